@@ -0,0 +1,279 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "AsyncWriter.h"
+#include "LogStream.h"
+#include <algorithm>
+#include <new>
+#include <vector>
+
+namespace
+{
+    std::atomic<size_t> nextShard(0);
+
+    size_t threadShard()
+    {
+        thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed);
+        return shard;
+    }
+}
+
+Log::AsyncWriter::AsyncWriter(size_t capacity, OverflowPolicy policy, size_t shards,
+                              std::chrono::microseconds window):
+        _shards(std::max<size_t>(shards, 1)), _mask(0), _policy(policy), _window(window), _dropped(0),
+        _highWater(0), _waiters(0), _sleeping(false), _stop(false)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    _mask = size - 1;
+    _queues.reset(new Queue[_shards]);
+    for (size_t i = 0; i < _shards; ++i)
+    {
+        Queue &queue = _queues[i];
+        queue.slots.reset(new Slot[size]);
+        for (size_t j = 0; j < size; ++j)
+            queue.slots[j].seq.store(j, std::memory_order_relaxed);
+        queue.tail.store(0, std::memory_order_relaxed);
+        queue.head.store(0, std::memory_order_relaxed);
+        queue.completed.store(0, std::memory_order_relaxed);
+    }
+    _thread = std::thread(&AsyncWriter::run, this);
+}
+
+Log::AsyncWriter::~AsyncWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop.store(true);
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+void Log::AsyncWriter::push(const LogRecord &record)
+{
+    Queue &queue = _queues[_shards == 1 ? 0 : threadShard() % _shards];
+    size_t pos;
+    Slot *slot = claim(queue, pos);
+    while (slot == nullptr)
+    {
+        switch (_policy)
+        {
+            case OverflowPolicy::DropNewest:
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            case OverflowPolicy::DropOldest:
+            {
+                size_t oldPos;
+                Slot *old = pop(queue, oldPos);
+                if (old != nullptr)
+                {
+                    release(*old, oldPos);
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+                break;
+            }
+            case OverflowPolicy::Block:
+                wakeConsumer();
+                std::this_thread::yield();
+                break;
+        }
+        slot = claim(queue, pos);
+    }
+    slot->record = record;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    wakeConsumer();
+}
+
+void Log::AsyncWriter::flush()
+{
+    // Queues are drained independently, waiting for them one by one waits for every record queued before the call
+    bool waiting = false;
+    for (size_t i = 0; i < _shards; ++i)
+    {
+        Queue &queue = _queues[i];
+        size_t target = queue.tail.load(std::memory_order_acquire);
+        if (queue.completed.load(std::memory_order_acquire) >= target)
+            continue;
+        if (!waiting)
+        {
+            _waiters.fetch_add(1);
+            waiting = true;
+        }
+        wakeConsumer();
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (queue.completed.load(std::memory_order_acquire) < target)
+            _done.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    if (waiting)
+        _waiters.fetch_sub(1);
+}
+
+void Log::AsyncWriter::afterForkChild()
+{
+    // Threads that held these or waited on them do not exist in the child, the parent's background thread
+    // neither, so its handle is abandoned instead of being joined
+    new (&_mutex) std::mutex;
+    new (&_wake) std::condition_variable;
+    new (&_done) std::condition_variable;
+    new (&_thread) std::thread;
+    for (size_t i = 0; i < _shards; ++i)
+    {
+        Queue &queue = _queues[i];
+        for (size_t j = 0; j <= _mask; ++j)
+            queue.slots[j].seq.store(j, std::memory_order_relaxed);
+        queue.tail.store(0, std::memory_order_relaxed);
+        queue.head.store(0, std::memory_order_relaxed);
+        queue.completed.store(0, std::memory_order_relaxed);
+    }
+    _waiters.store(0);
+    _sleeping.store(false);
+    _thread = std::thread(&AsyncWriter::run, this);
+}
+
+size_t Log::AsyncWriter::dropped() const
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+size_t Log::AsyncWriter::highWater() const
+{
+    return _highWater.load(std::memory_order_relaxed);
+}
+
+size_t Log::AsyncWriter::capacity() const
+{
+    return _mask + 1;
+}
+
+size_t Log::AsyncWriter::shards() const
+{
+    return _shards;
+}
+
+Log::OverflowPolicy Log::AsyncWriter::policy() const
+{
+    return _policy;
+}
+
+Log::AsyncWriter::Slot *Log::AsyncWriter::claim(Queue &queue, size_t &pos)
+{
+    pos = queue.tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot &slot = queue.slots[pos & _mask];
+        auto diff = static_cast<std::ptrdiff_t>(slot.seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            if (queue.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                return &slot;
+        }
+        else if (diff < 0)
+            return nullptr;
+        else
+            pos = queue.tail.load(std::memory_order_relaxed);
+    }
+}
+
+Log::AsyncWriter::Slot *Log::AsyncWriter::pop(Queue &queue, size_t &pos)
+{
+    pos = queue.head.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot &slot = queue.slots[pos & _mask];
+        auto diff = static_cast<std::ptrdiff_t>(slot.seq.load(std::memory_order_acquire) - (pos + 1));
+        if (diff == 0)
+        {
+            if (queue.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                return &slot;
+        }
+        else if (diff < 0)
+            return nullptr;
+        else
+            pos = queue.head.load(std::memory_order_relaxed);
+    }
+}
+
+void Log::AsyncWriter::release(Slot &slot, size_t pos)
+{
+    slot.seq.store(pos + _mask + 1, std::memory_order_release);
+}
+
+bool Log::AsyncWriter::ready(const Queue &queue) const
+{
+    size_t head = queue.head.load(std::memory_order_relaxed);
+    return queue.slots[head & _mask].seq.load(std::memory_order_relaxed) == head + 1;
+}
+
+void Log::AsyncWriter::wakeConsumer()
+{
+    // Pairs with the fence in run(): either the consumer sees the new record or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _wake.notify_one();
+    }
+}
+
+void Log::AsyncWriter::run()
+{
+    // Oldest record of every queue, taken out of the queue but not printed yet
+    std::vector<Slot *> staged(_shards, nullptr);
+    std::vector<size_t> positions(_shards, 0);
+    while (true)
+    {
+        size_t next = _shards;
+        bool complete = true;
+        for (size_t i = 0; i < _shards; ++i)
+        {
+            if (staged[i] == nullptr)
+            {
+                staged[i] = pop(_queues[i], positions[i]);
+                if (staged[i] != nullptr)
+                {
+                    size_t used = _queues[i].tail.load(std::memory_order_relaxed) - positions[i];
+                    if (used > _highWater.load(std::memory_order_relaxed))
+                        _highWater.store(used, std::memory_order_relaxed);
+                }
+            }
+            complete = complete && staged[i] != nullptr;
+            if (staged[i] != nullptr && (next == _shards || staged[i]->record.time < staged[next]->record.time))
+                next = i;
+        }
+        // An empty queue may still receive an older record, unless the writer is flushed or stopped
+        auto hold = std::chrono::system_clock::duration::zero();
+        if (next != _shards && !complete && _window.count() != 0 && _waiters.load(std::memory_order_relaxed) == 0 &&
+            !_stop.load())
+            hold = staged[next]->record.time + _window - std::chrono::system_clock::now();
+        if (next != _shards && hold.count() <= 0)
+        {
+            Slot *slot = staged[next];
+            slot->record.stream->printRecord(slot->record);
+            release(*slot, positions[next]);
+            staged[next] = nullptr;
+            _queues[next].completed.store(positions[next] + 1, std::memory_order_release);
+            if (_waiters.load(std::memory_order_relaxed) != 0)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _done.notify_all();
+            }
+            continue;
+        }
+        if (_stop.load() && next == _shards)
+            break;
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool pending = false;
+        for (size_t i = 0; i < _shards && !pending; ++i)
+            pending = staged[i] == nullptr && ready(_queues[i]);
+        if (!pending && !_stop.load())
+            _wake.wait_for(lock, hold.count() > 0 ? hold : std::chrono::milliseconds(100));
+        _sleeping.store(false, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _done.notify_all();
+}
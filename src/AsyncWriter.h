@@ -0,0 +1,161 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_ASYNCWRITER_H
+#define LOGGER_ASYNCWRITER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "LogRecord.h"
+
+namespace Log
+{
+    /*!
+     * Behaviour of an asynchronous writer when its queue is full
+     */
+    enum class OverflowPolicy
+    {
+        Block,      //!< Wait until the background thread frees a slot
+        DropNewest, //!< Discard the record that is being written
+        DropOldest, //!< Discard the oldest queued record
+    };
+
+    /*!
+     * Background writer fed by bounded lock-free multi-producer queues
+     * In sharded mode every thread pushes into one of several queues, the background thread
+     * merges queued records in timestamp order, so producers on different cores do not contend.
+     * While some queue is empty, the oldest record is held back until it is older than the reorder window,
+     * a record queued later than that after taking its timestamp may still be printed after newer ones.
+     */
+    class AsyncWriter
+    {
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> seq;
+            LogRecord record;
+        };
+
+        /*!
+         * Bounded multi-producer queue
+         */
+        struct Queue
+        {
+            std::unique_ptr<Slot[]> slots;
+            alignas(64) std::atomic<size_t> tail;
+            alignas(64) std::atomic<size_t> head;
+            alignas(64) std::atomic<size_t> completed;
+        };
+
+        std::unique_ptr<Queue[]> _queues;
+        size_t _shards;
+        size_t _mask;
+        OverflowPolicy _policy;
+        std::chrono::system_clock::duration _window;
+        std::atomic<size_t> _dropped;
+        std::atomic<size_t> _highWater;
+        std::atomic<size_t> _waiters;
+        std::atomic<bool> _sleeping;
+        std::atomic<bool> _stop;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        std::thread _thread;
+
+        Slot *claim(Queue &queue, size_t &pos);
+        Slot *pop(Queue &queue, size_t &pos);
+        void release(Slot &slot, size_t pos);
+        bool ready(const Queue &queue) const;
+        void wakeConsumer();
+        void run();
+    public:
+
+
+        /*!
+         * Constructor
+         * Starts the background thread
+         * @param capacity Maximum amount of queued records per queue, rounded up to a power of two
+         * @param policy Behaviour when a queue is full
+         * @param shards Amount of queues
+         * @param window Time an empty queue may still receive an older record than the other queues,
+         * records are held back for that long at most, only used with several queues
+         */
+        AsyncWriter(size_t capacity, OverflowPolicy policy, size_t shards = 1,
+                    std::chrono::microseconds window = std::chrono::microseconds(0));
+
+
+        /*!
+         * Destructor
+         * Writes all queued records and stops the background thread
+         */
+        ~AsyncWriter();
+
+        AsyncWriter(const AsyncWriter &) = delete;
+        AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+
+        /*!
+         * Queue a record to be printed into its stream
+         * @param record Captured message
+         */
+        void push(const LogRecord &record);
+
+
+        /*!
+         * Wait until every message queued before this call is printed
+         */
+        void flush();
+
+
+        /*!
+         * Restart the background thread in a forked child
+         * Records queued when the process forked belong to the parent and are discarded
+         * @note Must only be called in the child after fork
+         */
+        void afterForkChild();
+
+
+        /*!
+         * Get amount of records discarded because a queue was full
+         * @return Amount of discarded records
+         */
+        size_t dropped() const;
+
+
+        /*!
+         * Get the largest amount of records ever waiting in a single queue
+         * Records are stored in preallocated queue slots that keep their memory, the high-water mark
+         * close to the capacity means the queue is too small for bursts.
+         * @return Largest queue occupancy
+         */
+        size_t highWater() const;
+
+
+        /*!
+         * Get queue capacity
+         * @return Maximum amount of queued records per queue
+         */
+        size_t capacity() const;
+
+
+        /*!
+         * Get amount of queues
+         * @return Amount of queues
+         */
+        size_t shards() const;
+
+
+        /*!
+         * Get overflow policy
+         * @return Behaviour when the queue is full
+         */
+        OverflowPolicy policy() const;
+    };
+}
+
+#endif //LOGGER_ASYNCWRITER_H
@@ -0,0 +1,89 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "AtFork.h"
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <vector>
+#include <pthread.h>
+
+namespace
+{
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::pair<Log::ForkStage, Log::ForkListener *>> listeners;
+    };
+
+    // Never destroyed, listeners with static storage duration may outlive any other static object
+    Registry &registry()
+    {
+        static Registry *instance = new Registry();
+        return *instance;
+    }
+
+    constexpr Log::ForkStage stages[] = {Log::ForkStage::Logger, Log::ForkStage::Output, Log::ForkStage::Registry};
+
+    void prepare()
+    {
+        Registry &r = registry();
+        // Held until the fork completes, listeners cannot be added or removed in between
+        r.mutex.lock();
+        for (auto stage : stages)
+        {
+            for (auto i = r.listeners.rbegin(); i != r.listeners.rend(); ++i)
+            {
+                if (i->first == stage)
+                    i->second->beforeFork();
+            }
+        }
+    }
+
+    template <typename Callback>
+    void afterFork(Registry &r, Callback callback)
+    {
+        for (auto stage = std::rbegin(stages); stage != std::rend(stages); ++stage)
+        {
+            for (auto &listener : r.listeners)
+            {
+                if (listener.first == *stage)
+                    callback(*listener.second);
+            }
+        }
+        r.mutex.unlock();
+    }
+
+    void parent()
+    {
+        afterFork(registry(), [](Log::ForkListener &listener) { listener.afterForkParent(); });
+    }
+
+    void child()
+    {
+        afterFork(registry(), [](Log::ForkListener &listener) { listener.afterForkChild(); });
+    }
+}
+
+void Log::addForkListener(ForkListener *listener, ForkStage stage)
+{
+    static std::once_flag registered;
+    std::call_once(registered, []()
+    {
+        pthread_atfork(prepare, parent, child);
+    });
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.listeners.emplace_back(stage, listener);
+}
+
+void Log::removeForkListener(ForkListener *listener)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.listeners.erase(std::remove_if(r.listeners.begin(), r.listeners.end(), [listener](const auto &i)
+    {
+        return i.second == listener;
+    }), r.listeners.end());
+}
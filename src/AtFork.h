@@ -0,0 +1,72 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_ATFORK_H
+#define LOGGER_ATFORK_H
+
+namespace Log
+{
+    /*!
+     * Object that has to be brought into a consistent state around fork()
+     * Listeners are called from pthread_atfork handlers registered once by the library.
+     * Only the forking thread exists in the child, so locks held by other threads are never released there
+     * and background threads are gone.
+     */
+    class ForkListener
+    {
+    public:
+        virtual ~ForkListener() = default;
+
+
+        /*!
+         * Called in the parent before fork, stage by stage, in reverse order of registration within a stage
+         * Must wait for pending output and acquire locks that other threads may hold
+         */
+        virtual void beforeFork() = 0;
+
+
+        /*!
+         * Called in the parent after fork, stages and listeners in reverse order of beforeFork()
+         * Releases locks acquired by beforeFork()
+         */
+        virtual void afterForkParent() = 0;
+
+
+        /*!
+         * Called in the child after fork, stages and listeners in reverse order of beforeFork()
+         * Releases locks acquired by beforeFork() and restarts background threads
+         */
+        virtual void afterForkChild() = 0;
+    };
+
+
+    /*!
+     * Order in which fork listeners are prepared
+     * A stage only depends on later ones: a logger waits for its output, which may take a registry lock,
+     * so the logger is quiesced before its output is locked. Children restart later stages first.
+     */
+    enum class ForkStage
+    {
+        Logger,     //!< Loggers, write queued records and take output locks
+        Output,     //!< Outputs with their own locks and threads, e.g. files and sinks
+        Registry,   //!< Process-wide registries taken by the first use of something
+    };
+
+
+    /*!
+     * Register a fork listener
+     * @param listener Listener, must be removed before it is destroyed
+     * @param stage Stage the listener is prepared in
+     */
+    void addForkListener(ForkListener *listener, ForkStage stage);
+
+
+    /*!
+     * Remove a fork listener
+     * @param listener Listener
+     */
+    void removeForkListener(ForkListener *listener);
+}
+
+#endif //LOGGER_ATFORK_H
@@ -0,0 +1,499 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "BatchSink.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <vector>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// Writes at the current file position need IORING_FEAT_RW_CUR_POS, older headers do not have it
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define LOGGER_HAVE_URING 1
+#else
+#define LOGGER_HAVE_URING 0
+#endif
+
+namespace
+{
+    void writeFully(int fd, iovec *iov, size_t count)
+    {
+        while (count != 0)
+        {
+            ssize_t written = writev(fd, iov, int(std::min<size_t>(count, IOV_MAX)));
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            // Skip fully written parts and advance into a partially written one
+            auto left = size_t(written);
+            while (count != 0 && left >= iov->iov_len)
+            {
+                left -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count != 0)
+            {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + left;
+                iov->iov_len -= left;
+            }
+        }
+    }
+}
+
+/*!
+ * Minimal io_uring submitting linked writes of registered buffers
+ * Uses system calls directly, so liburing is not needed
+ */
+class Log::BatchSink::Uring
+{
+private:
+#if LOGGER_HAVE_URING
+    int _fd = -1;
+    void *_sqRing = MAP_FAILED;
+    void *_cqRing = MAP_FAILED;
+    void *_sqes = MAP_FAILED;
+    size_t _sqRingSize = 0;
+    size_t _cqRingSize = 0;
+    size_t _sqesSize = 0;
+    unsigned *_sqTail = nullptr;
+    unsigned *_sqArray = nullptr;
+    unsigned _sqMask = 0;
+    unsigned *_cqHead = nullptr;
+    unsigned *_cqTail = nullptr;
+    unsigned _cqMask = 0;
+    io_uring_cqe *_cqes = nullptr;
+    const char *_base = nullptr;
+    size_t _chunkSize = 0;
+    std::vector<int> _results;
+    bool _broken = false;
+
+    template <typename T>
+    static T *at(void *ring, size_t offset)
+    { return reinterpret_cast<T *>(static_cast<char *>(ring) + offset); }
+#endif
+public:
+#if LOGGER_HAVE_URING
+    ~Uring()
+    {
+        if (_sqes != MAP_FAILED)
+            munmap(_sqes, _sqesSize);
+        if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+            munmap(_cqRing, _cqRingSize);
+        if (_sqRing != MAP_FAILED)
+            munmap(_sqRing, _sqRingSize);
+        if (_fd >= 0)
+            close(_fd);
+    }
+
+    bool open(char *base, size_t chunkSize, size_t chunks)
+    {
+        io_uring_params params{};
+        long fd = syscall(__NR_io_uring_setup, unsigned(chunks), &params);
+        if (fd < 0)
+            return false;
+        _fd = int(fd);
+        if ((params.features & IORING_FEAT_RW_CUR_POS) == 0)
+            return false;
+        _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+        _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+                       IORING_OFF_SQ_RING);
+        if (_sqRing == MAP_FAILED)
+            return false;
+        _cqRing = single ? _sqRing : mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                          _fd, IORING_OFF_CQ_RING);
+        _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (_cqRing == MAP_FAILED || _sqes == MAP_FAILED)
+            return false;
+        _sqTail = at<unsigned>(_sqRing, params.sq_off.tail);
+        _sqArray = at<unsigned>(_sqRing, params.sq_off.array);
+        _sqMask = *at<unsigned>(_sqRing, params.sq_off.ring_mask);
+        _cqHead = at<unsigned>(_cqRing, params.cq_off.head);
+        _cqTail = at<unsigned>(_cqRing, params.cq_off.tail);
+        _cqMask = *at<unsigned>(_cqRing, params.cq_off.ring_mask);
+        _cqes = at<io_uring_cqe>(_cqRing, params.cq_off.cqes);
+        _base = base;
+        _chunkSize = chunkSize;
+        _results.resize(chunks);
+        // Registered chunks are pinned once instead of on every write, may fail with a low RLIMIT_MEMLOCK
+        std::vector<iovec> buffers(chunks);
+        for (size_t i = 0; i < chunks; ++i)
+            buffers[i] = {base + i * chunkSize, chunkSize};
+        return syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, buffers.data(), unsigned(chunks)) == 0;
+    }
+
+    /*!
+     * Write chunks in order
+     * A write that fails or is short cancels the following ones
+     * @return Amount of bytes written before the first incomplete write
+     */
+    size_t write(int fd, const iovec *iov, size_t count)
+    {
+        unsigned tail = *_sqTail;
+        for (size_t i = 0; i < count; ++i)
+        {
+            unsigned index = tail++ & _sqMask;
+            io_uring_sqe &sqe = static_cast<io_uring_sqe *>(_sqes)[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_WRITE_FIXED;
+            sqe.fd = fd;
+            sqe.off = UINT64_MAX;
+            sqe.addr = uint64_t(reinterpret_cast<uintptr_t>(iov[i].iov_base));
+            sqe.len = unsigned(iov[i].iov_len);
+            sqe.buf_index = uint16_t((static_cast<const char *>(iov[i].iov_base) - _base) / ptrdiff_t(_chunkSize));
+            sqe.flags = i + 1 < count ? IOSQE_IO_LINK : 0;
+            sqe.user_data = i;
+            _sqArray[index] = index;
+        }
+        __atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+        size_t submitted = 0;
+        size_t completed = 0;
+        while (completed < count)
+        {
+            long result = syscall(__NR_io_uring_enter, _fd, unsigned(count - submitted), unsigned(count - completed),
+                                  IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                // Entries left in the ring could be submitted later, the ring is not used anymore
+                _broken = true;
+                return 0;
+            }
+            submitted += size_t(result);
+            unsigned head = *_cqHead;
+            unsigned end = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+            for (; head != end; ++head, ++completed)
+            {
+                const io_uring_cqe &cqe = _cqes[head & _cqMask];
+                _results[cqe.user_data] = cqe.res;
+            }
+            __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+        }
+        size_t written = 0;
+        for (size_t i = 0; i < count && _results[i] >= 0; ++i)
+        {
+            written += size_t(_results[i]);
+            if (size_t(_results[i]) != iov[i].iov_len)
+                break;
+        }
+        return written;
+    }
+
+    bool broken() const
+    { return _broken; }
+#else
+    bool open(char *, size_t, size_t)
+    { return false; }
+
+    size_t write(int, const iovec *, size_t)
+    { return 0; }
+
+    bool broken() const
+    { return true; }
+#endif
+};
+
+Log::BatchSink::BatchSink(int fd, bool owned, const BatchPolicy &policy): _fd(fd), _owned(owned), _policy(policy),
+        _head(0), _tail(0), _committed(0), _tickets(0), _appended(0), _written(0), _lastBatch(0), _state(Busy),
+        _urgent(false), _stop(false)
+{
+    _policy.chunkSize = std::max<size_t>(_policy.chunkSize, 1);
+    _policy.chunks = std::clamp<size_t>(_policy.chunks, 2, IOV_MAX);
+    _memory.reset(new char[_policy.chunkSize * _policy.chunks]);
+    _iov.reset(new iovec[_policy.chunks]);
+    if (_policy.uring)
+    {
+        _uring.reset(new Uring);
+        if (!_uring->open(_memory.get(), _policy.chunkSize, _policy.chunks))
+            _uring.reset();
+    }
+    _thread = std::thread(&BatchSink::run, this);
+    addForkListener(this, ForkStage::Output);
+}
+
+Log::BatchSink::~BatchSink()
+{
+    removeForkListener(this);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+    _uring.reset();
+    if (_owned && _fd >= 0)
+        close(_fd);
+}
+
+void Log::BatchSink::write(const std::string_view *parts, size_t count)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+        total += parts[i].size();
+    size_t chunkSize = _policy.chunkSize;
+    size_t capacity = _policy.chunks * chunkSize;
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (total > capacity)
+    {
+        writeDirect(lock, parts, count, total);
+        return;
+    }
+    // A chunk is reused only once it is written completely
+    auto fits = [this, total, chunkSize, capacity]()
+    { return _tail + total <= _head / chunkSize * chunkSize + capacity; };
+    if (!fits())
+    {
+        ++_stats.stalls;
+        _space.wait(lock, fits);
+    }
+    uint64_t start = _tail;
+    _tail += total;
+    _appended += total;
+    lock.unlock();
+    uint64_t position = start;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char *data = parts[i].data();
+        size_t size = parts[i].size();
+        while (size != 0)
+        {
+            size_t offset = size_t(position % chunkSize);
+            size_t length = std::min(size, chunkSize - offset);
+            std::memcpy(chunk(position / chunkSize) + offset, data, length);
+            position += length;
+            data += length;
+            size -= length;
+        }
+    }
+    // Records are published in the order space was reserved, the preceding one is being copied right now
+    while (_committed.load(std::memory_order_acquire) != start)
+        std::this_thread::yield();
+    _committed.store(position, std::memory_order_release);
+    // Pairs with the fence in run(): either the writer sees the record or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint8_t state = _state.load(std::memory_order_relaxed);
+    // A lingering writer only waits for a filled chunk
+    if (state == Idle || (state == Lingering && position / chunkSize != start / chunkSize))
+        wakeWriter();
+}
+
+void Log::BatchSink::writeDirect(std::unique_lock<std::mutex> &lock, const std::string_view *parts, size_t count,
+                                 size_t total)
+{
+    // Takes its place among records reserved by other threads, which keep filling the ring meanwhile
+    Direct direct{_tail, _tickets++};
+    _directs.push_back(direct);
+    _appended += total;
+    ++_stats.stalls;
+    _urgent = true;
+    if (_state.load(std::memory_order_relaxed) != Busy)
+        _wake.notify_one();
+    _done.wait(lock, [this, &direct]()
+    { return _head == direct.position && _directs.front().ticket == direct.ticket; });
+    lock.unlock();
+    iovec iov[8];
+    for (size_t i = 0; i < count; i += std::size(iov))
+    {
+        size_t batch = std::min(count - i, std::size(iov));
+        for (size_t j = 0; j < batch; ++j)
+            iov[j] = {const_cast<char *>(parts[i + j].data()), parts[i + j].size()};
+        writeFully(_fd, iov, batch);
+    }
+    lock.lock();
+    _directs.pop_front();
+    _written += total;
+    ++_stats.batches;
+    _stats.bytes += total;
+    _stats.largestBatch = std::max(_stats.largestBatch, total);
+    _done.notify_all();
+    _wake.notify_one();
+}
+
+void Log::BatchSink::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t target = _appended;
+    if (_written >= target)
+        return;
+    _urgent = true;
+    if (_state.load(std::memory_order_relaxed) != Busy)
+        _wake.notify_one();
+    _done.wait(lock, [this, target]() { return _written >= target; });
+}
+
+bool Log::BatchSink::threadSafe() const
+{
+    return true;
+}
+
+int Log::BatchSink::fd() const
+{
+    return _fd;
+}
+
+bool Log::BatchSink::usesUring() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _uring != nullptr;
+}
+
+Log::BatchStats Log::BatchSink::stats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+char *Log::BatchSink::chunk(uint64_t index) const
+{
+    return _memory.get() + size_t(index % _policy.chunks) * _policy.chunkSize;
+}
+
+uint64_t Log::BatchSink::limit() const
+{
+    uint64_t end = _committed.load(std::memory_order_acquire);
+    // Ring data reserved after a direct record waits until it is written
+    if (!_directs.empty())
+        end = std::min(end, _directs.front().position);
+    return end;
+}
+
+void Log::BatchSink::wakeWriter()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _wake.notify_one();
+}
+
+void Log::BatchSink::submit(uint64_t first, uint64_t end)
+{
+    size_t count = 0;
+    for (uint64_t position = first; position != end;)
+    {
+        size_t offset = size_t(position % _policy.chunkSize);
+        size_t length = size_t(std::min<uint64_t>(_policy.chunkSize - offset, end - position));
+        _iov[count++] = {chunk(position / _policy.chunkSize) + offset, length};
+        position += length;
+    }
+    iovec *iov = _iov.get();
+    if (_uring != nullptr)
+    {
+        // Whatever io_uring did not write is written with writev()
+        size_t left = _uring->write(_fd, iov, count);
+        for (; count != 0 && left >= iov->iov_len; ++iov, --count)
+            left -= iov->iov_len;
+        if (count != 0)
+        {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+        if (_uring->broken())
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _uring.reset();
+        }
+    }
+    writeFully(_fd, iov, count);
+}
+
+void Log::BatchSink::run()
+{
+    size_t chunkSize = _policy.chunkSize;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _state.store(Idle, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _wake.wait(lock, [this]() { return _stop || _urgent || limit() != _head; });
+        _state.store(Busy, std::memory_order_relaxed);
+        if (limit() == _head)
+        {
+            if (_stop && _directs.empty())
+                break;
+            _urgent = false;
+            continue;
+        }
+        // Output is busy, let the chunk being filled grow into a bigger batch
+        uint64_t filled = (_head / chunkSize + 1) * chunkSize;
+        if (limit() < filled && !_urgent && !_stop && _lastBatch >= chunkSize && _policy.maxDelay.count() != 0)
+        {
+            _state.store(Lingering, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            _wake.wait_for(lock, _policy.maxDelay, [this, filled]()
+            { return _stop || _urgent || limit() >= filled; });
+            _state.store(Busy, std::memory_order_relaxed);
+        }
+        _urgent = false;
+        uint64_t first = _head;
+        uint64_t end = limit();
+        // Writers keep appending behind the batch, its chunks are not reused until it is written
+        lock.unlock();
+        submit(first, end);
+        lock.lock();
+        _head = end;
+        uint64_t bytes = end - first;
+        _written += bytes;
+        _lastBatch = bytes;
+        ++_stats.batches;
+        _stats.bytes += bytes;
+        _stats.largestBatch = std::max(_stats.largestBatch, size_t(bytes));
+        _space.notify_all();
+        _done.notify_all();
+    }
+}
+
+void Log::BatchSink::beforeFork()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t target = _appended;
+    _urgent = true;
+    if (_state.load(std::memory_order_relaxed) != Busy)
+        _wake.notify_one();
+    _done.wait(lock, [this, target]() { return _written >= target; });
+    // Stays locked until after fork
+    lock.release();
+}
+
+void Log::BatchSink::afterForkParent()
+{
+    _mutex.unlock();
+}
+
+void Log::BatchSink::afterForkChild()
+{
+    // Everything reserved before fork was written by the parent, the ring is reused from its end
+    _uring.reset();
+    _head = _tail;
+    _committed.store(_tail, std::memory_order_relaxed);
+    _directs.clear();
+    // Records reserved by threads that do not exist in the child are never going to be written
+    _written = _appended;
+    _state.store(Busy, std::memory_order_relaxed);
+    _urgent = false;
+    // The background thread does not exist in the child, its handle is abandoned instead of being joined
+    new (&_wake) std::condition_variable;
+    new (&_space) std::condition_variable;
+    new (&_done) std::condition_variable;
+    new (&_thread) std::thread;
+    _mutex.unlock();
+    _thread = std::thread(&BatchSink::run, this);
+}
@@ -0,0 +1,174 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_BATCHSINK_H
+#define LOGGER_BATCHSINK_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "AtFork.h"
+#include "Sink.h"
+
+struct iovec;
+
+namespace Log
+{
+    /*!
+     * Buffering and batching parameters of a BatchSink
+     */
+    struct BatchPolicy
+    {
+        size_t chunkSize = 64 * 1024;                   //!< Size of a buffer chunk, the unit of a batch
+        size_t chunks = 8;                              //!< Amount of chunks, writers wait when all of them are full
+        std::chrono::microseconds maxDelay{200};        //!< Longest time a batch waits for a chunk to fill
+                                                        //!< while output is busy, 0 to never wait
+        bool uring = true;                              //!< Submit batches with io_uring where available
+    };
+
+    /*!
+     * Statistics of a BatchSink
+     */
+    struct BatchStats
+    {
+        uint64_t batches = 0;       //!< Batches written
+        uint64_t bytes = 0;         //!< Bytes written
+        size_t largestBatch = 0;    //!< Size of the largest batch in bytes
+        uint64_t stalls = 0;        //!< Times a thread waited for a free chunk
+    };
+
+    /*!
+     * Sink collecting records of many threads into a file descriptor with batched writes
+     * Records are copied into a ring of buffer chunks, a background thread writes every filled chunk and
+     * the chunk being filled with one writev(), or with linked io_uring writes of registered chunks.
+     * Writers only take the lock to reserve space, records are copied outside of it and published
+     * in the order space was reserved. A record larger than the ring keeps its place in that order
+     * and is written directly by its thread, also without holding the lock.
+     * Batches grow with load: while the previous batch filled a chunk, a partially filled chunk waits
+     * up to BatchPolicy::maxDelay for more records, an idle sink writes a record as soon as it arrives.
+     * Before fork the sink waits for pending output after the loggers writing into it are quiesced,
+     * a forked child drops output pending at fork, which is written by the parent, and uses writev().
+     */
+    class BatchSink : public Sink, private ForkListener
+    {
+    private:
+        class Uring;
+
+        /*!
+         * State of the background thread, read by writers to decide if it needs a wakeup
+         */
+        enum State : uint8_t
+        {
+            Busy,
+            Idle,
+            Lingering,
+        };
+
+        /*!
+         * Record larger than the ring, written after the ring data preceding it
+         */
+        struct Direct
+        {
+            uint64_t position;
+            uint64_t ticket;
+        };
+
+        int _fd;
+        bool _owned;
+        BatchPolicy _policy;
+        std::unique_ptr<char[]> _memory;
+        std::unique_ptr<Uring> _uring;
+        std::unique_ptr<iovec[]> _iov;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _space;
+        std::condition_variable _done;
+        uint64_t _head;
+        uint64_t _tail;
+        std::atomic<uint64_t> _committed;
+        std::deque<Direct> _directs;
+        uint64_t _tickets;
+        uint64_t _appended;
+        uint64_t _written;
+        uint64_t _lastBatch;
+        std::atomic<uint8_t> _state;
+        bool _urgent;
+        bool _stop;
+        BatchStats _stats;
+        std::thread _thread;
+
+        char *chunk(uint64_t index) const;
+        uint64_t limit() const;
+        void wakeWriter();
+        void writeDirect(std::unique_lock<std::mutex> &lock, const std::string_view *parts, size_t count,
+                         size_t total);
+        void submit(uint64_t first, uint64_t end);
+        void run();
+        void beforeFork() override;
+        void afterForkParent() override;
+        void afterForkChild() override;
+    public:
+
+
+        /*!
+         * Constructor
+         * Starts the background thread
+         * @param fd File descriptor
+         * @param owned true to close the descriptor when the sink is destroyed
+         * @param policy Batching parameters
+         */
+        explicit BatchSink(int fd, bool owned = false, const BatchPolicy &policy = BatchPolicy());
+
+
+        /*!
+         * Destructor
+         * Writes pending records, stops the background thread and closes the descriptor if owned
+         */
+        ~BatchSink() override;
+
+        void write(const std::string_view *parts, size_t count) override;
+
+
+        /*!
+         * Wait until records written so far are passed to the kernel
+         * Records are only batched while nobody waits for them, so streams writing into the sink
+         * should use a flush policy other than FlushPolicy::everyRecord()
+         */
+        void flush() override;
+
+        bool threadSafe() const override;
+
+
+        /*!
+         * Get file descriptor
+         * @return File descriptor
+         */
+        int fd() const;
+
+
+        /*!
+         * Check if batches are submitted with io_uring
+         * @return true if io_uring is used, false if writev() is
+         */
+        bool usesUring() const;
+
+
+        /*!
+         * Get statistics
+         * @return Statistics
+         */
+        BatchStats stats() const;
+
+        BatchSink(const BatchSink &) = delete;
+        BatchSink &operator=(const BatchSink &) = delete;
+    };
+}
+
+#endif //LOGGER_BATCHSINK_H
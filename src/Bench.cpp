@@ -0,0 +1,335 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Logger benchmark suite
+ * Usage: LoggerBench [--json] [--iterations N] [--threads N] [--filter SUBSTRING]
+ *
+ * Every scenario reports per-call latency percentiles and total throughput of all threads.
+ * Latency is sampled per batch of calls, batches are a single call unless the call is too cheap to time.
+ */
+
+namespace
+{
+    /*!
+     * Benchmark scenario
+     */
+    struct Scenario
+    {
+        std::string name;
+        size_t threads;
+        size_t batch;
+        std::function<void()> setup;
+        std::function<void()> call;
+    };
+
+    /*!
+     * Scenario results
+     */
+    struct Result
+    {
+        std::string name;
+        size_t threads;
+        size_t calls;
+        double msgsPerSec;
+        double p50;
+        double p99;
+        double p999;
+    };
+
+    struct Options
+    {
+        bool json = false;
+        size_t iterations = 200000;
+        size_t threads = std::max(2u, std::min(4u, std::thread::hardware_concurrency()));
+        std::string filter;
+    };
+
+    std::string expensiveDump()
+    {
+        std::string result;
+        for (size_t i = 0; i < 100; ++i)
+            result += std::to_string(i) + ' ';
+        return result;
+    }
+
+    double percentile(std::vector<double> &samples, double fraction)
+    {
+        if (samples.empty())
+            return 0;
+        auto index = std::min(samples.size() - 1, size_t(fraction * double(samples.size())));
+        std::nth_element(samples.begin(), samples.begin() + std::ptrdiff_t(index), samples.end());
+        return samples[index];
+    }
+
+    Result run(const Scenario &scenario, size_t iterations)
+    {
+        if (scenario.setup)
+            scenario.setup();
+        size_t batches = std::max<size_t>(1, iterations / scenario.batch);
+        std::vector<std::vector<double>> samples(scenario.threads);
+        auto worker = [&scenario, batches](std::vector<double> &out)
+        {
+            out.reserve(batches);
+            for (size_t i = 0; i < batches; ++i)
+            {
+                auto start = std::chrono::steady_clock::now();
+                for (size_t j = 0; j < scenario.batch; ++j)
+                    scenario.call();
+                auto end = std::chrono::steady_clock::now();
+                out.push_back(double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) /
+                              double(scenario.batch));
+            }
+        };
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < scenario.threads; ++i)
+            threads.emplace_back(worker, std::ref(samples[i]));
+        worker(samples[0]);
+        for (auto &thread : threads)
+            thread.join();
+        Log::defaultLog.flush();
+        auto end = std::chrono::steady_clock::now();
+
+        std::vector<double> all;
+        for (auto &i : samples)
+            all.insert(all.end(), i.begin(), i.end());
+        Result result;
+        result.name = scenario.name;
+        result.threads = scenario.threads;
+        result.calls = batches * scenario.batch * scenario.threads;
+        result.msgsPerSec = double(result.calls) / std::chrono::duration<double>(end - start).count();
+        result.p50 = percentile(all, 0.5);
+        result.p99 = percentile(all, 0.99);
+        result.p999 = percentile(all, 0.999);
+        return result;
+    }
+
+    /*!
+     * Restore settings of the default logger changed by scenario setups, so they do not leak into later scenarios
+     * @param out Stream for the levels a setup disabled
+     */
+    void reset(std::ostream &out)
+    {
+        Log::defaultLog.disableAsync();
+        Log::defaultLog.disableFlightRecorder();
+        for (size_t i = 0; i < Log::levels; ++i)
+            LOGGER_SET_FORMAT(Log::LogLevel(i), Log::OutputFormat::Text);
+        Log::defaultLog.setFlushPolicy(Log::FlushPolicy::everyRecord());
+        LOGGER_SET_STREAM(Log::Verbose, out);
+        LOGGER_SET_SCOPE_THRESHOLD(std::chrono::nanoseconds(0));
+    }
+
+    void printText(const std::vector<Result> &results)
+    {
+        std::cout << std::left << std::setw(32) << "scenario" << std::right << std::setw(8) << "threads"
+                  << std::setw(14) << "msgs/sec" << std::setw(12) << "p50 ns" << std::setw(12) << "p99 ns"
+                  << std::setw(12) << "p999 ns" << '\n';
+        std::cout << std::fixed << std::setprecision(1);
+        for (const auto &i : results)
+        {
+            std::cout << std::left << std::setw(32) << i.name << std::right << std::setw(8) << i.threads
+                      << std::setw(14) << std::setprecision(0) << i.msgsPerSec << std::setprecision(1)
+                      << std::setw(12) << i.p50 << std::setw(12) << i.p99 << std::setw(12) << i.p999 << '\n';
+        }
+    }
+
+    void printJson(const std::vector<Result> &results)
+    {
+        std::cout << "{\"benchmarks\":[";
+        std::cout << std::fixed << std::setprecision(1);
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto &result = results[i];
+            std::cout << (i == 0 ? "" : ",") << "\n  {\"name\":\"" << result.name << "\",\"threads\":"
+                      << result.threads << ",\"calls\":" << result.calls << ",\"msgs_per_sec\":"
+                      << result.msgsPerSec << ",\"p50_ns\":" << result.p50 << ",\"p99_ns\":" << result.p99
+                      << ",\"p999_ns\":" << result.p999 << "}";
+        }
+        std::cout << "\n]}" << std::endl;
+    }
+
+    bool parse(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--json")
+                options.json = true;
+            else if (arg == "--iterations" && hasValue)
+                options.iterations = std::stoul(argv[++i]);
+            else if (arg == "--threads" && hasValue)
+                options.threads = std::max<size_t>(1, std::stoul(argv[++i]));
+            else if (arg == "--filter" && hasValue)
+                options.filter = argv[++i];
+            else
+            {
+                std::cerr << "Usage: " << argv[0] << " [--json] [--iterations N] [--threads N] [--filter SUBSTRING]"
+                          << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+        return 1;
+
+    std::ofstream devNull("/dev/null");
+    std::string filePath = std::string(P_tmpdir) + "/LoggerBench." + std::to_string(getpid()) + ".log";
+    std::ofstream file(filePath);
+    std::stringstream stringStream;
+    const std::string message = "connection 42 accepted from 127.0.0.1:5555";
+    const std::string multiline = "first line\nsecond line\nthird line\nfourth line";
+    int id = 42;
+    double dt = 12.5;
+
+    std::vector<Scenario> scenarios;
+    scenarios.push_back({"disabled LOG_VERBOSE", 1, 1000, []()
+    {
+        LOGGER_DISABLE_LEVEL(Log::Verbose);
+    }, []()
+    {
+        LOG_VERBOSE(expensiveDump());
+    }});
+    struct Sink
+    {
+        const char *name;
+        std::ostream &stream;
+    };
+    for (const Sink &sink : {Sink{"/dev/null", devNull}, Sink{"file", file}, Sink{"stringstream", stringStream}})
+    {
+        for (size_t threads : {size_t(1), options.threads})
+        {
+            auto setup = [&stream = sink.stream, &stringStream]()
+            {
+                stringStream.str(std::string());
+                LOGGER_SET_STREAM(Log::Info, stream);
+            };
+            scenarios.push_back({std::string("LOG_INFO ") + sink.name, threads, 1, setup, [&message]()
+            {
+                LOG_INFO(message);
+            }});
+        }
+    }
+    auto toDevNull = [&devNull]()
+    {
+        LOGGER_SET_STREAM(Log::Info, devNull);
+    };
+    scenarios.push_back({"multi-line printStr", 1, 1, toDevNull, [&multiline]()
+    {
+        LOG_INFO(multiline);
+    }});
+    scenarios.push_back({"variadic print", 1, 1, toDevNull, [&message, id, dt]()
+    {
+        Log::defaultLog.print(Log::Info, 0, __func__, message, id, dt, "done");
+    }});
+    scenarios.push_back({"LOG_INFO_FMT", 1, 1, toDevNull, [id, dt]()
+    {
+        LOG_INFO_FMT("conn {} took {} us", id, dt);
+    }});
+    auto fdSink = std::make_shared<Log::FdSink>(open("/dev/null", O_WRONLY | O_CLOEXEC), true);
+    for (size_t threads : {size_t(1), options.threads})
+    {
+        scenarios.push_back({"LOG_INFO fd sink /dev/null", threads, 1, [fdSink]()
+        {
+            LOGGER_SET_STREAM(Log::Info, fdSink);
+        }, [&message]()
+        {
+            LOG_INFO(message);
+        }});
+    }
+    scenarios.push_back({"sharded LOG_INFO /dev/null", options.threads, 1, [&devNull, &options]()
+    {
+        LOGGER_SET_STREAM(Log::Info, devNull);
+        Log::defaultLog.enableSharded(options.threads, 8192);
+    }, [&message]()
+    {
+        LOG_INFO(message);
+    }});
+    scenarios.push_back({"flight recorder LOG_VERBOSE", 1, 1, []()
+    {
+        LOGGER_DISABLE_LEVEL(Log::Verbose);
+        LOGGER_ENABLE_FLIGHT_RECORDER(64 * 1024);
+    }, [&message]()
+    {
+        LOG_VERBOSE(message);
+    }});
+    scenarios.push_back({"LOG_INFO_KV json", 1, 1, [&devNull]()
+    {
+        LOGGER_SET_STREAM(Log::Info, devNull);
+        LOGGER_SET_FORMAT(Log::Info, Log::OutputFormat::Json);
+    }, [&message, id, dt]()
+    {
+        LOG_INFO_KV(message, "id", id, "latency_us", dt, "peer", "127.0.0.1:5555");
+    }});
+    scenarios.push_back({"LOG_SCOPE under threshold", 1, 100, [&devNull]()
+    {
+        LOGGER_SET_STREAM(Log::Info, devNull);
+        LOGGER_SET_SCOPE_THRESHOLD(std::chrono::seconds(1));
+    }, []()
+    {
+        LOG_SCOPE("phase");
+    }});
+    // Compared with "LOG_INFO file", which flushes the stream after every record like std::endl does
+    std::string batchPath = filePath + ".batch";
+    for (bool uring : {true, false})
+    {
+        Log::BatchPolicy policy;
+        policy.uring = uring;
+        auto batchSink = std::make_shared<Log::BatchSink>(open(batchPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+                                                                                  O_CLOEXEC, 0644), true, policy);
+        std::string name = std::string("LOG_INFO batched ") + (batchSink->usesUring() ? "io_uring" : "writev") + " file";
+        for (size_t threads : {size_t(1), options.threads})
+        {
+            scenarios.push_back({name, threads, 1, [batchSink]()
+            {
+                LOGGER_SET_STREAM(Log::Info, batchSink);
+                LOGGER_SET_FLUSH_POLICY(Log::Info, Log::FlushPolicy::manual());
+            }, [&message]()
+            {
+                LOG_INFO(message);
+            }});
+        }
+    }
+
+    std::vector<Result> results;
+    for (const auto &scenario : scenarios)
+    {
+        if (scenario.name.find(options.filter) == std::string::npos)
+            continue;
+        size_t iterations = scenario.batch > 1 ? options.iterations * 50 : options.iterations;
+        results.push_back(run(scenario, iterations));
+        reset(devNull);
+    }
+    std::remove(filePath.c_str());
+    std::remove(batchPath.c_str());
+
+    if (options.json)
+        printJson(results);
+    else
+        printText(results);
+    return 0;
+}
@@ -0,0 +1,291 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "BinaryFormat.h"
+#include "TextFormat.h"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+    constexpr char magic[] = {'L', 'O', 'G', 'B'};
+    constexpr uint8_t version = 1;
+
+    //! Corrupt length prefixes must not allocate more than this ahead of the data actually read
+    constexpr size_t readChunk = 64 * 1024;
+
+    //! Deepest indentation a record can have, deeper is treated as corruption
+    constexpr uint64_t maxIndent = 4096;
+
+    /*!
+     * Process-wide tag table
+     */
+    struct TagTable
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, uint32_t> ids;
+    };
+
+    TagTable &tagTable()
+    {
+        static TagTable table;
+        return table;
+    }
+
+    /*!
+     * Per-thread direct-mapped cache in front of the tag table
+     */
+    struct TagCacheEntry
+    {
+        size_t hash = 0;
+        uint32_t id = 0;
+        bool valid = false;
+        std::string tag;
+    };
+
+    constexpr size_t tagCacheSize = 256;
+
+    thread_local TagCacheEntry tagCache[tagCacheSize];
+
+    void putVarint(std::string &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(char(uint8_t(value) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+
+    void putFixed64(std::string &out, uint64_t value)
+    {
+        for (size_t i = 0; i < 8; ++i)
+            out.push_back(char(uint8_t(value >> (8 * i))));
+    }
+
+    bool getByte(std::istream &in, uint8_t &value)
+    {
+        auto ch = in.get();
+        if (ch == std::istream::traits_type::eof())
+            return false;
+        value = uint8_t(ch);
+        return true;
+    }
+
+    bool getVarint(std::istream &in, uint64_t &value)
+    {
+        value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            uint8_t byte;
+            if (!getByte(in, byte))
+                return false;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool getFixed64(std::istream &in, uint64_t &value)
+    {
+        value = 0;
+        for (unsigned i = 0; i < 8; ++i)
+        {
+            uint8_t byte;
+            if (!getByte(in, byte))
+                return false;
+            value |= uint64_t(byte) << (8 * i);
+        }
+        return true;
+    }
+
+    bool getBytes(std::istream &in, std::string &value)
+    {
+        uint64_t length;
+        if (!getVarint(in, length))
+            return false;
+        value.clear();
+        while (value.size() < length)
+        {
+            size_t start = value.size();
+            auto chunk = size_t(std::min<uint64_t>(length - start, readChunk));
+            value.resize(start + chunk);
+            in.read(value.data() + start, std::streamsize(chunk));
+            if (in.gcount() != std::streamsize(chunk))
+                return false;
+        }
+        return true;
+    }
+}
+
+uint32_t Log::internTag(std::string_view tag)
+{
+    size_t hash = std::hash<std::string_view>()(tag);
+    TagCacheEntry &entry = tagCache[hash % tagCacheSize];
+    if (entry.valid && entry.hash == hash && entry.tag == tag)
+        return entry.id;
+    TagTable &table = tagTable();
+    uint32_t id;
+    {
+        std::lock_guard<std::mutex> lock(table.mutex);
+        id = table.ids.emplace(std::string(tag), uint32_t(table.ids.size())).first->second;
+    }
+    entry.hash = hash;
+    entry.id = id;
+    entry.valid = true;
+    entry.tag.assign(tag);
+    return id;
+}
+
+Log::BinaryWriter::BinaryWriter() noexcept: _started(false)
+{
+}
+
+uint32_t Log::BinaryWriter::encode(const LogRecord &record, uint32_t pid, char sign, std::string &out) const
+{
+    uint32_t tagId = internTag(record.tag);
+    out.push_back('R');
+    auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(record.time.time_since_epoch()).count();
+    putFixed64(out, uint64_t(time));
+    putVarint(out, pid);
+    putVarint(out, threadNumber(record.tid));
+    out.push_back(sign);
+    putVarint(out, tagId);
+    putVarint(out, record.lines.size());
+    size_t pos = 0;
+    for (const auto &line : record.lines)
+    {
+        putVarint(out, line.indent);
+        putVarint(out, line.length);
+        out.append(record.text, pos, line.length);
+        pos += line.length;
+    }
+    return tagId;
+}
+
+size_t Log::BinaryWriter::prepare(uint32_t tagId, std::string_view tag, std::string &out)
+{
+    if (_started && tagId < _defined.size() && _defined[tagId])
+        return 0;
+    size_t start = out.size();
+    if (!_started)
+    {
+        out.push_back('H');
+        out.append(magic, sizeof(magic));
+        out.push_back(char(version));
+        _started = true;
+    }
+    if (tagId >= _defined.size())
+        _defined.resize(tagId + 1, false);
+    if (!_defined[tagId])
+    {
+        out.push_back('T');
+        putVarint(out, tagId);
+        putVarint(out, tag.size());
+        out.append(tag);
+        _defined[tagId] = true;
+    }
+    return out.size() - start;
+}
+
+void Log::BinaryWriter::reset()
+{
+    _started = false;
+    _defined.clear();
+}
+
+std::mutex &Log::BinaryWriter::mutex()
+{
+    return _mutex;
+}
+
+bool Log::BinaryReader::decode(std::istream &in, std::ostream &out)
+{
+    std::string text;
+    std::string line;
+    while (true)
+    {
+        auto type = in.get();
+        if (type == std::istream::traits_type::eof())
+            return true;
+        switch (type)
+        {
+            case 'H':
+            {
+                char header[sizeof(magic) + 1];
+                in.read(header, sizeof(header));
+                if (in.gcount() != sizeof(header) || !std::equal(magic, magic + sizeof(magic), header))
+                {
+                    _error = "invalid header";
+                    return false;
+                }
+                if (uint8_t(header[sizeof(magic)]) != version)
+                {
+                    _error = "unsupported format version " + std::to_string(uint8_t(header[sizeof(magic)]));
+                    return false;
+                }
+                break;
+            }
+            case 'T':
+            {
+                uint64_t id;
+                std::string tag;
+                if (!getVarint(in, id) || !getBytes(in, tag))
+                {
+                    _error = "truncated tag entry";
+                    return false;
+                }
+                _tags[id] = std::move(tag);
+                break;
+            }
+            case 'R':
+            {
+                uint64_t time, pid, tid, tagId, lines;
+                uint8_t sign;
+                if (!getFixed64(in, time) || !getVarint(in, pid) || !getVarint(in, tid) || !getByte(in, sign) ||
+                    !getVarint(in, tagId) || !getVarint(in, lines))
+                {
+                    _error = "truncated record";
+                    return false;
+                }
+                auto tag = _tags.find(tagId);
+                if (tag == _tags.end())
+                {
+                    _error = "undefined tag id " + std::to_string(tagId);
+                    return false;
+                }
+                std::chrono::system_clock::time_point timePoint(
+                        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                std::chrono::nanoseconds(int64_t(time))));
+                text.clear();
+                for (uint64_t i = 0; i < lines; ++i)
+                {
+                    uint64_t indent;
+                    if (!getVarint(in, indent) || indent > maxIndent || !getBytes(in, line))
+                    {
+                        _error = "truncated record";
+                        return false;
+                    }
+                    appendHeader(text, timePoint, pid, tid, char(sign), tag->second);
+                    appendIndent(text, indent);
+                    text.append(line);
+                    text.push_back('\n');
+                }
+                out.write(text.data(), std::streamsize(text.size()));
+                break;
+            }
+            default:
+                _error = "unknown entry type " + std::to_string(type);
+                return false;
+        }
+    }
+}
+
+const std::string &Log::BinaryReader::error() const
+{
+    return _error;
+}
@@ -0,0 +1,124 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_BINARYFORMAT_H
+#define LOGGER_BINARYFORMAT_H
+
+#include <cstdint>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "LogRecord.h"
+
+/*
+ * Binary log is a sequence of entries, each starts with a type byte.
+ * Integers are unsigned LEB128 unless stated otherwise.
+ *
+ * 'H' Header:     "LOGB", format version byte
+ * 'T' Tag:        id, length, bytes
+ * 'R' Record:     time (8 bytes little-endian, nanoseconds since epoch), pid, thread id, sign byte,
+ *                 tag id, line count, then per line: indent, length, bytes
+ *
+ * Tag ids are process-wide, a tag entry precedes the first record that uses the tag.
+ * Header and tag entries may repeat, readers must accept them.
+ */
+
+namespace Log
+{
+    /*!
+     * Get process-wide id of a tag
+     * @param tag Tag
+     * @return Small integer id, the same for equal tags
+     */
+    uint32_t internTag(std::string_view tag);
+
+    /*!
+     * Binary log encoder of a single output stream
+     */
+    class BinaryWriter
+    {
+    private:
+        bool _started;
+        std::vector<bool> _defined;
+        std::mutex _mutex;
+    public:
+
+
+        /*!
+         * Constructor
+         */
+        BinaryWriter() noexcept;
+
+
+        /*!
+         * Encode a record
+         * Does not change writer state, so it can be called without holding the output stream lock
+         * @param record Record to encode
+         * @param pid Process id
+         * @param sign Level sign
+         * @param out String to append the entry to
+         * @return Tag id used by the record
+         */
+        uint32_t encode(const LogRecord &record, uint32_t pid, char sign, std::string &out) const;
+
+
+        /*!
+         * Append header and tag entries needed before a record
+         * Must be called with the output locked, the entries must be written right before the record
+         * @param tagId Tag id returned by encode()
+         * @param tag Tag
+         * @param out Buffer to append to
+         * @return Amount of bytes appended
+         */
+        size_t prepare(uint32_t tagId, std::string_view tag, std::string &out);
+
+
+        /*!
+         * Forget the header and tag entries written so far
+         * Must be called with the output locked when output continues in a new file
+         */
+        void reset();
+
+
+        /*!
+         * Get mutex used to serialize output of a stream that has no mutex of its own
+         * @return Mutex
+         */
+        std::mutex &mutex();
+    };
+
+    /*!
+     * Binary log decoder
+     * Converts binary log back into the text format
+     */
+    class BinaryReader
+    {
+    private:
+        std::unordered_map<uint64_t, std::string> _tags;
+        std::string _error;
+    public:
+
+
+        /*!
+         * Decode binary log
+         * @param in Binary log
+         * @param out Stream to print text log into
+         * @return true if the whole input was decoded, false otherwise
+         */
+        bool decode(std::istream &in, std::ostream &out);
+
+
+        /*!
+         * Get description of the last decoding error
+         * @return Error description
+         */
+        const std::string &error() const;
+    };
+}
+
+#endif //LOGGER_BINARYFORMAT_H
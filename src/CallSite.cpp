@@ -0,0 +1,164 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "CallSite.h"
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <fnmatch.h>
+#include "AtFork.h"
+
+namespace Log
+{
+    /*!
+     * Process-wide list of call sites and rules enabling them
+     * Locked around fork, a site reached by another thread at that moment would leave it locked in the child
+     */
+    struct CallSiteRegistry : private ForkListener
+    {
+        struct Rule
+        {
+            SiteMatch match;
+            std::string pattern;
+            bool enable;
+        };
+
+        std::mutex mutex;
+        std::vector<CallSite *> sites;
+        std::deque<CallSiteInfo> infos;
+        std::vector<Rule> rules;
+
+        CallSiteRegistry()
+        {
+            addForkListener(this, ForkStage::Registry);
+        }
+
+        void beforeFork() override
+        {
+            mutex.lock();
+        }
+
+        void afterForkParent() override
+        {
+            mutex.unlock();
+        }
+
+        void afterForkChild() override
+        {
+            // Only the forking thread exists in the child, the lock it holds is replaced with a fresh one
+            new (&mutex) std::mutex;
+        }
+
+        bool evaluate(const CallSiteInfo &info) const
+        {
+            bool enable = true;
+            for (const auto &rule : rules)
+            {
+                const char *value = rule.match == SiteMatch::Tag ? info.tag.c_str() :
+                                    rule.match == SiteMatch::File ? info.file : info.function;
+                if (fnmatch(rule.pattern.c_str(), value, 0) == 0)
+                    enable = rule.enable;
+            }
+            return enable;
+        }
+
+        void apply()
+        {
+            for (size_t i = 0; i < sites.size(); ++i)
+            {
+                infos[i].enabled = evaluate(infos[i]);
+                sites[i]->_state.store(infos[i].enabled ? CallSite::Enabled : CallSite::Disabled,
+                                       std::memory_order_release);
+            }
+        }
+    };
+}
+
+namespace
+{
+    // Never destroyed, sites are reached by static destructors and threads outliving main()
+    Log::CallSiteRegistry &registry()
+    {
+        static auto *instance = new Log::CallSiteRegistry();
+        return *instance;
+    }
+}
+
+bool Log::CallSite::registerSite(size_t level, std::string_view tag, const char *function)
+{
+    CallSiteRegistry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    // Another thread may have registered the site while this one waited
+    if (_state.load(std::memory_order_relaxed) == Unregistered)
+    {
+        CallSiteInfo info;
+        info.id = uint32_t(r.sites.size() + 1);
+        info.level = level;
+        info.tag.assign(tag);
+        info.file = _file;
+        info.line = _line;
+        info.function = function;
+        info.enabled = r.evaluate(info);
+        _id = info.id;
+        r.sites.push_back(this);
+        r.infos.push_back(std::move(info));
+        _state.store(r.infos.back().enabled ? Enabled : Disabled, std::memory_order_release);
+    }
+    return _state.load(std::memory_order_relaxed) == Enabled;
+}
+
+bool Log::CallSite::acquire(const RateLimit &limit, int64_t now)
+{
+    if (limit.perSecond == 0)
+        return true;
+    auto interval = int64_t(1000000000 / limit.perSecond);
+    int64_t tolerance = interval * (int64_t(std::max<uint32_t>(limit.burst, 1)) - 1);
+    int64_t full = _full.load(std::memory_order_relaxed);
+    int64_t next;
+    do
+    {
+        // Bucket refills while the site is quiet, but never above the burst
+        int64_t start = std::max(full, now);
+        if (start - now > tolerance)
+        {
+            _suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        next = start + interval;
+    } while (!_full.compare_exchange_weak(full, next, std::memory_order_relaxed));
+    return true;
+}
+
+void Log::setSitesEnabled(SiteMatch match, const std::string &pattern, bool enable)
+{
+    CallSiteRegistry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.rules.push_back({match, pattern, enable});
+    r.apply();
+}
+
+void Log::resetSites()
+{
+    CallSiteRegistry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.rules.clear();
+    r.apply();
+}
+
+std::vector<Log::CallSiteInfo> Log::callSites()
+{
+    CallSiteRegistry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return std::vector<CallSiteInfo>(r.infos.begin(), r.infos.end());
+}
+
+Log::CallSiteInfo Log::callSite(uint32_t id)
+{
+    CallSiteRegistry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (id == 0 || id > r.infos.size())
+        return CallSiteInfo();
+    return r.infos[id - 1];
+}
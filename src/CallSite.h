@@ -0,0 +1,152 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_CALLSITE_H
+#define LOGGER_CALLSITE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "RateLimit.h"
+
+namespace Log
+{
+    /*!
+     * Static state of a single logging macro expansion
+     * A site registers itself in a process-wide registry the first time it is reached, after that checking
+     * whether it is enabled costs a single load. The site also holds its rate limiter state.
+     * @note Sites must have static storage duration and must not be unloaded, e.g. by dlclose()
+     */
+    class CallSite
+    {
+    private:
+        enum State : uint8_t
+        {
+            Unregistered,
+            Enabled,
+            Disabled,
+        };
+
+        std::atomic<uint8_t> _state;
+        const char *_file;
+        unsigned _line;
+        uint32_t _id;
+        std::atomic<int64_t> _full;
+        std::atomic<uint64_t> _suppressed;
+
+        bool registerSite(size_t level, std::string_view tag, const char *function);
+        friend struct CallSiteRegistry;
+    public:
+
+
+        /*!
+         * Constructor
+         * Constant, so a static call site needs no initialization guard
+         * @param file Source file of the site
+         * @param line Source line of the site
+         */
+        constexpr CallSite(const char *file = "", unsigned line = 0) noexcept: _state(Unregistered), _file(file),
+                _line(line), _id(0), _full(0), _suppressed(0)
+        {}
+
+
+        /*!
+         * Check if the site is enabled, registering it on the first call
+         * @param level Log level of the site
+         * @param tag Tag of the site, sites printing with varying tags are matched by the first one
+         * @param function Name of the function the site is in
+         * @return true if messages of the site are printed, false otherwise
+         */
+        inline bool enabled(size_t level, std::string_view tag, const char *function)
+        {
+            uint8_t state = _state.load(std::memory_order_acquire);
+            return state == Enabled || (state == Unregistered && registerSite(level, tag, function));
+        }
+
+
+        /*!
+         * Get site id
+         * Ids are small consecutive numbers starting with 1 assigned in the order sites are reached
+         * @return Site id, 0 if the site was not reached yet
+         */
+        inline uint32_t id() const
+        { return _state.load(std::memory_order_acquire) == Unregistered ? 0 : _id; }
+
+
+        /*!
+         * Take a token from the bucket
+         * @param limit Rate limit
+         * @param now Current time of a steady clock in nanoseconds
+         * @return true if the message is allowed, false if it is suppressed
+         */
+        bool acquire(const RateLimit &limit, int64_t now);
+
+
+        /*!
+         * Get amount of messages suppressed since the previous call and reset it
+         * @return Amount of suppressed messages
+         */
+        inline uint64_t takeSuppressed()
+        { return _suppressed.load(std::memory_order_relaxed) == 0 ? 0 : _suppressed.exchange(0); }
+
+        CallSite(const CallSite &) = delete;
+        CallSite &operator=(const CallSite &) = delete;
+    };
+
+    /*!
+     * Attribute call sites are selected by
+     */
+    enum class SiteMatch
+    {
+        Tag,        //!< Tag of the first message printed by the site
+        File,       //!< Source file path as given by __FILE__
+        Function,   //!< Name of the function the site is in
+    };
+
+    /*!
+     * Description of a registered call site
+     */
+    struct CallSiteInfo
+    {
+        uint32_t id = 0;            //!< Site id, see CallSite::id()
+        size_t level = 0;           //!< Log level
+        std::string tag;            //!< Tag of the first message printed by the site
+        const char *file = "";      //!< Source file
+        unsigned line = 0;          //!< Source line
+        const char *function = "";  //!< Function the site is in
+        bool enabled = true;        //!< true if messages of the site are printed
+    };
+
+    /*!
+     * Enable or disable call sites matching a pattern
+     * Rules are applied in the order they were added to sites that are registered already and to sites
+     * registered later, the last matching rule wins. Sites matching no rule are enabled.
+     * @param match Attribute matched against the pattern
+     * @param pattern Shell wildcard pattern, see fnmatch(3)
+     * @param enable true to enable matching sites, false to disable them
+     */
+    void setSitesEnabled(SiteMatch match, const std::string &pattern, bool enable);
+
+    /*!
+     * Remove all rules added by setSitesEnabled and enable every call site
+     */
+    void resetSites();
+
+    /*!
+     * Get descriptions of all registered call sites
+     * @return Call sites ordered by id
+     */
+    std::vector<CallSiteInfo> callSites();
+
+    /*!
+     * Get description of a registered call site
+     * @param id Site id
+     * @return Call site, id is 0 if no site has the id
+     */
+    CallSiteInfo callSite(uint32_t id);
+}
+
+#endif //LOGGER_CALLSITE_H
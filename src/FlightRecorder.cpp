@@ -0,0 +1,336 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "FlightRecorder.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    /*!
+     * Captured record, followed by the tag, line lengths and indents as pairs of uint32_t, and text
+     */
+    struct EntryHeader
+    {
+        uint32_t size;
+        uint32_t tagLength;
+        uint32_t lineCount;
+        char sign;
+        int64_t time;
+    };
+
+    std::atomic<uint64_t> nextRecorder(1);
+
+    //! Amount of rings of exited threads kept until the next dump, the oldest ones are dropped beyond it
+    constexpr size_t exitedRings = 64;
+
+    std::atomic<int> signalPipes[NSIG];
+
+    void signalHandler(int signal)
+    {
+        int fd = signalPipes[signal].load(std::memory_order_relaxed);
+        if (fd < 0)
+            return;
+        int saved = errno;
+        char c = 0;
+        ssize_t result = write(fd, &c, 1);
+        (void)result;
+        errno = saved;
+    }
+}
+
+struct Log::FlightRecorder::Ring
+{
+    std::mutex mutex;
+    std::vector<char> data;
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    std::thread::id tid;
+    bool exited = false;
+
+    void copyIn(uint64_t pos, const void *src, size_t length)
+    {
+        size_t offset = size_t(pos % data.size());
+        size_t first = std::min(length, data.size() - offset);
+        std::memcpy(data.data() + offset, src, first);
+        std::memcpy(data.data(), static_cast<const char *>(src) + first, length - first);
+    }
+
+    void copyOut(uint64_t pos, void *dst, size_t length) const
+    {
+        size_t offset = size_t(pos % data.size());
+        size_t first = std::min(length, data.size() - offset);
+        std::memcpy(dst, data.data() + offset, first);
+        std::memcpy(static_cast<char *>(dst) + first, data.data(), length - first);
+    }
+};
+
+struct Log::FlightRecorder::Registry
+{
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Ring>> rings;
+};
+
+/*!
+ * Rings of the current thread
+ * When the thread exits, its empty rings are removed from their recorders and the others are kept
+ * until they are dumped, so records captured just before the thread exited are not lost
+ */
+struct Log::FlightRecorder::ThreadRings
+{
+    struct Entry
+    {
+        uint64_t recorder;
+        std::weak_ptr<Registry> registry;
+        std::shared_ptr<Ring> ring;
+    };
+
+    std::vector<Entry> entries;
+
+    ~ThreadRings()
+    {
+        for (auto &entry : entries)
+        {
+            auto registry = entry.registry.lock();
+            if (registry == nullptr)
+                continue;
+            std::lock_guard<std::mutex> lock(registry->mutex);
+            auto &rings = registry->rings;
+            bool empty;
+            {
+                std::lock_guard<std::mutex> ringLock(entry.ring->mutex);
+                empty = entry.ring->head == entry.ring->tail;
+            }
+            if (empty)
+            {
+                rings.erase(std::remove(rings.begin(), rings.end(), entry.ring), rings.end());
+                continue;
+            }
+            entry.ring->exited = true;
+            size_t exited = size_t(std::count_if(rings.begin(), rings.end(),
+                                                 [](const std::shared_ptr<Ring> &ring) { return ring->exited; }));
+            for (auto i = rings.begin(); exited > exitedRings;)
+            {
+                if ((*i)->exited)
+                {
+                    i = rings.erase(i);
+                    --exited;
+                }
+                else
+                    ++i;
+            }
+        }
+    }
+};
+
+Log::FlightRecorder::FlightRecorder(size_t capacity):
+        _capacity(std::max(capacity, sizeof(EntryHeader))), _id(nextRecorder.fetch_add(1)),
+        _registry(std::make_shared<Registry>())
+{
+}
+
+Log::FlightRecorder::~FlightRecorder() = default;
+
+Log::FlightRecorder::Ring &Log::FlightRecorder::threadRing()
+{
+    thread_local ThreadRings rings;
+    for (auto &entry : rings.entries)
+    {
+        if (entry.recorder == _id)
+            return *entry.ring;
+    }
+    auto ring = std::make_shared<Ring>();
+    ring->data.resize(_capacity);
+    ring->tid = std::this_thread::get_id();
+    {
+        std::lock_guard<std::mutex> lock(_registry->mutex);
+        _registry->rings.push_back(ring);
+    }
+    rings.entries.push_back({_id, _registry, ring});
+    return *ring;
+}
+
+void Log::FlightRecorder::capture(const LogRecord &record, char sign)
+{
+    EntryHeader header{};
+    size_t size = sizeof(header) + record.tag.size() + record.lines.size() * 2 * sizeof(uint32_t) +
+                  record.text.size();
+    if (size > _capacity)
+        return;
+    header.size = uint32_t(size);
+    header.tagLength = uint32_t(record.tag.size());
+    header.lineCount = uint32_t(record.lines.size());
+    header.sign = sign;
+    header.time = std::chrono::duration_cast<std::chrono::nanoseconds>(record.time.time_since_epoch()).count();
+    Ring &ring = threadRing();
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    // Overwrite the oldest records
+    while (ring.tail - ring.head + size > _capacity)
+    {
+        uint32_t oldest;
+        ring.copyOut(ring.head, &oldest, sizeof(oldest));
+        ring.head += oldest;
+    }
+    uint64_t pos = ring.tail;
+    ring.copyIn(pos, &header, sizeof(header));
+    pos += sizeof(header);
+    ring.copyIn(pos, record.tag.data(), record.tag.size());
+    pos += record.tag.size();
+    for (const auto &line : record.lines)
+    {
+        uint32_t fields[2] = {uint32_t(line.indent), uint32_t(line.length)};
+        ring.copyIn(pos, fields, sizeof(fields));
+        pos += sizeof(fields);
+    }
+    ring.copyIn(pos, record.text.data(), record.text.size());
+    ring.tail += size;
+}
+
+void Log::FlightRecorder::drain(Ring &ring, const std::function<void(LogRecord &)> &print)
+{
+    std::vector<LogRecord> records;
+    {
+        std::lock_guard<std::mutex> lock(ring.mutex);
+        for (uint64_t pos = ring.head; pos != ring.tail;)
+        {
+            EntryHeader header{};
+            ring.copyOut(pos, &header, sizeof(header));
+            records.emplace_back();
+            LogRecord &record = records.back();
+            record.sign = header.sign;
+            record.tid = ring.tid;
+            record.time = std::chrono::system_clock::time_point(
+                    std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                            std::chrono::nanoseconds(header.time)));
+            uint64_t field = pos + sizeof(header);
+            record.tag.resize(header.tagLength);
+            ring.copyOut(field, &record.tag[0], header.tagLength);
+            field += header.tagLength;
+            size_t textLength = 0;
+            for (uint32_t i = 0; i < header.lineCount; ++i)
+            {
+                uint32_t fields[2];
+                ring.copyOut(field, fields, sizeof(fields));
+                field += sizeof(fields);
+                record.lines.push_back({fields[0], fields[1]});
+                textLength += fields[1];
+            }
+            record.text.resize(textLength);
+            ring.copyOut(field, &record.text[0], textLength);
+            pos += header.size;
+        }
+        ring.head = ring.tail;
+    }
+    // Printing may take locks, do it after the ring is released
+    for (auto &record : records)
+        print(record);
+}
+
+void Log::FlightRecorder::dumpThread(const std::function<void(LogRecord &)> &print)
+{
+    drain(threadRing(), print);
+}
+
+void Log::FlightRecorder::dumpAll(const std::function<void(LogRecord &)> &print)
+{
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::vector<std::shared_ptr<Ring>> exited;
+    {
+        std::lock_guard<std::mutex> lock(_registry->mutex);
+        rings = _registry->rings;
+        for (auto &ring : rings)
+        {
+            if (ring->exited)
+                exited.push_back(ring);
+        }
+    }
+    for (auto &ring : rings)
+        drain(*ring, print);
+    if (exited.empty())
+        return;
+    // Nothing is captured into rings of exited threads anymore, they are not needed after being dumped
+    std::lock_guard<std::mutex> lock(_registry->mutex);
+    auto &all = _registry->rings;
+    for (auto &ring : exited)
+        all.erase(std::remove(all.begin(), all.end(), ring), all.end());
+}
+
+size_t Log::FlightRecorder::capacity() const
+{
+    return _capacity;
+}
+
+void Log::FlightRecorder::afterForkChild()
+{
+    // Threads that held these do not exist in the child
+    new (&_registry->mutex) std::mutex;
+    for (auto &ring : _registry->rings)
+        new (&ring->mutex) std::mutex;
+}
+
+Log::SignalWatcher::SignalWatcher(int signal, std::function<void()> callback):
+        _signal(signal), _pipe{-1, -1}, _callback(std::move(callback))
+{
+    if (signal <= 0 || signal >= NSIG || pipe2(_pipe, O_CLOEXEC) != 0)
+        return;
+    // A full pipe already guarantees a pending callback, the handler must not block
+    fcntl(_pipe[1], F_SETFL, fcntl(_pipe[1], F_GETFL) | O_NONBLOCK);
+    signalPipes[signal].store(_pipe[1]);
+    struct sigaction action{};
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(signal, &action, nullptr);
+    _thread = std::thread(&SignalWatcher::run, this);
+}
+
+Log::SignalWatcher::~SignalWatcher()
+{
+    if (_pipe[0] < 0)
+        return;
+    signal(_signal, SIG_DFL);
+    signalPipes[_signal].store(-1);
+    // The watching thread stops at the end of the pipe
+    close(_pipe[1]);
+    _thread.join();
+    close(_pipe[0]);
+}
+
+void Log::SignalWatcher::run()
+{
+    char buf[64];
+    while (true)
+    {
+        ssize_t length = read(_pipe[0], buf, sizeof(buf));
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length <= 0)
+            break;
+        _callback();
+    }
+}
+
+void Log::SignalWatcher::afterForkChild()
+{
+    if (_pipe[0] < 0)
+        return;
+    // The pipe is shared with the parent, signals of the child get a pipe of their own
+    close(_pipe[0]);
+    close(_pipe[1]);
+    new (&_thread) std::thread;
+    if (pipe2(_pipe, O_CLOEXEC) != 0)
+    {
+        _pipe[0] = _pipe[1] = -1;
+        signalPipes[_signal].store(-1);
+        return;
+    }
+    fcntl(_pipe[1], F_SETFL, fcntl(_pipe[1], F_GETFL) | O_NONBLOCK);
+    signalPipes[_signal].store(_pipe[1]);
+    _thread = std::thread(&SignalWatcher::run, this);
+}
@@ -0,0 +1,140 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_FLIGHTRECORDER_H
+#define LOGGER_FLIGHTRECORDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "LogRecord.h"
+
+namespace Log
+{
+    /*!
+     * Keeps recent records of every thread in memory without formatting their headers
+     * Every thread captures records into its own fixed-size ring, the oldest records are overwritten.
+     * Rings are locked only to be dumped, so capturing threads never contend with each other.
+     * Message text is rendered when the record is captured, time stamp, thread, sign and indentation
+     * are kept as fields and only formatted when the record is dumped.
+     * Rings of exited threads are kept until they are dumped by dumpAll(), up to 64 of them.
+     */
+    class FlightRecorder
+    {
+    private:
+        struct Ring;
+        struct Registry;
+        struct ThreadRings;
+
+        size_t _capacity;
+        uint64_t _id;
+        std::shared_ptr<Registry> _registry;
+
+        Ring &threadRing();
+        static void drain(Ring &ring, const std::function<void(LogRecord &)> &print);
+    public:
+
+
+        /*!
+         * Constructor
+         * @param capacity Size of the ring of every thread in bytes
+         */
+        explicit FlightRecorder(size_t capacity);
+
+
+        /*!
+         * Destructor
+         */
+        ~FlightRecorder();
+
+        FlightRecorder(const FlightRecorder &) = delete;
+        FlightRecorder &operator=(const FlightRecorder &) = delete;
+
+
+        /*!
+         * Capture a record into the ring of the calling thread
+         * Records larger than the ring are dropped
+         * @param record Record
+         * @param sign Sign of the stream the record was printed into
+         */
+        void capture(const LogRecord &record, char sign);
+
+
+        /*!
+         * Take records captured by the calling thread, oldest first
+         * @param print Called for every record, LogRecord::sign is set to the sign of its stream
+         */
+        void dumpThread(const std::function<void(LogRecord &)> &print);
+
+
+        /*!
+         * Take records captured by all threads, oldest first within every thread
+         * @param print Called for every record, LogRecord::sign is set to the sign of its stream
+         */
+        void dumpAll(const std::function<void(LogRecord &)> &print);
+
+
+        /*!
+         * Get size of the ring of every thread
+         * @return Ring size in bytes
+         */
+        size_t capacity() const;
+
+
+        /*!
+         * Release locks held by threads that do not exist in a forked child
+         * @note Must only be called in the child after fork
+         */
+        void afterForkChild();
+    };
+
+    /*!
+     * Runs a callback on a dedicated thread when a signal is delivered
+     * The signal handler only writes into a pipe, so the callback is free to lock and allocate.
+     * Only one watcher per signal can exist.
+     */
+    class SignalWatcher
+    {
+    private:
+        int _signal;
+        int _pipe[2];
+        std::function<void()> _callback;
+        std::thread _thread;
+
+        void run();
+    public:
+
+
+        /*!
+         * Constructor
+         * Installs the signal handler and starts the watching thread
+         * @param signal Signal number
+         * @param callback Function called on every delivery of the signal
+         */
+        SignalWatcher(int signal, std::function<void()> callback);
+
+
+        /*!
+         * Destructor
+         * Restores the default signal handler and stops the watching thread
+         */
+        ~SignalWatcher();
+
+        SignalWatcher(const SignalWatcher &) = delete;
+        SignalWatcher &operator=(const SignalWatcher &) = delete;
+
+
+        /*!
+         * Restart the watching thread in a forked child
+         * @note Must only be called in the child after fork
+         */
+        void afterForkChild();
+    };
+}
+
+#endif //LOGGER_FLIGHTRECORDER_H
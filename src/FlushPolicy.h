@@ -0,0 +1,96 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_FLUSHPOLICY_H
+#define LOGGER_FLUSHPOLICY_H
+
+#include <chrono>
+#include <cstddef>
+
+namespace Log
+{
+    /*!
+     * Condition to flush an output stream after a record is written
+     */
+    enum class FlushMode
+    {
+        EveryRecord, //!< Flush after every record
+        Bytes,       //!< Flush when at least FlushPolicy::bytes were written since the last flush
+        Interval,    //!< Flush when FlushPolicy::interval passed since the last flush,
+                     //!< a logger also flushes output left pending for that long on a timer
+        Severity,    //!< Flush when the logger writes an Error or Assert record
+        Manual,      //!< Flush only on Logger::flush() or when the stream decides to
+    };
+
+    /*!
+     * Output stream flush policy
+     */
+    struct FlushPolicy
+    {
+        FlushMode mode = FlushMode::EveryRecord;
+        size_t bytes = 0;
+        std::chrono::steady_clock::duration interval{};
+
+
+        /*!
+         * Flush after every record
+         */
+        static FlushPolicy everyRecord()
+        { return FlushPolicy(); }
+
+
+        /*!
+         * Flush every N bytes
+         * @param bytes Amount of bytes written before a flush
+         */
+        static FlushPolicy everyBytes(size_t bytes)
+        {
+            FlushPolicy policy;
+            policy.mode = FlushMode::Bytes;
+            policy.bytes = bytes;
+            return policy;
+        }
+
+
+        /*!
+         * Flush on a timer
+         * The timer is checked when a record is written. Streams of a Logger are also flushed by a background
+         * timer, so output waits at most one and a half intervals even if nothing else is written.
+         * @param interval Minimal interval between flushes
+         */
+        static FlushPolicy every(std::chrono::steady_clock::duration interval)
+        {
+            FlushPolicy policy;
+            policy.mode = FlushMode::Interval;
+            policy.interval = interval;
+            return policy;
+        }
+
+
+        /*!
+         * Flush when an error arrives
+         * Records of lower levels stay buffered until the logger writes an Error or Assert record,
+         * which flushes every stream with this policy, so the context of an error is never lost in a buffer
+         */
+        static FlushPolicy onError()
+        {
+            FlushPolicy policy;
+            policy.mode = FlushMode::Severity;
+            return policy;
+        }
+
+
+        /*!
+         * Flush only on request
+         */
+        static FlushPolicy manual()
+        {
+            FlushPolicy policy;
+            policy.mode = FlushMode::Manual;
+            return policy;
+        }
+    };
+}
+
+#endif //LOGGER_FLUSHPOLICY_H
@@ -0,0 +1,51 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "FlushTimer.h"
+#include <algorithm>
+#include <new>
+
+Log::FlushTimer::FlushTimer(std::chrono::steady_clock::duration period, std::function<void()> callback):
+        _period(period), _callback(std::move(callback)), _stop(false)
+{
+    _thread = std::thread(&FlushTimer::run, this);
+}
+
+Log::FlushTimer::~FlushTimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+std::chrono::steady_clock::duration Log::FlushTimer::period() const
+{
+    return _period;
+}
+
+void Log::FlushTimer::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto next = std::chrono::steady_clock::now() + _period;
+    while (!_wake.wait_until(lock, next, [this]() { return _stop; }))
+    {
+        // The callback takes output locks, it must not delay the destructor
+        lock.unlock();
+        _callback();
+        lock.lock();
+        next = std::max(next + _period, std::chrono::steady_clock::now());
+    }
+}
+
+void Log::FlushTimer::afterForkChild()
+{
+    // The timer thread does not exist in the child, its handle is abandoned instead of being joined
+    new (&_mutex) std::mutex;
+    new (&_wake) std::condition_variable;
+    new (&_thread) std::thread;
+    _thread = std::thread(&FlushTimer::run, this);
+}
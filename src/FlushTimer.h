@@ -0,0 +1,67 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_FLUSHTIMER_H
+#define LOGGER_FLUSHTIMER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace Log
+{
+    /*!
+     * Background thread calling a function periodically
+     * Flushes output of streams with an interval flush policy that nothing else is written to
+     */
+    class FlushTimer
+    {
+    private:
+        std::chrono::steady_clock::duration _period;
+        std::function<void()> _callback;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        bool _stop;
+        std::thread _thread;
+
+        void run();
+    public:
+
+
+        /*!
+         * Constructor
+         * Starts the timer thread
+         * @param period Interval between calls
+         * @param callback Function called every period
+         */
+        FlushTimer(std::chrono::steady_clock::duration period, std::function<void()> callback);
+
+
+        /*!
+         * Destructor
+         * Stops the timer thread, waits for a running call
+         */
+        ~FlushTimer();
+
+
+        /*!
+         * Get interval between calls
+         * @return Interval
+         */
+        std::chrono::steady_clock::duration period() const;
+
+
+        /*!
+         * Restart the timer thread in a forked child
+         */
+        void afterForkChild();
+
+        FlushTimer(const FlushTimer &) = delete;
+        FlushTimer &operator=(const FlushTimer &) = delete;
+    };
+}
+
+#endif //LOGGER_FLUSHTIMER_H
@@ -0,0 +1,106 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "Format.h"
+#include <charconv>
+
+namespace
+{
+    void appendInteger(std::string &out, const Log::FormatArg &arg, int base, bool upper)
+    {
+        char buf[24];
+        std::to_chars_result result = arg.isSigned ?
+                                      std::to_chars(buf, buf + sizeof(buf), arg.integer, base) :
+                                      std::to_chars(buf, buf + sizeof(buf), arg.unsignedInteger, base);
+        if (upper)
+        {
+            for (char *i = buf; i != result.ptr; ++i)
+            {
+                if (*i >= 'a' && *i <= 'f')
+                    *i = char(*i - 'a' + 'A');
+            }
+        }
+        out.append(buf, result.ptr);
+    }
+
+    void appendFloating(std::string &out, double value, std::string_view spec)
+    {
+        // Large enough for any double in fixed notation with precision up to 99
+        char buf[512];
+        std::to_chars_result result{};
+        if (spec.empty())
+            result = std::to_chars(buf, buf + sizeof(buf), value);
+        else
+        {
+            int precision = 0;
+            for (char c : spec.substr(1))
+                precision = precision * 10 + (c - '0');
+            result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, precision);
+        }
+        out.append(buf, result.ptr);
+    }
+
+    void appendArg(std::string &out, const Log::FormatArg &arg, std::string_view spec)
+    {
+        switch (arg.kind)
+        {
+            case Log::ArgKind::Integer:
+                appendInteger(out, arg, spec.empty() ? 10 : 16, spec == "X");
+                break;
+            case Log::ArgKind::Floating:
+                appendFloating(out, arg.floating, spec);
+                break;
+            case Log::ArgKind::Bool:
+                out.append(arg.boolean ? "true" : "false");
+                break;
+            case Log::ArgKind::Char:
+                out.push_back(arg.character);
+                break;
+            case Log::ArgKind::String:
+                out.append(arg.string);
+                break;
+            case Log::ArgKind::Pointer:
+                out.append("0x", 2);
+                appendInteger(out, arg, 16, false);
+                break;
+            case Log::ArgKind::Unsupported:
+                break;
+        }
+    }
+}
+
+void Log::formatArgs(std::string &out, std::string_view fmt, const FormatArg *args, size_t count)
+{
+    size_t arg = 0;
+    size_t pos = 0;
+    while (pos < fmt.size())
+    {
+        size_t brace = fmt.find_first_of("{}", pos);
+        if (brace == std::string_view::npos)
+        {
+            out.append(fmt.substr(pos));
+            break;
+        }
+        out.append(fmt.substr(pos, brace - pos));
+        if (brace + 1 < fmt.size() && fmt[brace + 1] == fmt[brace])
+        {
+            out.push_back(fmt[brace]);
+            pos = brace + 2;
+            continue;
+        }
+        size_t close = fmt.find('}', brace);
+        if (fmt[brace] == '}' || close == std::string_view::npos)
+        {
+            // Rejected by checkFormat, print the rest verbatim
+            out.append(fmt.substr(brace));
+            break;
+        }
+        std::string_view spec = fmt.substr(brace + 1, close - brace - 1);
+        if (!spec.empty())
+            spec.remove_prefix(1);
+        if (arg < count)
+            appendArg(out, args[arg++], spec);
+        pos = close + 1;
+    }
+}
@@ -0,0 +1,254 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_FORMAT_H
+#define LOGGER_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * Format strings use a subset of the std::format syntax:
+ *
+ * {}       argument in its default representation
+ * {:x}     integer in lowercase hexadecimal, {:X} in uppercase
+ * {:.N}    floating point number in fixed notation with N (0-99) digits after the point
+ * {{ }}    literal braces
+ *
+ * Arguments are matched to placeholders in order. Format strings are checked against
+ * argument types at compile time, see LOGGER_FORMAT_STRING.
+ */
+
+//! Wrap a string literal into a type usable as a compile-time format string
+#define LOGGER_FORMAT_STRING(fmt) \
+    [] { struct Format { static constexpr std::string_view value() { return fmt; } }; return Format(); }()
+
+namespace Log
+{
+    /*!
+     * Kind of a format argument
+     */
+    enum class ArgKind
+    {
+        Integer,
+        Floating,
+        Bool,
+        Char,
+        String,
+        Pointer,
+        Unsupported,
+    };
+
+    /*!
+     * Format string errors detected at compile time
+     */
+    enum class FormatError
+    {
+        None,
+        UnmatchedBrace,
+        TooFewArguments,
+        TooManyArguments,
+        InvalidSpec,
+    };
+
+    /*!
+     * Get kind of a format argument type
+     * @tparam T Argument type
+     * @return Argument kind
+     */
+    template <typename T>
+    constexpr ArgKind argKind()
+    {
+        using Type = std::remove_cv_t<std::decay_t<T>>;
+        if constexpr (std::is_same_v<Type, bool>)
+            return ArgKind::Bool;
+        else if constexpr (std::is_same_v<Type, char>)
+            return ArgKind::Char;
+        else if constexpr (std::is_integral_v<Type>)
+            return sizeof(Type) <= sizeof(long long) ? ArgKind::Integer : ArgKind::Unsupported;
+        else if constexpr (std::is_floating_point_v<Type>)
+            return ArgKind::Floating;
+        else if constexpr (std::is_same_v<Type, const char *> || std::is_same_v<Type, char *> ||
+                           std::is_same_v<Type, std::string> || std::is_same_v<Type, std::string_view>)
+            return ArgKind::String;
+        else if constexpr (std::is_pointer_v<Type> || std::is_null_pointer_v<Type>)
+            return ArgKind::Pointer;
+        else
+            return ArgKind::Unsupported;
+    }
+
+    /*!
+     * Check if a placeholder spec is valid for an argument
+     * @param spec Placeholder contents after ':'
+     * @param kind Argument kind
+     * @return true if valid, false otherwise
+     */
+    constexpr bool validSpec(std::string_view spec, ArgKind kind)
+    {
+        if (spec.empty())
+            return true;
+        if (spec == "x" || spec == "X")
+            return kind == ArgKind::Integer;
+        if (spec.size() < 2 || spec.size() > 3 || spec[0] != '.' || kind != ArgKind::Floating)
+            return false;
+        for (size_t i = 1; i < spec.size(); ++i)
+        {
+            if (spec[i] < '0' || spec[i] > '9')
+                return false;
+        }
+        return true;
+    }
+
+    /*!
+     * Check a format string
+     * @param fmt Format string
+     * @param kinds Kinds of arguments
+     * @param count Amount of arguments
+     * @return First error found
+     */
+    constexpr FormatError checkFormat(std::string_view fmt, const ArgKind *kinds, size_t count)
+    {
+        size_t arg = 0;
+        for (size_t pos = 0; pos < fmt.size(); ++pos)
+        {
+            if (fmt[pos] == '}')
+            {
+                if (pos + 1 == fmt.size() || fmt[pos + 1] != '}')
+                    return FormatError::UnmatchedBrace;
+                ++pos;
+            }
+            else if (fmt[pos] == '{')
+            {
+                if (pos + 1 < fmt.size() && fmt[pos + 1] == '{')
+                {
+                    ++pos;
+                    continue;
+                }
+                size_t close = fmt.find_first_of("{}", pos + 1);
+                if (close == std::string_view::npos || fmt[close] != '}')
+                    return FormatError::UnmatchedBrace;
+                std::string_view spec = fmt.substr(pos + 1, close - pos - 1);
+                if (!spec.empty() && spec[0] != ':')
+                    return FormatError::InvalidSpec;
+                if (arg == count)
+                    return FormatError::TooFewArguments;
+                if (!spec.empty() && !validSpec(spec.substr(1), kinds[arg]))
+                    return FormatError::InvalidSpec;
+                ++arg;
+                pos = close;
+            }
+        }
+        return arg == count ? FormatError::None : FormatError::TooManyArguments;
+    }
+
+    /*!
+     * Check a compile-time format string against argument types
+     * Compilation fails if the format string is invalid
+     * @tparam Fmt Format string type created by LOGGER_FORMAT_STRING
+     * @tparam Args Argument types
+     * @return Format string
+     */
+    template <typename Fmt, typename ... Args>
+    constexpr std::string_view checkedFormat()
+    {
+        static_assert(((argKind<Args>() != ArgKind::Unsupported) && ...), "Argument type cannot be formatted");
+        constexpr ArgKind kinds[] = {argKind<Args>()..., ArgKind::Unsupported};
+        constexpr FormatError error = checkFormat(Fmt::value(), kinds, sizeof...(Args));
+        static_assert(error != FormatError::UnmatchedBrace, "Format string has an unmatched brace");
+        static_assert(error != FormatError::TooFewArguments, "Format string has more placeholders than arguments");
+        static_assert(error != FormatError::TooManyArguments, "Format string has less placeholders than arguments");
+        static_assert(error != FormatError::InvalidSpec, "Format spec is invalid for the argument type");
+        return Fmt::value();
+    }
+
+    /*!
+     * Type-erased format argument
+     */
+    struct FormatArg
+    {
+        ArgKind kind;
+        union
+        {
+            long long integer;
+            unsigned long long unsignedInteger;
+            double floating;
+            bool boolean;
+            char character;
+        };
+        std::string_view string;
+        bool isSigned;
+
+
+        /*!
+         * Constructor
+         * @param value Argument
+         */
+        template <typename T>
+        FormatArg(const T &value);
+
+
+        /*!
+         * Constructor of a sentinel argument
+         */
+        constexpr FormatArg(): kind(ArgKind::Unsupported), integer(0), isSigned(false)
+        {}
+    };
+
+    /*!
+     * Format arguments
+     * @param out String to append the result to
+     * @param fmt Format string checked by checkFormat
+     * @param args Arguments
+     * @param count Amount of arguments
+     */
+    void formatArgs(std::string &out, std::string_view fmt, const FormatArg *args, size_t count);
+
+    /*!
+     * Format arguments
+     * @param out String to append the result to
+     * @param fmt Format string checked by checkFormat
+     * @param args Arguments
+     */
+    template <typename ... Args>
+    void formatTo(std::string &out, std::string_view fmt, const Args & ... args);
+}
+
+template<typename T>
+Log::FormatArg::FormatArg(const T &value): kind(argKind<T>()), integer(0), isSigned(false)
+{
+    using Type = std::remove_cv_t<std::decay_t<T>>;
+    if constexpr (std::is_same_v<Type, bool>)
+        boolean = value;
+    else if constexpr (std::is_same_v<Type, char>)
+        character = value;
+    else if constexpr (std::is_integral_v<Type> && std::is_signed_v<Type>)
+    {
+        integer = value;
+        isSigned = true;
+    }
+    else if constexpr (std::is_integral_v<Type>)
+        unsignedInteger = value;
+    else if constexpr (std::is_floating_point_v<Type>)
+        floating = static_cast<double>(value);
+    else if constexpr (std::is_array_v<T>)
+        string = std::string_view(value);
+    else if constexpr (std::is_same_v<Type, const char *> || std::is_same_v<Type, char *>)
+        string = value != nullptr ? std::string_view(value) : std::string_view("(null)");
+    else if constexpr (std::is_same_v<Type, std::string> || std::is_same_v<Type, std::string_view>)
+        string = value;
+    else if constexpr (std::is_pointer_v<Type>)
+        unsignedInteger = reinterpret_cast<uintptr_t>(value);
+}
+
+template<typename... Args>
+void Log::formatTo(std::string &out, std::string_view fmt, const Args &... args)
+{
+    const FormatArg list[] = {FormatArg(args)..., FormatArg()};
+    formatArgs(out, fmt, list, sizeof...(Args));
+}
+
+#endif //LOGGER_FORMAT_H
@@ -0,0 +1,99 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "Json.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    inline bool needsEscape(char c)
+    {
+        return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+    }
+}
+
+size_t Log::jsonEscapePosition(std::string_view value)
+{
+    const char *data = value.data();
+    size_t size = value.size();
+    size_t pos = 0;
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        // Unsigned chunk <= 0x1F, SSE2 only has signed byte comparison
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+        auto mask = unsigned(_mm_movemask_epi8(special));
+        if (mask != 0)
+            return pos + size_t(__builtin_ctz(mask));
+    }
+#endif
+    for (; pos < size; ++pos)
+    {
+        if (needsEscape(data[pos]))
+            return pos;
+    }
+    return size;
+}
+
+void Log::appendJsonEscaped(std::string &out, std::string_view value)
+{
+    static const char hex[] = "0123456789abcdef";
+    while (!value.empty())
+    {
+        size_t pos = jsonEscapePosition(value);
+        out.append(value.data(), pos);
+        if (pos == value.size())
+            break;
+        char c = value[pos];
+        char escaped[6] = {'\\', 0, 0, 0, 0, 0};
+        size_t length = 2;
+        switch (c)
+        {
+            case '"':
+            case '\\':
+                escaped[1] = c;
+                break;
+            case '\n':
+                escaped[1] = 'n';
+                break;
+            case '\r':
+                escaped[1] = 'r';
+                break;
+            case '\t':
+                escaped[1] = 't';
+                break;
+            case '\b':
+                escaped[1] = 'b';
+                break;
+            case '\f':
+                escaped[1] = 'f';
+                break;
+            default:
+                escaped[1] = 'u';
+                escaped[2] = '0';
+                escaped[3] = '0';
+                escaped[4] = hex[static_cast<unsigned char>(c) >> 4u];
+                escaped[5] = hex[static_cast<unsigned char>(c) & 0xFu];
+                length = 6;
+                break;
+        }
+        out.append(escaped, length);
+        value.remove_prefix(pos + 1);
+    }
+}
+
+void Log::appendJsonString(std::string &out, std::string_view value)
+{
+    out.push_back('"');
+    appendJsonEscaped(out, value);
+    out.push_back('"');
+}
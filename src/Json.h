@@ -0,0 +1,38 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_JSON_H
+#define LOGGER_JSON_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace Log
+{
+    /*!
+     * Find the first character that must be escaped in a JSON string: quote, backslash or a control character
+     * Scans 16 bytes at once where SSE2 is available
+     * @param value String
+     * @return Position of the character, size of the string if there is none
+     */
+    size_t jsonEscapePosition(std::string_view value);
+
+    /*!
+     * Append a string escaped for a JSON string literal, without quotes
+     * Runs of characters that need no escaping are copied at once, bytes above 0x7F are copied as is
+     * @param out String to append to
+     * @param value String to escape
+     */
+    void appendJsonEscaped(std::string &out, std::string_view value);
+
+    /*!
+     * Append a quoted JSON string
+     * @param out String to append to
+     * @param value String to escape
+     */
+    void appendJsonString(std::string &out, std::string_view value);
+}
+
+#endif //LOGGER_JSON_H
@@ -0,0 +1,179 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "LineScan.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LOGGER_SCAN_AVX2 1
+#else
+#define LOGGER_SCAN_AVX2 0
+#endif
+
+namespace
+{
+    constexpr char escape = '\x1B';
+
+    inline bool stops(char c, bool controls)
+    {
+        auto byte = static_cast<unsigned char>(c);
+        return c == '\n' || (controls && ((byte < 0x20 && c != '\t') || byte == 0x7F));
+    }
+
+    size_t scanScalar(const char *data, size_t size, bool controls)
+    {
+        for (size_t pos = 0; pos < size; ++pos)
+        {
+            if (stops(data[pos], controls))
+                return pos;
+        }
+        return size;
+    }
+
+#if defined(__SSE2__)
+    size_t scanSse2(const char *data, size_t size, bool controls)
+    {
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        const __m128i del = _mm_set1_epi8(0x7F);
+        size_t pos = 0;
+        for (; pos + 16 <= size; pos += 16)
+        {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+            __m128i special = _mm_cmpeq_epi8(chunk, newline);
+            if (controls)
+            {
+                // Unsigned chunk <= 0x1F, SSE2 only has signed byte comparison
+                __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk);
+                special = _mm_or_si128(special, _mm_andnot_si128(_mm_cmpeq_epi8(chunk, tab), low));
+                special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, del));
+            }
+            auto mask = unsigned(_mm_movemask_epi8(special));
+            if (mask != 0)
+                return pos + size_t(__builtin_ctz(mask));
+        }
+        return pos + scanScalar(data + pos, size - pos, controls);
+    }
+#endif
+
+#if LOGGER_SCAN_AVX2
+    __attribute__((target("avx2"))) size_t scanAvx2(const char *data, size_t size, bool controls)
+    {
+        // Most lines are short, they skip the setup of 256-bit constants
+        if (size < 32)
+            return scanSse2(data, size, controls);
+        const __m256i newline = _mm256_set1_epi8('\n');
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i control = _mm256_set1_epi8(0x1F);
+        const __m256i del = _mm256_set1_epi8(0x7F);
+        size_t pos = 0;
+        for (; pos + 32 <= size; pos += 32)
+        {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+            __m256i special = _mm256_cmpeq_epi8(chunk, newline);
+            if (controls)
+            {
+                __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control), chunk);
+                special = _mm256_or_si256(special, _mm256_andnot_si256(_mm256_cmpeq_epi8(chunk, tab), low));
+                special = _mm256_or_si256(special, _mm256_cmpeq_epi8(chunk, del));
+            }
+            auto mask = unsigned(_mm256_movemask_epi8(special));
+            if (mask != 0)
+                return pos + size_t(__builtin_ctz(mask));
+        }
+        // The tail is scanned by legacy SSE code, which is slow while upper halves of registers are dirty
+        _mm256_zeroupper();
+        return pos + scanSse2(data + pos, size - pos, controls);
+    }
+
+    bool haveAvx2()
+    {
+        // May run from a static constructor, before the feature data is initialized by the runtime
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    /*!
+     * Length of a terminal escape sequence
+     * @param text String starting with ESC
+     * @return Length of the sequence, up to the end of the string or the next line break if it is not terminated
+     */
+    size_t sequenceLength(std::string_view text)
+    {
+        size_t pos = 1;
+        if (pos == text.size())
+            return pos;
+        char kind = text[pos++];
+        auto in = [&text, &pos](unsigned char first, unsigned char last)
+        {
+            return pos < text.size() && static_cast<unsigned char>(text[pos]) >= first &&
+                   static_cast<unsigned char>(text[pos]) <= last;
+        };
+        switch (kind)
+        {
+            case '[':
+                // CSI: parameter bytes, intermediate bytes, final byte
+                while (in(0x30, 0x3F))
+                    ++pos;
+                while (in(0x20, 0x2F))
+                    ++pos;
+                if (in(0x40, 0x7E))
+                    ++pos;
+                return pos;
+            case ']':
+            case 'P':
+            case 'X':
+            case '^':
+            case '_':
+                // OSC, DCS, SOS, PM and APC strings are terminated by BEL or ESC backslash
+                for (; pos < text.size() && text[pos] != '\n'; ++pos)
+                {
+                    if (text[pos] == '\a')
+                        return pos + 1;
+                    if (text[pos] == escape && pos + 1 < text.size() && text[pos + 1] == '\\')
+                        return pos + 2;
+                }
+                return pos;
+            default:
+                // Other sequences are intermediate bytes followed by a final byte
+                --pos;
+                while (in(0x20, 0x2F))
+                    ++pos;
+                if (in(0x30, 0x7E))
+                    ++pos;
+                return pos;
+        }
+    }
+}
+
+size_t Log::lineScanPosition(std::string_view text, bool controls)
+{
+#if LOGGER_SCAN_AVX2
+    static const bool avx2 = haveAvx2();
+    if (avx2)
+        return scanAvx2(text.data(), text.size(), controls);
+#endif
+#if defined(__SSE2__)
+    return scanSse2(text.data(), text.size(), controls);
+#else
+    return scanScalar(text.data(), text.size(), controls);
+#endif
+}
+
+size_t Log::appendControl(std::string &out, std::string_view text, ControlChars policy)
+{
+    static const char hex[] = "0123456789abcdef";
+    if (policy == ControlChars::Strip)
+        return text[0] == escape ? sequenceLength(text) : 1;
+    auto c = static_cast<unsigned char>(text[0]);
+    char escaped[4] = {'\\', 'x', hex[c >> 4u], hex[c & 0xFu]};
+    out.append(escaped, sizeof(escaped));
+    return 1;
+}
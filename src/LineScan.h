@@ -0,0 +1,44 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_LINESCAN_H
+#define LOGGER_LINESCAN_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace Log
+{
+    /*!
+     * Handling of control characters in message text
+     * Control characters are C0 codes other than tab and line feed, and DEL. Line feeds always split lines.
+     */
+    enum class ControlChars
+    {
+        Keep,   //!< Print control characters as is
+        Escape, //!< Replace every control character with \xHH, terminal escape sequences become visible text
+        Strip,  //!< Remove control characters together with terminal escape sequences they start
+    };
+
+    /*!
+     * Find the first line break or, optionally, control character
+     * Scans 32 bytes at once where AVX2 is available at run time, 16 bytes with SSE2 otherwise
+     * @param text String
+     * @param controls true to stop at control characters too, false to stop at line breaks only
+     * @return Position of the character, size of the string if there is none
+     */
+    size_t lineScanPosition(std::string_view text, bool controls);
+
+    /*!
+     * Append a replacement for the control character a string starts with
+     * @param out String to append to
+     * @param text String starting with a control character other than line feed
+     * @param policy Escape or Strip
+     * @return Amount of bytes of the string replaced: 1, or the whole escape sequence when stripping
+     */
+    size_t appendControl(std::string &out, std::string_view text, ControlChars policy);
+}
+
+#endif //LOGGER_LINESCAN_H
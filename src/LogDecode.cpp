@@ -0,0 +1,42 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "BinaryFormat.h"
+#include <fstream>
+#include <iostream>
+
+/*
+ * Converts binary logs into the text format
+ * Usage: logdecode [file...]
+ * Reads standard input if no files are given
+ */
+int main(int argc, char **argv)
+{
+    std::ios::sync_with_stdio(false);
+    Log::BinaryReader reader;
+    if (argc < 2)
+    {
+        if (!reader.decode(std::cin, std::cout))
+        {
+            std::cerr << "logdecode: <stdin>: " << reader.error() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    for (int i = 1; i < argc; ++i)
+    {
+        std::ifstream in(argv[i], std::ios::binary);
+        if (!in)
+        {
+            std::cerr << "logdecode: " << argv[i] << ": cannot open file" << std::endl;
+            return 1;
+        }
+        if (!reader.decode(in, std::cout))
+        {
+            std::cerr << "logdecode: " << argv[i] << ": " << reader.error() << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
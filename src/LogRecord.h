@@ -0,0 +1,66 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_LOGRECORD_H
+#define LOGGER_LOGRECORD_H
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Log
+{
+    class LogStream;
+
+    /*!
+     * Unformatted message captured on the caller's thread
+     * Holds every line printed by a single Logger::print call
+     */
+    struct LogRecord
+    {
+        /*!
+         * Line of a record, its text is stored in LogRecord::text
+         */
+        struct Line
+        {
+            size_t indent;
+            size_t length;
+        };
+
+        /*!
+         * Key-value field of a structured record, its key and value are stored in LogRecord::fieldText
+         */
+        struct Field
+        {
+            size_t keyLength;
+            size_t valueLength;
+            bool quoted;        //!< Value is a string, otherwise a number or boolean literal
+        };
+
+        const LogStream *stream = nullptr;
+        std::string tag;
+        std::string text;
+        std::vector<Line> lines;
+        std::chrono::system_clock::time_point time;
+        std::thread::id tid;
+        char sign = 0; //!< Sign of the stream the record was captured from, 0 to use the sign of its stream
+        std::string fieldText;      //!< Keys and values of all fields back to back
+        std::vector<Field> fields;
+
+
+        /*!
+         * Remove all lines and fields, keeping allocated memory
+         */
+        inline void clear()
+        {
+            text.clear();
+            lines.clear();
+            fieldText.clear();
+            fields.clear();
+        }
+    };
+}
+
+#endif //LOGGER_LOGRECORD_H
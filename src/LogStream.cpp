@@ -3,41 +3,398 @@
 // See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
 
 #include "LogStream.h"
-#include <iomanip>
+#include "Json.h"
+#include "StringBuf.h"
+#include "TextFormat.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
 #include <unistd.h>
 
-Log::LogStream::LogStream() noexcept: _pid(getpid()), _sign(0), _stream(nullptr), _mutex(nullptr)
+namespace
+{
+    /*!
+     * Record being built by a batch
+     */
+    struct Frame
+    {
+        Log::LogRecord record;
+        Log::StringBuf buf;
+        std::ostream out;
+        Log::StringBuf fieldBuf;
+        std::ostream fieldOut;
+        size_t indent;
+        size_t lineStart;
+        size_t fieldStart;
+
+        Frame(): buf(record.text), out(&buf), fieldBuf(record.fieldText), fieldOut(&fieldBuf), indent(0),
+                lineStart(0), fieldStart(0)
+        {
+            record.tag.reserve(64);
+            record.text.reserve(256);
+            record.lines.reserve(8);
+        }
+
+        size_t reserved() const
+        {
+            return sizeof(Frame) + recordSize(record);
+        }
+
+        static size_t recordSize(const Log::LogRecord &record)
+        {
+            return record.tag.capacity() + record.text.capacity() + record.fieldText.capacity() +
+                   record.lines.capacity() * sizeof(Log::LogRecord::Line) +
+                   record.fields.capacity() * sizeof(Log::LogRecord::Field);
+        }
+    };
+
+    std::atomic<size_t> bufferThreads(0);
+    std::atomic<size_t> bufferBytes(0);
+    std::atomic<size_t> bufferHighWater(0);
+    std::atomic<size_t> bufferTrims(0);
+    std::atomic<size_t> bufferLimit(1024 * 1024);
+
+    /*!
+     * Per-thread buffers reused by every record printed from the thread
+     * Buffers only grow, so a thread that once printed a huge record keeps its memory
+     * until its buffers exceed the limit set by Log::setBufferLimit and are trimmed.
+     */
+    struct Staging
+    {
+        std::vector<std::unique_ptr<Frame>> frames;
+        size_t depth;
+        std::string formatted;
+        std::string prefix;
+        std::string scratch;
+        Log::LogRecord folded;
+        size_t reserved;
+
+        Staging(): depth(0), reserved(0)
+        {
+            frames.reserve(4);
+            formatted.reserve(1024);
+            bufferThreads.fetch_add(1, std::memory_order_relaxed);
+            account();
+        }
+
+        ~Staging()
+        {
+            bufferBytes.fetch_sub(reserved, std::memory_order_relaxed);
+            bufferThreads.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        Frame &top()
+        { return *frames[depth - 1]; }
+
+        /*!
+         * Update memory statistics after buffers were used, trim them if they exceed the limit
+         * @note Buffers must not be in use
+         */
+        void account()
+        {
+            update(measure());
+            if (reserved <= bufferLimit.load(std::memory_order_relaxed))
+                return;
+            frames.clear();
+            frames.shrink_to_fit();
+            frames.reserve(4);
+            std::string().swap(formatted);
+            std::string().swap(prefix);
+            std::string().swap(scratch);
+            folded = Log::LogRecord();
+            formatted.reserve(1024);
+            bufferTrims.fetch_add(1, std::memory_order_relaxed);
+            update(measure());
+        }
+
+        void update(size_t total)
+        {
+            if (total == reserved)
+                return;
+            size_t bytes = bufferBytes.fetch_add(total - reserved, std::memory_order_relaxed) + total - reserved;
+            reserved = total;
+            size_t highWater = bufferHighWater.load(std::memory_order_relaxed);
+            while (bytes > highWater && !bufferHighWater.compare_exchange_weak(highWater, bytes,
+                                                                               std::memory_order_relaxed));
+        }
+
+        size_t measure() const
+        {
+            size_t total = sizeof(Staging) + frames.capacity() * sizeof(frames[0]) + formatted.capacity() +
+                           prefix.capacity() + scratch.capacity() + Frame::recordSize(folded);
+            for (const auto &frame : frames)
+                total += frame->reserved();
+            return total;
+        }
+    };
+
+    thread_local Staging staging;
+}
+
+Log::BufferStats Log::bufferStats()
+{
+    BufferStats stats;
+    stats.threads = bufferThreads.load(std::memory_order_relaxed);
+    stats.reserved = bufferBytes.load(std::memory_order_relaxed);
+    stats.highWater = bufferHighWater.load(std::memory_order_relaxed);
+    stats.trimmed = bufferTrims.load(std::memory_order_relaxed);
+    stats.limit = bufferLimit.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Log::setBufferLimit(size_t bytes)
+{
+    bufferLimit.store(bytes, std::memory_order_relaxed);
+}
+
+Log::LogStream::Batch::Batch(const LogStream &stream, std::string_view tag, std::chrono::system_clock::time_point time):
+        _stream(stream), _joined(false)
+{
+    Staging &s = staging;
+    if (s.depth != 0 && s.top().record.stream == &stream)
+    {
+        _joined = true;
+        return;
+    }
+    if (s.frames.size() == s.depth)
+        s.frames.emplace_back(new Frame);
+    LogRecord &record = s.frames[s.depth++]->record;
+    record.clear();
+    record.stream = &stream;
+    record.tag.assign(tag);
+    record.time = time == std::chrono::system_clock::time_point() ? now(stream._clock) : time;
+    record.tid = std::this_thread::get_id();
+}
+
+Log::LogStream::Batch::~Batch()
+{
+    if (_joined)
+        return;
+    Staging &s = staging;
+    LogRecord &record = s.top().record;
+    if (!record.lines.empty())
+        _stream.commit(record);
+    if (--s.depth == 0)
+        s.account();
+}
+
+Log::LogStream::LogStream() noexcept: _pid(getpid()), _sign(0), _mutex(nullptr),
+        _clock(ClockSource::Realtime), _critical(false), _format(OutputFormat::Text), _controls(ControlChars::Keep), _trigger(false),
+        _metrics(nullptr), _group(nullptr), _severe(false)
 {
 }
 
 Log::LogStream::LogStream(char sign, std::ostream &stream, std::shared_ptr<std::mutex> mutex):
-        _pid(getpid()), _sign(sign), _stream(&stream), _mutex(std::move(mutex))
+        _pid(getpid()), _sign(sign), _sink(std::make_shared<OStreamSink>(stream)), _mutex(std::move(mutex)),
+        _clock(ClockSource::Realtime), _critical(false), _flushState(std::make_shared<FlushState>()),
+        _format(OutputFormat::Text), _controls(ControlChars::Keep), _trigger(false), _metrics(nullptr),
+        _group(nullptr), _severe(false)
 {
 }
 
-void Log::LogStream::printStr(size_t indent, const std::string &tag, const std::string &msg) const
+void Log::LogStream::printStr(size_t indent, std::string_view tag, std::string_view msg) const
 {
-    if (_stream == nullptr)
+    if (!enabled())
         return;
-    size_t spos = 0;
-    size_t epos = 0;
-    while (epos != std::string::npos)
+    Batch batch(*this, tag);
+    beginText(indent, tag);
+    appendLines(msg);
+}
+
+void Log::LogStream::printRecord(const LogRecord &record) const
+{
+    if (_sink == nullptr)
+        return;
+    Staging &s = staging;
+    s.formatted.clear();
+    uint32_t tagId = encode(record, s.formatted);
+    std::mutex *mutex = outputMutex();
+    if (mutex != nullptr)
+        lock(*mutex);
+    // Repeats are only tracked under a lock
+    if (mutex == nullptr || _repeats == nullptr || !suppressRepeat(record))
+    {
+        wrote(write(record, tagId, s.formatted));
+        if (needFlush())
+            flushSink();
+    }
+    if (mutex != nullptr)
+        mutex->unlock();
+    // Other streams are locked after this one is released, streams of errors may share locks with them
+    if (_severe && _group != nullptr)
     {
-        epos = msg.find('\n', epos + 1);
-        println(indent, tag, msg.substr(spos, epos - spos));
-        spos = epos + 1;
+        for (const auto &stream : *_group)
+        {
+            if (&stream != this && stream._flushPolicy.mode == FlushMode::Severity)
+                stream.flushPending();
+        }
     }
+    // Records of the calling thread are accounted when their batch ends
+    if (s.depth == 0)
+        s.account();
+}
+
+uint32_t Log::LogStream::encode(const LogRecord &record, std::string &out) const
+{
+    switch (_format)
+    {
+        case OutputFormat::Binary:
+            return _binary->encode(folded(record), uint32_t(_pid), record.sign != 0 ? record.sign : _sign, out);
+        case OutputFormat::Json:
+            formatJson(record, out);
+            break;
+        case OutputFormat::Text:
+            formatText(record, out);
+            break;
+    }
+    return 0;
+}
+
+size_t Log::LogStream::write(const LogRecord &record, uint32_t tagId, const std::string &data) const
+{
+    std::string_view parts[2];
+    size_t count = 0;
+    if (_format == OutputFormat::Binary)
+    {
+        std::string &prefix = staging.prefix;
+        prefix.clear();
+        _binary->prepare(tagId, record.tag, prefix);
+        // A new file needs its own header and tag entries
+        if (_sink->reserve(prefix.size() + data.size()))
+        {
+            _binary->reset();
+            prefix.clear();
+            _binary->prepare(tagId, record.tag, prefix);
+        }
+        if (!prefix.empty())
+            parts[count++] = prefix;
+    }
+    parts[count++] = data;
+    _sink->writeRecord(record, parts, count);
+    return count == 1 ? data.size() : data.size() + parts[0].size();
+}
+
+bool Log::LogStream::suppressRepeat(const LogRecord &record) const
+{
+    RepeatState &r = *_repeats;
+    bool same = r.valid && record.tag == r.last.tag && record.text == r.last.text &&
+                record.fieldText == r.last.fieldText && record.fields.size() == r.last.fields.size() &&
+                std::equal(record.fields.begin(), record.fields.end(), r.last.fields.begin(),
+                           [](const LogRecord::Field &a, const LogRecord::Field &b)
+                           { return a.keyLength == b.keyLength && a.quoted == b.quoted; }) &&
+                record.lines.size() == r.last.lines.size() &&
+                std::equal(record.lines.begin(), record.lines.end(), r.last.lines.begin(),
+                           [](const LogRecord::Line &a, const LogRecord::Line &b)
+                           { return a.indent == b.indent && a.length == b.length; });
+    if (same)
+    {
+        ++r.count;
+        r.last.time = record.time;
+        r.last.tid = record.tid;
+        return true;
+    }
+    wrote(writeRepeats());
+    r.last.tag = record.tag;
+    r.last.text = record.text;
+    r.last.lines = record.lines;
+    r.last.fieldText = record.fieldText;
+    r.last.fields = record.fields;
+    r.valid = true;
+    return false;
+}
+
+size_t Log::LogStream::writeRepeats() const
+{
+    RepeatState &r = *_repeats;
+    if (r.count == 0)
+        return 0;
+    char buf[64] = "last message repeated ";
+    char *pos = buf + std::char_traits<char>::length(buf);
+    pos = std::to_chars(pos, buf + sizeof(buf), r.count).ptr;
+    std::string_view times = r.count == 1 ? " time" : " times";
+    pos = std::copy(times.begin(), times.end(), pos);
+    r.count = 0;
+    r.notice.tag = r.last.tag;
+    r.notice.text.assign(buf, size_t(pos - buf));
+    r.notice.lines.assign(1, {0, r.notice.text.size()});
+    r.notice.time = r.last.time;
+    r.notice.tid = r.last.tid;
+    r.formatted.clear();
+    uint32_t tagId = encode(r.notice, r.formatted);
+    return write(r.notice, tagId, r.formatted);
+}
+
+void Log::LogStream::setRecorder(std::shared_ptr<FlightRecorder> recorder, bool trigger)
+{
+    _recorder = std::move(recorder);
+    _trigger = trigger;
+}
+
+bool Log::LogStream::dumpRecorder(bool allThreads) const
+{
+    if (_recorder == nullptr || _sink == nullptr)
+        return false;
+    auto print = [this](LogRecord &record)
+    {
+        record.stream = this;
+        output(record);
+    };
+    if (allThreads)
+        _recorder->dumpAll(print);
+    else
+        _recorder->dumpThread(print);
+    return true;
+}
+
+void Log::LogStream::setMetrics(StreamMetrics *metrics)
+{
+    _metrics = metrics;
+}
+
+void Log::LogStream::setFlushGroup(const std::vector<LogStream> *group, bool severe)
+{
+    _group = group;
+    _severe = severe;
+}
+
+void Log::LogStream::flushDue() const
+{
+    if (_sink == nullptr || _flushPolicy.mode != FlushMode::Interval ||
+        _flushState->unflushed.load(std::memory_order_relaxed) == 0 || !needFlush())
+        return;
+    flushPending();
+}
+
+void Log::LogStream::setRepeatSuppression(bool enable)
+{
+    _repeats = enable ? std::make_shared<RepeatState>() : nullptr;
+}
+
+bool Log::LogStream::getRepeatSuppression() const
+{
+    return _repeats != nullptr;
 }
 
 void Log::LogStream::setStream(std::ostream &stream, std::shared_ptr<std::mutex> mutex)
 {
-    _stream = &stream;
+    setSink(std::make_shared<OStreamSink>(stream), std::move(mutex));
+}
+
+void Log::LogStream::setSink(std::shared_ptr<Sink> sink, std::shared_ptr<std::mutex> mutex)
+{
+    _sink = std::move(sink);
     _mutex = std::move(mutex);
+    _flushState = std::make_shared<FlushState>();
 }
 
 std::ostream &Log::LogStream::getStream() const
 {
-    return *_stream;
+    return dynamic_cast<OStreamSink &>(*_sink).stream();
+}
+
+std::shared_ptr<Log::Sink> Log::LogStream::getSink() const
+{
+    return _sink;
 }
 
 void Log::LogStream::setSign(char sign)
@@ -50,31 +407,368 @@ std::shared_ptr<std::mutex> Log::LogStream::getMutex() const
     return _mutex;
 }
 
+void Log::LogStream::setAsync(std::shared_ptr<AsyncWriter> async)
+{
+    _async = std::move(async);
+}
+
+std::shared_ptr<Log::AsyncWriter> Log::LogStream::getAsync() const
+{
+    return _async;
+}
+
+void Log::LogStream::setClock(ClockSource clock)
+{
+    _clock = clock;
+}
+
+Log::ClockSource Log::LogStream::getClock() const
+{
+    return _clock;
+}
+
+void Log::LogStream::setFlushPolicy(FlushPolicy policy)
+{
+    _flushPolicy = policy;
+}
+
+Log::FlushPolicy Log::LogStream::getFlushPolicy() const
+{
+    return _flushPolicy;
+}
+
+void Log::LogStream::setCritical(bool critical)
+{
+    _critical = critical;
+}
+
+void Log::LogStream::setFormat(OutputFormat format)
+{
+    _format = format;
+    _binary = format == OutputFormat::Binary ? std::make_shared<BinaryWriter>() : nullptr;
+}
+
+Log::OutputFormat Log::LogStream::getFormat() const
+{
+    return _format;
+}
+
+void Log::LogStream::setControlChars(ControlChars policy)
+{
+    _controls = policy;
+}
+
+Log::ControlChars Log::LogStream::getControlChars() const
+{
+    return _controls;
+}
+
+void Log::LogStream::flush() const
+{
+    if (_async != nullptr)
+        _async->flush();
+    if (_sink == nullptr)
+        return;
+    std::mutex *mutex = outputMutex();
+    if (mutex != nullptr)
+        lock(*mutex);
+    if (mutex != nullptr && _repeats != nullptr)
+        wrote(writeRepeats());
+    flushSink();
+    _flushState->lastFlush.store(std::chrono::steady_clock::now().time_since_epoch().count(),
+                                 std::memory_order_relaxed);
+    if (mutex != nullptr)
+        mutex->unlock();
+}
+
 void Log::LogStream::disable()
 {
-    _stream = nullptr;
+    _sink = nullptr;
     _mutex = nullptr;
+    _flushState = nullptr;
+}
+
+void Log::LogStream::formatText(const LogRecord &record, std::string &out) const
+{
+    uint64_t tid = threadNumber(record.tid);
+    char sign = record.sign != 0 ? record.sign : _sign;
+    size_t pos = 0;
+    for (const auto &line : record.lines)
+    {
+        appendHeader(out, record.time, uint64_t(_pid), tid, sign, record.tag);
+        appendIndent(out, line.indent);
+        out.append(record.text, pos, line.length);
+        pos += line.length;
+        if (&line == &record.lines.back())
+            appendFields(out, record);
+        out.push_back('\n');
+    }
+}
+
+void Log::LogStream::formatJson(const LogRecord &record, std::string &out) const
+{
+    char buf[32];
+    auto number = [&out, &buf](auto value)
+    {
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+    };
+    out.append("{\"time\":");
+    number(std::chrono::duration_cast<std::chrono::nanoseconds>(record.time.time_since_epoch()).count());
+    out.append(",\"pid\":");
+    number(_pid);
+    out.append(",\"tid\":");
+    number(threadNumber(record.tid));
+    out.append(",\"level\":");
+    char sign = record.sign != 0 ? record.sign : _sign;
+    appendJsonString(out, std::string_view(&sign, 1));
+    out.append(",\"tag\":");
+    appendJsonString(out, record.tag);
+    out.append(",\"msg\":\"");
+    std::string_view text = record.text;
+    for (const auto &line : record.lines)
+    {
+        if (&line != &record.lines.front())
+            out.append("\\n");
+        appendJsonEscaped(out, text.substr(0, line.length));
+        text.remove_prefix(line.length);
+    }
+    out.push_back('"');
+    std::string_view fields = record.fieldText;
+    for (const auto &field : record.fields)
+    {
+        out.push_back(',');
+        appendJsonString(out, fields.substr(0, field.keyLength));
+        out.push_back(':');
+        std::string_view value = fields.substr(field.keyLength, field.valueLength);
+        if (field.quoted)
+            appendJsonString(out, value);
+        else
+            out.append(value);
+        fields.remove_prefix(field.keyLength + field.valueLength);
+    }
+    out.append("}\n");
+}
+
+const Log::LogRecord &Log::LogStream::folded(const LogRecord &record) const
+{
+    if (record.fields.empty())
+        return record;
+    // Binary format and flight recorder store lines only, fields are printed into the last one
+    LogRecord &copy = staging.folded;
+    copy.stream = record.stream;
+    copy.tag = record.tag;
+    copy.time = record.time;
+    copy.tid = record.tid;
+    copy.sign = record.sign;
+    copy.text = record.text;
+    copy.lines = record.lines;
+    if (copy.lines.empty())
+        copy.lines.push_back({0, 0});
+    size_t length = copy.text.size();
+    appendFields(copy.text, record);
+    copy.lines.back().length += copy.text.size() - length;
+    return copy;
+}
+
+std::string &Log::LogStream::beginField(std::string_view key, bool quoted) const
+{
+    Frame &frame = staging.top();
+    frame.record.fieldText.append(key);
+    frame.record.fields.push_back({key.size(), 0, quoted});
+    frame.fieldStart = frame.record.fieldText.size();
+    return frame.record.fieldText;
+}
+
+std::ostream &Log::LogStream::fieldStream() const
+{
+    return staging.top().fieldOut;
+}
+
+void Log::LogStream::endField() const
+{
+    Frame &frame = staging.top();
+    frame.record.fields.back().valueLength = frame.record.fieldText.size() - frame.fieldStart;
+}
+
+std::string &Log::LogStream::beginText(size_t indent, std::string_view tag) const
+{
+    Frame &frame = staging.top();
+    if (frame.record.tag != tag)
+    {
+        if (!frame.record.lines.empty())
+            commit(frame.record);
+        frame.record.clear();
+        frame.record.tag.assign(tag);
+    }
+    frame.indent = indent;
+    frame.lineStart = frame.record.text.size();
+    return frame.record.text;
+}
+
+std::ostream &Log::LogStream::beginLine(size_t indent, std::string_view tag) const
+{
+    beginText(indent, tag);
+    return staging.top().out;
+}
+
+void Log::LogStream::endLine() const
+{
+    Frame &frame = staging.top();
+    LogRecord &record = frame.record;
+    // Text written since beginText() may contain line breaks, each line gets its own header
+    std::string_view text(record.text.data() + frame.lineStart, record.text.size() - frame.lineStart);
+    if (lineScanPosition(text, _controls != ControlChars::Keep) == text.size())
+    {
+        record.lines.push_back({frame.indent, text.size()});
+        return;
+    }
+    std::string &scratch = staging.scratch;
+    scratch.assign(text);
+    record.text.resize(frame.lineStart);
+    appendLines(scratch);
+}
+
+void Log::LogStream::appendLines(std::string_view text) const
+{
+    Frame &frame = staging.top();
+    LogRecord &record = frame.record;
+    bool controls = _controls != ControlChars::Keep;
+    size_t start = record.text.size();
+    while (true)
+    {
+        size_t pos = lineScanPosition(text, controls);
+        record.text.append(text.data(), pos);
+        if (pos == text.size())
+            break;
+        if (text[pos] == '\n')
+        {
+            record.lines.push_back({frame.indent, record.text.size() - start});
+            start = record.text.size();
+            ++pos;
+        }
+        else
+            pos += appendControl(record.text, text.substr(pos), _controls);
+        text.remove_prefix(pos);
+    }
+    record.lines.push_back({frame.indent, record.text.size() - start});
+}
+
+void Log::LogStream::commit(const LogRecord &record) const
+{
+    if (_recorder != nullptr)
+    {
+        if (_sink == nullptr)
+        {
+            _recorder->capture(folded(record), _sign);
+            count(Counter::Captured);
+            return;
+        }
+        if (_trigger)
+            dumpRecorder(false);
+    }
+    count(Counter::Messages);
+    count(Counter::Lines, record.lines.size());
+    output(record);
+}
+
+void Log::LogStream::output(const LogRecord &record) const
+{
+    if (_async == nullptr)
+        printRecord(record);
+    else
+    {
+        _async->push(record);
+        if (_critical)
+            _async->flush();
+    }
 }
 
-std::ostream &Log::LogStream::putTime() const
+void Log::LogStream::flushLocked() const
 {
-    auto chronotime = std::chrono::system_clock::now();
-    time_t time = std::chrono::system_clock::to_time_t(chronotime);
-    tm ltime{};
-    *_stream << std::put_time(localtime_r(&time, &ltime), "%m-%d %T") << "." << std::setfill('0') << std::setw(9)
-             << std::chrono::time_point_cast<std::chrono::nanoseconds>(chronotime).time_since_epoch().count()%1000000000;
-    return *_stream;
+    if (_sink == nullptr)
+        return;
+    if (outputMutex() != nullptr && _repeats != nullptr)
+        wrote(writeRepeats());
+    if (_flushState->unflushed.load(std::memory_order_relaxed) == 0)
+        return;
+    flushSink();
 }
 
-std::ostream &Log::LogStream::putIndent(size_t N) const
+void Log::LogStream::lock(std::mutex &mutex) const
 {
+    if (_metrics == nullptr)
+    {
+        mutex.lock();
+        return;
+    }
+    if (mutex.try_lock())
+        return;
+    // Only contended locks are timed, reading the clock costs more than an uncontended lock
+    auto start = std::chrono::steady_clock::now();
+    mutex.lock();
+    auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    _metrics->add(Counter::LockWait, uint64_t(wait.count()));
+}
+
+void Log::LogStream::wrote(size_t bytes) const
+{
+    _flushState->unflushed.fetch_add(bytes, std::memory_order_relaxed);
+    count(Counter::Bytes, bytes);
+}
 
-    for(size_t i = 0; i < N; ++i)
+void Log::LogStream::flushSink() const
+{
+    _sink->flush();
+    _flushState->unflushed.store(0, std::memory_order_relaxed);
+    count(Counter::Flushes);
+}
+
+std::mutex *Log::LogStream::outputMutex() const
+{
+    // Tag entries must precede records using them even if the stream itself needs no lock
+    if (_mutex == nullptr && _binary != nullptr)
+        return &_binary->mutex();
+    return _mutex.get();
+}
+
+bool Log::LogStream::needFlush() const
+{
+    if (_critical)
+        return true;
+    switch (_flushPolicy.mode)
     {
-        *_stream<<"    ";
+        case FlushMode::EveryRecord:
+            return true;
+        case FlushMode::Bytes:
+            return _flushState->unflushed.load(std::memory_order_relaxed) >= _flushPolicy.bytes;
+        case FlushMode::Interval:
+        {
+            auto time = std::chrono::steady_clock::now().time_since_epoch().count();
+            auto last = _flushState->lastFlush.load(std::memory_order_relaxed);
+            if (std::chrono::steady_clock::duration(time - last) < _flushPolicy.interval)
+                return false;
+            // Only one of concurrent writers flushes
+            return _flushState->lastFlush.compare_exchange_strong(last, time, std::memory_order_relaxed);
+        }
+        case FlushMode::Severity:
+            return _severe;
+        case FlushMode::Manual:
+            return false;
     }
+    return true;
+}
 
-    return *_stream;
+void Log::LogStream::flushPending() const
+{
+    if (_sink == nullptr || _flushState->unflushed.load(std::memory_order_relaxed) == 0)
+        return;
+    std::mutex *mutex = outputMutex();
+    if (mutex != nullptr)
+        lock(*mutex);
+    if (_flushState->unflushed.load(std::memory_order_relaxed) != 0)
+        flushSink();
+    if (mutex != nullptr)
+        mutex->unlock();
 }
 
 void Log::LogStream::updatePID()
@@ -83,20 +777,26 @@ void Log::LogStream::updatePID()
 }
 
 void Log::LogStream::printer<std::string>::operator()
-        (const LogStream &stream, size_t indent, const std::string &tag, const std::string &msg)
+        (const LogStream &stream, size_t indent, std::string_view tag, const std::string &msg)
 {
     stream.printStr(indent, tag, msg);
 }
 
 
+void Log::LogStream::printer<std::string_view>::operator()
+        (const LogStream &stream, size_t indent, std::string_view tag, std::string_view msg)
+{
+    stream.printStr(indent, tag, msg);
+}
+
 void Log::LogStream::printer<char*>::operator()
-        (const LogStream &stream, size_t indent, const std::string &scope, const char* msg)
+        (const LogStream &stream, size_t indent, std::string_view scope, const char* msg)
 {
     stream.printStr(indent, scope, msg);
 }
 
 void Log::LogStream::printer<const char*>::operator()
-        (const LogStream &stream, size_t indent, const std::string &scope, const char* msg)
+        (const LogStream &stream, size_t indent, std::string_view scope, const char* msg)
 {
     stream.printStr(indent, scope, msg);
 }
@@ -5,13 +5,65 @@
 #ifndef LOGGER_LOGSTREAM_H
 #define LOGGER_LOGSTREAM_H
 
+#include <atomic>
 #include <ostream>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <charconv>
+#include <cmath>
+#include <string_view>
+#include <type_traits>
+#include "AsyncWriter.h"
+#include "BinaryFormat.h"
+#include "FlushPolicy.h"
+#include "FlightRecorder.h"
+#include "Format.h"
+#include "LineScan.h"
+#include "Metrics.h"
+#include "Sink.h"
+#include "Timestamp.h"
 
 namespace Log
 {
+    /*!
+     * Output format of a log stream
+     */
+    enum class OutputFormat
+    {
+        Text,   //!< Human readable text, one line per message line
+        Binary, //!< Compact binary records, see BinaryFormat.h, converted back to text by logdecode
+        Json,   //!< JSON Lines, one object per record with its lines joined into a single message
+    };
+
+    /*!
+     * Memory held by per-thread buffers that records are built and formatted in
+     * Every thread that prints a message owns such buffers, they are reused by all of its records,
+     * so steady-state logging does not touch the global allocator.
+     */
+    struct BufferStats
+    {
+        size_t threads = 0;     //!< Amount of threads owning buffers
+        size_t reserved = 0;    //!< Bytes currently reserved by buffers of all threads
+        size_t highWater = 0;   //!< Largest amount of bytes ever reserved at once
+        size_t trimmed = 0;     //!< Amount of times buffers of a thread exceeded the limit and were released
+        size_t limit = 0;       //!< Per-thread limit, see setBufferLimit
+    };
+
+    /*!
+     * Get memory statistics of per-thread record buffers
+     * @return Buffer statistics
+     */
+    BufferStats bufferStats();
+
+    /*!
+     * Set the amount of memory a thread may keep in its record buffers
+     * Buffers of a thread exceeding the limit after a record is written are released, so a single huge
+     * record does not pin its memory for the lifetime of the thread.
+     * @param bytes Per-thread limit, 1 MiB by default
+     */
+    void setBufferLimit(size_t bytes);
+
     /*!
      * Logging stream class
      */
@@ -35,15 +87,109 @@ namespace Log
              * @param tag Message scope
              * @param msg Message
              */
-            void operator()(const LogStream& stream, size_t indent, const std::string &tag, const MsgT &msg);
+            void operator()(const LogStream& stream, size_t indent, std::string_view tag, const MsgT &msg);
+        };
+
+
+        /*!
+         * Groups all lines printed into a stream by the current thread into a single record
+         * The record is written with a single locked write when the outermost batch is destroyed
+         */
+        class Batch
+        {
+        private:
+            const LogStream &_stream;
+            bool _joined;
+        public:
+
+
+            /*!
+             * Constructor
+             * Joins a batch already opened for the same stream by the current thread
+             * @param stream Stream to print the record into
+             * @param tag Record tag
+             * @param time Record time, default to read the clock of the stream
+             */
+            Batch(const LogStream &stream, std::string_view tag, std::chrono::system_clock::time_point time = {});
+
+
+            /*!
+             * Destructor
+             * Writes the record if this is the outermost batch
+             */
+            ~Batch();
+
+            Batch(const Batch &) = delete;
+            Batch &operator=(const Batch &) = delete;
         };
     private:
+        /*!
+         * Output state shared by copies of a stream
+         * Atomic, streams without a mutex are written concurrently
+         */
+        struct FlushState
+        {
+            std::atomic<size_t> unflushed{0};
+            std::atomic<std::chrono::steady_clock::rep> lastFlush{
+                    std::chrono::steady_clock::now().time_since_epoch().count()};
+        };
+
+        /*!
+         * Last message and amount of its suppressed repeats
+         * Only accessed under the output mutex
+         */
+        struct RepeatState
+        {
+            LogRecord last;
+            LogRecord notice;
+            std::string formatted;
+            size_t count = 0;
+            bool valid = false;
+        };
+
         __pid_t _pid;
         char _sign;
-        std::ostream * _stream;
+        std::shared_ptr<Sink> _sink;
         std::shared_ptr<std::mutex> _mutex;
-        std::ostream & putTime() const;
-        std::ostream & putIndent(size_t N) const;
+        std::shared_ptr<AsyncWriter> _async;
+        ClockSource _clock;
+        FlushPolicy _flushPolicy;
+        bool _critical;
+        std::shared_ptr<FlushState> _flushState;
+        OutputFormat _format;
+        ControlChars _controls;
+        std::shared_ptr<BinaryWriter> _binary;
+        std::shared_ptr<RepeatState> _repeats;
+        std::shared_ptr<FlightRecorder> _recorder;
+        bool _trigger;
+        StreamMetrics *_metrics;
+        const std::vector<LogStream> *_group;
+        bool _severe;
+        bool needFlush() const;
+        void flushPending() const;
+        void lock(std::mutex &mutex) const;
+        void wrote(size_t bytes) const;
+        void flushSink() const;
+        uint32_t encode(const LogRecord &record, std::string &out) const;
+        size_t write(const LogRecord &record, uint32_t tagId, const std::string &data) const;
+        bool suppressRepeat(const LogRecord &record) const;
+        size_t writeRepeats() const;
+        void formatText(const LogRecord &record, std::string &out) const;
+        void formatJson(const LogRecord &record, std::string &out) const;
+        const LogRecord &folded(const LogRecord &record) const;
+        std::string & beginField(std::string_view key, bool quoted) const;
+        std::ostream & fieldStream() const;
+        void endField() const;
+        template <typename ValueT>
+        void addField(std::string_view key, const ValueT &value) const;
+        template <typename KeyT, typename ValueT, typename ... Rest>
+        void addFields(const KeyT &key, const ValueT &value, const Rest & ... rest) const;
+        std::string & beginText(size_t indent, std::string_view tag) const;
+        std::ostream & beginLine(size_t indent, std::string_view tag) const;
+        void endLine() const;
+        void appendLines(std::string_view text) const;
+        void commit(const LogRecord &record) const;
+        void output(const LogRecord &record) const;
     public:
 
 
@@ -67,7 +213,29 @@ namespace Log
          * @param line Line to be printed
          */
         template <typename MsgT>
-        void println(size_t indent, const std::string &tag, const MsgT &line) const;
+        void println(size_t indent, std::string_view tag, const MsgT &line) const;
+
+
+        /*!
+         * Format arguments into a single line and print it into the stream
+         * @param tag Scope name
+         * @param fmt Format string checked by checkFormat
+         * @param args Arguments
+         */
+        template <typename ... Args>
+        void printFormat(size_t indent, std::string_view tag, std::string_view fmt, const Args & ... args) const;
+
+
+        /*!
+         * Print a message with key-value fields
+         * Fields are printed as " key=value" pairs after the message in text format and as members of the record
+         * object in JSON format. Arithmetic and boolean values are printed as JSON literals, other values as strings.
+         * @param tag Scope name
+         * @param msg Message
+         * @param fields Keys, each followed by its value
+         */
+        template <typename MsgT, typename ... Fields>
+        void printKV(size_t indent, std::string_view tag, const MsgT &msg, const Fields & ... fields) const;
 
 
         /*!
@@ -75,25 +243,48 @@ namespace Log
          * @param tag Scope name
          * @param msg Message
          */
-        void printStr(size_t indent, const std::string &tag, const std::string &msg) const;
+        void printStr(size_t indent, std::string_view tag, std::string_view msg) const;
+
+
+        /*!
+         * Format a record and write it into the stream with a single locked write
+         * @param record Captured message
+         */
+        void printRecord(const LogRecord &record) const;
 
 
         /*!
          * Set output stream
          * @param stream Output stream
-         * @param mutex Mutex to use for specified output stream
+         * @param mutex Mutex to use for specified output stream,
+         *              nullptr if the stream buffer can be written by several threads at once
          */
         void setStream(std::ostream &stream, std::shared_ptr<std::mutex> mutex);
 
 
+        /*!
+         * Set output sink
+         * @param sink Output sink
+         * @param mutex Mutex to use for specified sink, nullptr if the sink is thread safe
+         */
+        void setSink(std::shared_ptr<Sink> sink, std::shared_ptr<std::mutex> mutex);
+
+
         /*!
          * Get output stream
-         * @note Unidentified behaviour if stream is disabled
+         * @note Unidentified behaviour if stream is disabled or writes into a sink other than OStreamSink
          * @return Output stream
          */
         std::ostream &getStream() const;
 
 
+        /*!
+         * Get output sink
+         * @return Output sink, nullptr if stream is disabled
+         */
+        std::shared_ptr<Sink> getSink() const;
+
+
         /*!
          * Set sign
          * @param sign Character that specifies this stream
@@ -107,12 +298,192 @@ namespace Log
          */
         std::shared_ptr<std::mutex> getMutex() const;
 
+
+        /*!
+         * Set asynchronous writer
+         * Messages are queued into the writer and printed by its background thread
+         * @param async Writer to use, nullptr to print on the caller's thread
+         */
+        void setAsync(std::shared_ptr<AsyncWriter> async);
+
+
+        /*!
+         * Get asynchronous writer used for this stream
+         * @return Writer used in this stream, nullptr if messages are printed on the caller's thread
+         */
+        std::shared_ptr<AsyncWriter> getAsync() const;
+
+
+        /*!
+         * Set clock used to timestamp messages
+         * @param clock Clock source
+         */
+        void setClock(ClockSource clock);
+
+
+        /*!
+         * Get clock used to timestamp messages
+         * @return Clock source
+         */
+        ClockSource getClock() const;
+
+
+        /*!
+         * Set output stream flush policy
+         * @param policy Flush policy
+         */
+        void setFlushPolicy(FlushPolicy policy);
+
+
+        /*!
+         * Get output stream flush policy
+         * @return Flush policy
+         */
+        FlushPolicy getFlushPolicy() const;
+
+
+        /*!
+         * Mark stream as critical
+         * Critical stream ignores its flush policy and flushes every record,
+         * in asynchronous mode the caller also waits until the record is written
+         * @param critical true to mark stream as critical
+         */
+        void setCritical(bool critical);
+
+
+        /*!
+         * Check if stream is critical
+         * @return true if critical, false otherwise
+         */
+        inline bool critical() const
+        { return _critical; }
+
+
+        /*!
+         * Set output format
+         * @param format Output format
+         */
+        void setFormat(OutputFormat format);
+
+
+        /*!
+         * Get output format
+         * @return Output format
+         */
+        OutputFormat getFormat() const;
+
+
+        /*!
+         * Set handling of control characters in message text
+         * @param policy Control character policy
+         */
+        void setControlChars(ControlChars policy);
+
+
+        /*!
+         * Get handling of control characters in message text
+         * @return Control character policy
+         */
+        ControlChars getControlChars() const;
+
+
+        /*!
+         * Flush output stream
+         */
+        void flush() const;
+
+
+        /*!
+         * Collapse identical consecutive messages into a repeat count
+         * Has no effect on streams written without a lock
+         * @param enable true to suppress repeats, false to print every message
+         */
+        void setRepeatSuppression(bool enable);
+
+
+        /*!
+         * Check if repeats are suppressed
+         * @return true if identical consecutive messages are collapsed, false otherwise
+         */
+        bool getRepeatSuppression() const;
+
+
+        /*!
+         * Flush output stream if records were written since the last flush
+         * @note Caller must hold outputMutex()
+         */
+        void flushLocked() const;
+
+
+        /*!
+         * Get the lock serializing writes into the output stream
+         * @return Mutex, nullptr if the stream is written without locking
+         */
+        std::mutex *outputMutex() const;
+
+        /*!
+         * Set flight recorder
+         * A stream without output captures records into the recorder instead of discarding them
+         * @param recorder Flight recorder, nullptr to disable
+         * @param trigger true to print records captured by the calling thread before every record of this stream
+         */
+        void setRecorder(std::shared_ptr<FlightRecorder> recorder, bool trigger);
+
+
+        /*!
+         * Print records captured by the flight recorder
+         * @param allThreads true to print records of all threads, false of the calling thread only
+         * @return true if records were taken, false if the stream has no recorder or no output
+         */
+        bool dumpRecorder(bool allThreads) const;
+
+        /*!
+         * Set counters updated by this stream
+         * @param metrics Counters, nullptr to disable counting
+         */
+        void setMetrics(StreamMetrics *metrics);
+
+
+        /*!
+         * Set streams of the same logger
+         * Streams with FlushMode::Severity among them are flushed after a record of a severe stream
+         * @param group Streams, nullptr if the stream is used alone
+         * @param severe true if records of this stream are errors
+         */
+        void setFlushGroup(const std::vector<LogStream> *group, bool severe);
+
+
+        /*!
+         * Flush output pending for longer than the interval of FlushMode::Interval
+         * Called by a timer, does nothing for other flush modes
+         */
+        void flushDue() const;
+
+
+        /*!
+         * Increase a counter of this stream
+         * @param counter Counter
+         * @param value Amount to add
+         */
+        inline void count(Counter counter, uint64_t value = 1) const
+        {
+            if (_metrics != nullptr)
+                _metrics->add(counter, value);
+        }
+
         /*!
          * Check if stream is enabled
-         * @return true if enabled, false otherwise
+         * @return true if messages are printed or captured by a flight recorder, false otherwise
          */
         inline bool enabled() const
-        { return _stream != nullptr; }
+        { return _sink != nullptr || _recorder != nullptr; }
+
+        /*!
+         * Check if stream prints messages
+         * @return true if messages are written into an output, false otherwise
+         */
+        inline bool printing() const
+        { return _sink != nullptr; }
 
         /*!
          * Disable this thread
@@ -127,41 +498,98 @@ namespace Log
 }
 
 template<typename MsgT>
-void Log::LogStream::println(size_t indent, const std::string &tag, const MsgT &line) const
+void Log::LogStream::println(size_t indent, std::string_view tag, const MsgT &line) const
 {
-    if (_mutex != nullptr)
-        _mutex->lock();
-    putTime();
-    (*_stream) << "  " << _pid << "  " << std::this_thread::get_id() << " ";
-    (*_stream) << _sign << " " << tag << ": ";
-    putIndent(indent);
-    (*_stream)<< line << std::endl;
-    if (_mutex != nullptr)
-        _mutex->unlock();
+    if (!enabled())
+        return;
+    Batch batch(*this, tag);
+    beginLine(indent, tag) << line;
+    endLine();
+}
+
+template<typename... Args>
+void Log::LogStream::printFormat(size_t indent, std::string_view tag, std::string_view fmt, const Args &... args) const
+{
+    if (!enabled())
+        return;
+    Batch batch(*this, tag);
+    formatTo(beginText(indent, tag), fmt, args...);
+    endLine();
+}
+
+template<typename MsgT, typename... Fields>
+void Log::LogStream::printKV(size_t indent, std::string_view tag, const MsgT &msg, const Fields &... fields) const
+{
+    static_assert(sizeof...(Fields) % 2 == 0, "Every key must be followed by a value");
+    if (!enabled())
+        return;
+    Batch batch(*this, tag);
+    printer<MsgT>()(*this, indent, tag, msg);
+    if constexpr (sizeof...(Fields) != 0)
+        addFields(fields...);
+}
+
+template<typename KeyT, typename ValueT, typename... Rest>
+void Log::LogStream::addFields(const KeyT &key, const ValueT &value, const Rest &... rest) const
+{
+    addField(std::string_view(key), value);
+    if constexpr (sizeof...(Rest) != 0)
+        addFields(rest...);
+}
+
+template<typename ValueT>
+void Log::LogStream::addField(std::string_view key, const ValueT &value) const
+{
+    if constexpr (std::is_same_v<ValueT, bool>)
+        beginField(key, false).append(value ? "true" : "false");
+    else if constexpr (std::is_arithmetic_v<ValueT>)
+    {
+        char buf[64];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value);
+        bool finite = true;
+        if constexpr (std::is_floating_point_v<ValueT>)
+            finite = std::isfinite(value);
+        // JSON has no literals for infinity and NaN
+        beginField(key, !finite).append(buf, size_t(result.ptr - buf));
+    }
+    else if constexpr (std::is_convertible_v<const ValueT &, std::string_view>)
+        beginField(key, true).append(std::string_view(value));
+    else
+    {
+        beginField(key, true);
+        fieldStream() << value;
+    }
+    endField();
 }
 
 template <>
 struct Log::LogStream::printer<std::string>
 {
-    void operator()(const LogStream& stream, size_t indent, const std::string &tag, const std::string &msg);
+    void operator()(const LogStream& stream, size_t indent, std::string_view tag, const std::string &msg);
+};
+
+template <>
+struct Log::LogStream::printer<std::string_view>
+{
+    void operator()(const LogStream& stream, size_t indent, std::string_view tag, std::string_view msg);
 };
 
 template <>
 struct Log::LogStream::printer<char*>
 {
-    void operator()(const LogStream& stream, size_t indent, const std::string &tag, const char* msg);
+    void operator()(const LogStream& stream, size_t indent, std::string_view tag, const char* msg);
 };
 
 template <>
 struct Log::LogStream::printer<const char*>
 {
-    void operator()(const LogStream& stream, size_t indent, const std::string &tag, const char* msg);
+    void operator()(const LogStream& stream, size_t indent, std::string_view tag, const char* msg);
 };
 
 template <size_t N>
 struct Log::LogStream::printer<char[N]>
 {
-    void operator()(const LogStream& stream, size_t indent, const std::string &tag, const char* msg)
+    void operator()(const LogStream& stream, size_t indent, std::string_view tag, const char* msg)
     {
         stream.printStr(indent, tag, msg);
     }
@@ -169,8 +597,25 @@ struct Log::LogStream::printer<char[N]>
 
 template<typename MsgT>
 void Log::LogStream::printer<MsgT>::operator()
-        (const LogStream &stream, size_t indent, const std::string &tag, const MsgT &msg)
+        (const LogStream &stream, size_t indent, std::string_view tag, const MsgT &msg)
 {
+    if constexpr (std::is_arithmetic_v<MsgT>)
+    {
+        // Same output as std::to_string, without a temporary string
+        char buf[512];
+        std::to_chars_result result{};
+        if constexpr (std::is_same_v<MsgT, bool>)
+            result = std::to_chars(buf, buf + sizeof(buf), int(msg));
+        else if constexpr (std::is_floating_point_v<MsgT>)
+            result = std::to_chars(buf, buf + sizeof(buf), msg, std::chars_format::fixed, 6);
+        else
+            result = std::to_chars(buf, buf + sizeof(buf), msg);
+        if (result.ec == std::errc())
+        {
+            stream.printStr(indent, tag, std::string_view(buf, size_t(result.ptr - buf)));
+            return;
+        }
+    }
     stream.printStr(indent, tag, std::to_string(msg));
 }
 
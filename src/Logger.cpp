@@ -3,7 +3,11 @@
 // See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
 
 #include "Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <unistd.h>
 
 Log::Logger Log::defaultLog;
 
@@ -13,51 +17,513 @@ const size_t Log::levels = 6;
 const size_t Log::levels = 5;
 #endif
 
-Log::Logger::Logger() noexcept
+template<typename Modify>
+void Log::Logger::update(Modify &&modify)
 {
-    std::shared_ptr<std::mutex> coutMutex = std::make_shared<std::mutex>();
-    std::shared_ptr<std::mutex> cerrMutex = std::make_shared<std::mutex>();
-    _streams.resize(levels);
-    _streams[0] = LogStream('I', std::cout, coutMutex);
-    _streams[1] = LogStream('V', std::cout, coutMutex);
-    _streams[2] = LogStream('W', std::cout, coutMutex);
-    _streams[3] = LogStream('E', std::cerr, cerrMutex);
-    _streams[4] = LogStream('A', std::cerr, cerrMutex);
+    auto previous = _config.update([this, &modify](Config &config)
+    {
+        modify(config);
+        uint32_t enabled = 0;
+        uint32_t printed = 0;
+        for(size_t i = 0; i < config.streams.size(); ++i)
+        {
+            if(config.streams[i].enabled())
+                enabled |= 1u << i;
+            if(config.streams[i].printing())
+                printed |= 1u << i;
+            config.streams[i].setFlushGroup(&config.streams, i == Error || i == Assert);
+        }
+        _enabled.store(enabled, std::memory_order_relaxed);
+        _printed.store(printed, std::memory_order_relaxed);
+    });
+    // Queued records may point into the previous configuration
+    if(previous->async != nullptr)
+        previous->async->flush();
+}
+
+Log::Logger::Logger() noexcept: _config(std::make_unique<Config>()), _enabled((1u << levels) - 1),
+        _printed((1u << levels) - 1), _rateLimits()
+{
+    update([this](Config &config)
+    {
+        std::shared_ptr<std::mutex> coutMutex = std::make_shared<std::mutex>();
+        std::shared_ptr<std::mutex> cerrMutex = std::make_shared<std::mutex>();
+        config.streams.resize(levels);
+        config.streams[0] = LogStream('I', std::cout, coutMutex);
+        config.streams[1] = LogStream('V', std::cout, coutMutex);
+        config.streams[2] = LogStream('W', std::cout, coutMutex);
+        config.streams[3] = LogStream('E', std::cerr, cerrMutex);
+        config.streams[4] = LogStream('A', std::cerr, cerrMutex);
+        config.streams[4].setCritical(true);
 #if LOGGER_LOG_DEBUG_ENABLED
-    _streams[5] = LogStream('D', std::cout, coutMutex);
+        config.streams[5] = LogStream('D', std::cout, coutMutex);
 #endif
+        for(size_t i = 0; i < levels; ++i)
+            config.streams[i].setMetrics(&_metrics[i]);
+    });
+    addForkListener(this, ForkStage::Logger);
+}
+
+Log::Logger::~Logger()
+{
+    removeForkListener(this);
+    _signalWatcher.reset();
+    _flushTimer.reset();
+    disableAsync();
 }
 
 void Log::Logger::setStream(Log::LogLevel level, std::ostream &outStream)
 {
     if(level < levels)
     {
-        for(size_t i = 0; i < levels; ++i)
+        update([level, &outStream](Config &config)
         {
-            if(i != level && _streams[i].enabled() && &_streams[i].getStream() == &outStream)
+            auto &streams = config.streams;
+            for(size_t i = 0; i < levels; ++i)
             {
-                _streams[level].setStream(outStream, _streams[i].getMutex());
+                auto *adapter = dynamic_cast<OStreamSink *>(streams[i].getSink().get());
+                if(i != level && adapter != nullptr && &adapter->stream() == &outStream)
+                {
+                    streams[level].setStream(outStream, streams[i].getMutex());
+                    return;
+                }
+            }
+            streams[level].setStream(outStream, std::make_shared<std::mutex>());
+        });
+    }
+}
+
+void Log::Logger::setStream(Log::LogLevel level, MappedFile &file)
+{
+    setStream(level, std::make_shared<MappedFileSink>(file));
+}
+
+void Log::Logger::setStream(Log::LogLevel level, std::shared_ptr<Sink> sink)
+{
+    if(level < levels && sink != nullptr)
+    {
+        update([level, &sink](Config &config)
+        {
+            auto &streams = config.streams;
+            if(sink->threadSafe())
+            {
+                streams[level].setSink(sink, nullptr);
                 return;
             }
-        }
-        _streams[level].setStream(outStream, std::make_shared<std::mutex>());
+            for(size_t i = 0; i < levels; ++i)
+            {
+                if(i != level && streams[i].getSink() == sink)
+                {
+                    streams[level].setSink(sink, streams[i].getMutex());
+                    return;
+                }
+            }
+            streams[level].setSink(sink, std::make_shared<std::mutex>());
+        });
     }
 }
 
 void Log::Logger::disableLevel(Log::LogLevel level)
 {
     if(level < levels)
-        _streams[level].disable();
+    {
+        update([level](Config &config)
+        {
+            config.streams[level].disable();
+        });
+    }
 }
 
-void Log::Logger::print(Log::LogLevel, size_t, const std::string&) const
+void Log::Logger::print(Log::LogLevel, size_t, std::string_view) const
 {
 }
 
 void Log::Logger::updatePID()
 {
-    for(auto & i : _streams)
+    update([](Config &config)
+    {
+        for(auto & i : config.streams)
+        {
+            i.updatePID();
+        }
+    });
+}
+
+void Log::Logger::enableAsync(size_t capacity, OverflowPolicy policy)
+{
+    setAsync(std::make_shared<AsyncWriter>(capacity, policy));
+}
+
+void Log::Logger::enableSharded(size_t shards, size_t capacity, OverflowPolicy policy,
+                                std::chrono::microseconds window)
+{
+    if(shards == 0)
+        shards = std::max(1u, std::thread::hardware_concurrency());
+    setAsync(std::make_shared<AsyncWriter>(capacity, policy, shards, window));
+}
+
+void Log::Logger::setAsync(std::shared_ptr<AsyncWriter> async)
+{
+    update([&async](Config &config)
+    {
+        config.async = async;
+        for(auto & i : config.streams)
+        {
+            i.setAsync(async);
+        }
+    });
+}
+
+void Log::Logger::disableAsync()
+{
+    update([](Config &config)
+    {
+        config.async.reset();
+        for(auto & i : config.streams)
+        {
+            i.setAsync(nullptr);
+        }
+    });
+}
+
+void Log::Logger::flush()
+{
+    auto config = _config.read();
+    if(config->async != nullptr)
+        config->async->flush();
+    for(auto & i : config->streams)
+    {
+        i.flush();
+    }
+}
+
+void Log::Logger::setFlushPolicy(Log::LogLevel level, FlushPolicy policy)
+{
+    if(level < levels)
+    {
+        update([level, policy](Config &config)
+        {
+            config.streams[level].setFlushPolicy(policy);
+        });
+        updateFlushTimer();
+    }
+}
+
+void Log::Logger::setFlushPolicy(FlushPolicy policy)
+{
+    update([policy](Config &config)
+    {
+        for(auto & i : config.streams)
+        {
+            i.setFlushPolicy(policy);
+        }
+    });
+    updateFlushTimer();
+}
+
+void Log::Logger::updateFlushTimer()
+{
+    std::chrono::steady_clock::duration interval = std::chrono::steady_clock::duration::max();
+    {
+        auto config = _config.read();
+        for(auto & i : config->streams)
+        {
+            FlushPolicy policy = i.getFlushPolicy();
+            if(policy.mode == FlushMode::Interval && policy.interval.count() > 0)
+                interval = std::min(interval, policy.interval);
+        }
+    }
+    if(interval == std::chrono::steady_clock::duration::max())
+    {
+        _flushTimer.reset();
+        return;
+    }
+    // Output written right after a check waits for the next one, half an interval later
+    auto period = std::max<std::chrono::steady_clock::duration>(interval / 2, std::chrono::milliseconds(1));
+    if(_flushTimer != nullptr && _flushTimer->period() == period)
+        return;
+    _flushTimer.reset();
+    _flushTimer = std::make_unique<FlushTimer>(period, [this]()
+    {
+        auto config = _config.read();
+        for(auto & i : config->streams)
+        {
+            i.flushDue();
+        }
+    });
+}
+
+size_t Log::Logger::dropped() const
+{
+    auto config = _config.read();
+    return config->async != nullptr ? config->async->dropped() : 0;
+}
+
+size_t Log::Logger::queueHighWater() const
+{
+    auto config = _config.read();
+    return config->async != nullptr ? config->async->highWater() : 0;
+}
+
+void Log::Logger::setFormat(Log::LogLevel level, OutputFormat format)
+{
+    if(level < levels)
+    {
+        update([level, format](Config &config)
+        {
+            config.streams[level].setFormat(format);
+        });
+    }
+}
+
+void Log::Logger::setControlChars(Log::LogLevel level, ControlChars policy)
+{
+    if(level < levels)
+    {
+        update([level, policy](Config &config)
+        {
+            config.streams[level].setControlChars(policy);
+        });
+    }
+}
+
+void Log::Logger::setClockSource(ClockSource source)
+{
+    update([source](Config &config)
+    {
+        for(auto & i : config.streams)
+        {
+            i.setClock(source);
+        }
+    });
+}
+
+void Log::Logger::setRateLimit(Log::LogLevel level, RateLimit limit)
+{
+    if(level < levels)
+    {
+        uint64_t packed = limit.perSecond == 0 ? 0 : uint64_t(limit.perSecond) << 32u | limit.burst;
+        _rateLimits[level].store(packed, std::memory_order_relaxed);
+    }
+}
+
+void Log::Logger::setRepeatSuppression(Log::LogLevel level, bool enable)
+{
+    if(level < levels)
+    {
+        update([level, enable](Config &config)
+        {
+            config.streams[level].setRepeatSuppression(enable);
+        });
+    }
+}
+
+bool Log::Logger::allowLimited(Log::LogLevel level, std::string_view tag, CallSite &site, uint64_t limit) const
+{
+    RateLimit unpacked;
+    unpacked.perSecond = uint32_t(limit >> 32u);
+    unpacked.burst = uint32_t(limit);
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    if(!site.acquire(unpacked, now))
+        return false;
+    uint64_t suppressed = site.takeSuppressed();
+    if(suppressed != 0)
+        printFormat(level, 0, tag, LOGGER_FORMAT_STRING("suppressed {} messages"), "", suppressed);
+    return true;
+}
+
+void Log::Logger::enableFlightRecorder(size_t capacity)
+{
+    auto recorder = std::make_shared<FlightRecorder>(capacity);
+    update([&recorder](Config &config)
+    {
+        config.recorder = recorder;
+        for(size_t i = 0; i < config.streams.size(); ++i)
+        {
+            config.streams[i].setRecorder(recorder, i == Error || i == Assert);
+        }
+    });
+}
+
+void Log::Logger::disableFlightRecorder()
+{
+    update([](Config &config)
+    {
+        config.recorder.reset();
+        for(auto & i : config.streams)
+        {
+            i.setRecorder(nullptr, false);
+        }
+    });
+}
+
+void Log::Logger::dumpFlightRecorder()
+{
+    auto config = _config.read();
+    if(!config->streams[Error].dumpRecorder(true))
+        config->streams[Assert].dumpRecorder(true);
+}
+
+void Log::Logger::dumpOnSignal(int signal)
+{
+    _signalWatcher.reset();
+    _signalWatcher = std::make_unique<SignalWatcher>(signal, [this]()
+    {
+        dumpFlightRecorder();
+    });
+}
+
+void Log::Logger::beforeFork()
+{
+    _config.beforeFork();
+    auto config = _config.read();
+    if(config->async != nullptr)
+        config->async->flush();
+    _forkLocks.clear();
+    for(auto & i : config->streams)
+    {
+        std::mutex *mutex = i.outputMutex();
+        if(mutex != nullptr)
+            _forkLocks.push_back(mutex);
+    }
+    // Streams share mutexes, lock each once and in a fixed order
+    std::sort(_forkLocks.begin(), _forkLocks.end());
+    _forkLocks.erase(std::unique(_forkLocks.begin(), _forkLocks.end()), _forkLocks.end());
+    for(auto * i : _forkLocks)
+    {
+        i->lock();
+    }
+    // Buffered output would otherwise be written by both processes
+    for(auto & i : config->streams)
+    {
+        i.flushLocked();
+    }
+}
+
+void Log::Logger::afterForkParent()
+{
+    for(auto i = _forkLocks.rbegin(); i != _forkLocks.rend(); ++i)
+    {
+        (*i)->unlock();
+    }
+    _config.afterForkParent();
+}
+
+void Log::Logger::afterForkChild()
+{
+    for(auto i = _forkLocks.rbegin(); i != _forkLocks.rend(); ++i)
+    {
+        (*i)->unlock();
+    }
+    _config.afterForkChild();
+    {
+        auto config = _config.read();
+        if(config->async != nullptr)
+            config->async->afterForkChild();
+        if(config->recorder != nullptr)
+            config->recorder->afterForkChild();
+    }
+    if(_signalWatcher != nullptr)
+        _signalWatcher->afterForkChild();
+    if(_flushTimer != nullptr)
+        _flushTimer->afterForkChild();
+    updatePID();
+}
+
+Log::MetricsSnapshot Log::Logger::metrics() const
+{
+    MetricsSnapshot snapshot;
+    for(size_t i = 0; i < levels; ++i)
+        snapshot.levels[i] = _metrics[i].read();
+    auto config = _config.read();
+    if(config->async != nullptr)
+    {
+        snapshot.dropped = config->async->dropped();
+        snapshot.queueHighWater = config->async->highWater();
+        snapshot.queueCapacity = config->async->capacity();
+    }
+    return snapshot;
+}
+
+void Log::Logger::writeMetrics(std::ostream &out) const
+{
+    static const char *const names[] = {"info", "verbose", "warning", "error", "assert", "debug"};
+    struct Family
+    {
+        const char *name;
+        const char *help;
+        Counter counter;
+    };
+    static const Family families[] = {
+            {"logger_messages_total", "Messages printed", Counter::Messages},
+            {"logger_suppressed_total", "Messages of disabled levels", Counter::Suppressed},
+            {"logger_filtered_total", "Messages of call sites disabled by rules", Counter::Filtered},
+            {"logger_captured_total", "Messages captured by the flight recorder", Counter::Captured},
+            {"logger_lines_total", "Lines printed", Counter::Lines},
+            {"logger_bytes_total", "Bytes written into the output", Counter::Bytes},
+            {"logger_flushes_total", "Output flushes", Counter::Flushes},
+            {"logger_lock_wait_seconds_total", "Time spent waiting for the output lock", Counter::LockWait},
+    };
+    MetricsSnapshot snapshot = metrics();
+    std::string text;
+    char buf[32];
+    auto number = [&text, &buf](auto value)
+    {
+        text.append(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr);
+        text.push_back('\n');
+    };
+    for(const auto &family : families)
+    {
+        text.append("# HELP ").append(family.name).append(" ").append(family.help).append("\n");
+        text.append("# TYPE ").append(family.name).append(" counter\n");
+        for(size_t i = 0; i < levels; ++i)
+        {
+            text.append(family.name).append("{level=\"").append(names[i]).append("\"} ");
+            uint64_t value = snapshot.levels[i][family.counter];
+            if(family.counter == Counter::LockWait)
+                number(double(value) / 1e9);
+            else
+                number(value);
+        }
+    }
+    if(snapshot.queueCapacity != 0)
+    {
+        text.append("# HELP logger_async_dropped_total Messages discarded by the asynchronous queue\n"
+                    "# TYPE logger_async_dropped_total counter\n"
+                    "logger_async_dropped_total ");
+        number(snapshot.dropped);
+        text.append("# HELP logger_async_queue_high_water Largest amount of messages waiting in a queue\n"
+                    "# TYPE logger_async_queue_high_water gauge\n"
+                    "logger_async_queue_high_water ");
+        number(snapshot.queueHighWater);
+        text.append("# HELP logger_async_queue_capacity Capacity of a queue\n"
+                    "# TYPE logger_async_queue_capacity gauge\n"
+                    "logger_async_queue_capacity ");
+        number(snapshot.queueCapacity);
+    }
+    out.write(text.data(), std::streamsize(text.size()));
+}
+
+bool Log::Logger::dumpMetrics(const std::string &path) const
+{
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        if(!file)
+            return false;
+        writeMetrics(file);
+        file.flush();
+        if(!file)
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if(std::rename(temporary.c_str(), path.c_str()) != 0)
     {
-        i.updatePID();
+        std::remove(temporary.c_str());
+        return false;
     }
+    return true;
 }
@@ -5,8 +5,18 @@
 #ifndef LOGGER_LOGGER_H
 #define LOGGER_LOGGER_H
 
+#include <atomic>
+#include <cstdint>
 #include <vector>
+#include "AtFork.h"
+#include "BatchSink.h"
+#include "FlushTimer.h"
 #include "LogStream.h"
+#include "MappedFile.h"
+#include "CallSite.h"
+#include "RotatingFile.h"
+#include "Rcu.h"
+#include "Scope.h"
 
 
 //! Mark compile-time enabled log levels
@@ -47,61 +57,132 @@
 #define LOGGER_LOG_DEBUG_ALLOWED 0
 #endif
 
+//! State of the call site the macro is expanded at
+#define LOGGER_CALL_SITE() \
+    ([]() -> Log::CallSite & { static Log::CallSite site(__FILE__, __LINE__); return site; }())
+
+//! Print message into a level of the default logger
+//! Message is not evaluated if the level or the call site is disabled on runtime,
+//! or the call site exceeds the level's rate limit. Tag is evaluated exactly once.
+#define LOGGER_LOG(level, tag, msg) \
+    ([&](std::string_view loggerTag, const char *loggerFunction) { \
+        if(Log::defaultLog.admit(level, loggerTag, LOGGER_CALL_SITE(), loggerFunction)) \
+            Log::defaultLog.print(level, Log::Scope::indent(), loggerTag, msg); \
+    }(tag, __FUNCTION__))
+
+//! Format arguments into a single line and print it into a level of the default logger
+//! Takes a format string literal followed by arguments, the format string is checked at compile time
+//! The format string is passed twice, the second copy is ignored and only makes the macro valid without arguments
+#define LOGGER_LOG_FMT(level, tag, ...) \
+    ([&](std::string_view loggerTag, const char *loggerFunction) { \
+        if(Log::defaultLog.admit(level, loggerTag, LOGGER_CALL_SITE(), loggerFunction)) \
+            Log::defaultLog.printFormat(level, Log::Scope::indent(), loggerTag, \
+                                        LOGGER_FORMAT_STRING(LOGGER_FMT_FIRST(__VA_ARGS__, 0)), __VA_ARGS__); \
+    }(tag, __FUNCTION__))
+#define LOGGER_FMT_FIRST(first, ...) first
+
+//! Print a message with key-value fields into a level of the default logger
+//! Takes a message followed by keys, each followed by its value
+#define LOGGER_LOG_KV(level, tag, ...) \
+    ([&](std::string_view loggerTag, const char *loggerFunction) { \
+        if(Log::defaultLog.admit(level, loggerTag, LOGGER_CALL_SITE(), loggerFunction)) \
+            Log::defaultLog.printKV(level, Log::Scope::indent(), loggerTag, __VA_ARGS__); \
+    }(tag, __FUNCTION__))
+
+//! Trace the rest of the enclosing block in a level of the default logger
+//! Prints entering and leaving it with the duration, messages printed inside are indented
+//! Only the level and the call site are checked, a scope is not a message for rate limits and metrics
+#define LOGGER_SCOPE(level, tag, name) \
+    Log::Scope LOGGER_CONCAT(loggerScope, __COUNTER__)(Log::defaultLog, level, tag, name, \
+                                                      LOGGER_CALL_SITE(), __FUNCTION__)
+#define LOGGER_CONCAT(a, b) LOGGER_CONCAT_EXPANDED(a, b)
+#define LOGGER_CONCAT_EXPANDED(a, b) a##b
+
+//! Set duration below which traced scopes are not printed
+#define LOGGER_SET_SCOPE_THRESHOLD(threshold) \
+    Log::setScopeThreshold(std::chrono::duration_cast<std::chrono::nanoseconds>(threshold))
+
 //! Print message into info stream
 #if LOGGER_LOG_INFO_ENABLED
-#define LOG_INFO(msg) Log::defaultLog.print(Log::Info, 0, __FUNCTION__, msg)
-#define LOG_INFO_TAG(msg, tag) Log::defaultLog.print(Log::Info, 0, tag, msg)
+#define LOG_INFO(msg) LOGGER_LOG(Log::Info, __FUNCTION__, msg)
+#define LOG_INFO_TAG(msg, tag) LOGGER_LOG(Log::Info, tag, msg)
+#define LOG_INFO_FMT(...) LOGGER_LOG_FMT(Log::Info, __FUNCTION__, __VA_ARGS__)
+#define LOG_INFO_KV(...) LOGGER_LOG_KV(Log::Info, __FUNCTION__, __VA_ARGS__)
+#define LOG_SCOPE(name) LOGGER_SCOPE(Log::Info, __FUNCTION__, name)
 #else
 #define LOG_INFO(msg) ((void)0)
 #define LOG_INFO_TAG(msg, tag) ((void)0)
+#define LOG_INFO_FMT(...) ((void)0)
+#define LOG_INFO_KV(...) ((void)0)
+#define LOG_SCOPE(name) ((void)0)
 #endif
 
 
 //!Print message into verbose stream
 #if LOGGER_LOG_VERBOSE_ENABLED
-#define LOG_VERBOSE(msg) Log::defaultLog.print(Log::Verbose, 0, __FUNCTION__, msg)
-#define LOG_VERBOSE_TAG(msg, tag) Log::defaultLog.print(Log::Verbose, 0, tag, msg)
+#define LOG_VERBOSE(msg) LOGGER_LOG(Log::Verbose, __FUNCTION__, msg)
+#define LOG_VERBOSE_TAG(msg, tag) LOGGER_LOG(Log::Verbose, tag, msg)
+#define LOG_VERBOSE_FMT(...) LOGGER_LOG_FMT(Log::Verbose, __FUNCTION__, __VA_ARGS__)
+#define LOG_VERBOSE_KV(...) LOGGER_LOG_KV(Log::Verbose, __FUNCTION__, __VA_ARGS__)
 #else
 #define LOG_VERBOSE(msg) ((void)0)
 #define LOG_VERBOSE_TAG(msg, tag) ((void)0)
+#define LOG_VERBOSE_FMT(...) ((void)0)
+#define LOG_VERBOSE_KV(...) ((void)0)
 #endif
 
 
 //!Print message into warning stream
 #if LOGGER_LOG_WARNING_ENABLED
-#define LOG_WARNING(msg) Log::defaultLog.print(Log::Warning, 0, __FUNCTION__, msg)
-#define LOG_WARNING_TAG(msg, tag) Log::defaultLog.print(Log::Warning, 0, tag, msg)
+#define LOG_WARNING(msg) LOGGER_LOG(Log::Warning, __FUNCTION__, msg)
+#define LOG_WARNING_TAG(msg, tag) LOGGER_LOG(Log::Warning, tag, msg)
+#define LOG_WARNING_FMT(...) LOGGER_LOG_FMT(Log::Warning, __FUNCTION__, __VA_ARGS__)
+#define LOG_WARNING_KV(...) LOGGER_LOG_KV(Log::Warning, __FUNCTION__, __VA_ARGS__)
 #else
 #define LOG_WARNING(msg) ((void)0)
 #define LOG_WARNING_TAG(msg, tag) ((void)0)
+#define LOG_WARNING_FMT(...) ((void)0)
+#define LOG_WARNING_KV(...) ((void)0)
 #endif
 
 
 //!Print message into error stream
 #if LOGGER_LOG_ERROR_ENABLED
-#define LOG_ERROR(msg) Log::defaultLog.print(Log::Error, 0, __PRETTY_FUNCTION__, msg)
-#define LOG_ERROR_TAG(msg, tag) Log::defaultLog.print(Log::Error, 0, tag, msg)
+#define LOG_ERROR(msg) LOGGER_LOG(Log::Error, __PRETTY_FUNCTION__, msg)
+#define LOG_ERROR_TAG(msg, tag) LOGGER_LOG(Log::Error, tag, msg)
+#define LOG_ERROR_FMT(...) LOGGER_LOG_FMT(Log::Error, __PRETTY_FUNCTION__, __VA_ARGS__)
+#define LOG_ERROR_KV(...) LOGGER_LOG_KV(Log::Error, __PRETTY_FUNCTION__, __VA_ARGS__)
 #else
 #define LOG_ERROR(msg) ((void)0)
 #define LOG_ERROR_TAG(msg, tag) ((void)0)
+#define LOG_ERROR_FMT(...) ((void)0)
+#define LOG_ERROR_KV(...) ((void)0)
 #endif
 
 //!Print message into assert stream
 #if LOGGER_LOG_WTF_ENABLED
-#define LOG_WTF(msg) Log::defaultLog.print(Log::Assert, 0, __PRETTY_FUNCTION__, msg)
-#define LOG_WTF_TAG(msg, tag) Log::defaultLog.print(Log::Assert, 0, tag, msg)
+#define LOG_WTF(msg) LOGGER_LOG(Log::Assert, __PRETTY_FUNCTION__, msg)
+#define LOG_WTF_TAG(msg, tag) LOGGER_LOG(Log::Assert, tag, msg)
+#define LOG_WTF_FMT(...) LOGGER_LOG_FMT(Log::Assert, __PRETTY_FUNCTION__, __VA_ARGS__)
+#define LOG_WTF_KV(...) LOGGER_LOG_KV(Log::Assert, __PRETTY_FUNCTION__, __VA_ARGS__)
 #else
 #define LOG_WTF(msg) ((void)0)
 #define LOG_WTF_TAG(msg, tag) ((void)0)
+#define LOG_WTF_FMT(...) ((void)0)
+#define LOG_WTF_KV(...) ((void)0)
 #endif
 
 //!Print message into debug stream
 #if LOGGER_LOG_DEBUG_ENABLED && (!LOGGER_LOG_DEBUG_RESTRICTED || LOGGER_LOG_DEBUG_ALLOWED)
-#define LOG_DEBUG(msg) Log::defaultLog.print(Log::Debug, 0, __PRETTY_FUNCTION__, msg)
-#define LOG_DEBUG_TAG(msg, tag) Log::defaultLog.print(Log::Debug, 0, tag, msg)
+#define LOG_DEBUG(msg) LOGGER_LOG(Log::Debug, __PRETTY_FUNCTION__, msg)
+#define LOG_DEBUG_TAG(msg, tag) LOGGER_LOG(Log::Debug, tag, msg)
+#define LOG_DEBUG_FMT(...) LOGGER_LOG_FMT(Log::Debug, __PRETTY_FUNCTION__, __VA_ARGS__)
+#define LOG_DEBUG_KV(...) LOGGER_LOG_KV(Log::Debug, __PRETTY_FUNCTION__, __VA_ARGS__)
 #else
 #define LOG_DEBUG(msg) ((void)0)
 #define LOG_DEBUG_TAG(msg, tag) ((void)0)
+#define LOG_DEBUG_FMT(...) ((void)0)
+#define LOG_DEBUG_KV(...) ((void)0)
 #endif
 
 //! Disable a specific logger level on runtime
@@ -111,8 +192,51 @@
 #define LOGGER_SET_STREAM(level, stream) Log::defaultLog.setStream(level, stream)
 
 //! Update cached pid after forking
+//! Not needed anymore, loggers update it in a forked child automatically
 #define LOGGER_UPDATE_PID() Log::defaultLog.updatePID()
 
+//! Print messages on a background thread
+#define LOGGER_ENABLE_ASYNC(capacity, policy) Log::defaultLog.enableAsync(capacity, policy)
+
+//! Print messages on a background thread fed by per-thread queues
+#define LOGGER_ENABLE_SHARDED(shards) Log::defaultLog.enableSharded(shards)
+
+//! Wait until all queued messages are printed
+#define LOGGER_FLUSH() Log::defaultLog.flush()
+
+//! Set output flush policy for a specific logger level
+#define LOGGER_SET_FLUSH_POLICY(level, policy) Log::defaultLog.setFlushPolicy(level, policy)
+
+//! Set output format for a specific logger level
+#define LOGGER_SET_FORMAT(level, format) Log::defaultLog.setFormat(level, format)
+
+//! Set handling of control characters in messages of a specific logger level
+#define LOGGER_SET_CONTROL_CHARS(level, policy) Log::defaultLog.setControlChars(level, policy)
+
+//! Select clock used to timestamp messages
+#define LOGGER_SET_CLOCK_SOURCE(source) Log::defaultLog.setClockSource(source)
+
+//! Limit messages printed by every call site of a specific logger level
+#define LOGGER_SET_RATE_LIMIT(level, perSecond, burst) Log::defaultLog.setRateLimit(level, {perSecond, burst})
+
+//! Capture messages of disabled levels into per-thread rings, printed before errors
+#define LOGGER_ENABLE_FLIGHT_RECORDER(capacity) Log::defaultLog.enableFlightRecorder(capacity)
+
+//! Print messages captured by the flight recorder when a signal is delivered
+#define LOGGER_DUMP_ON_SIGNAL(signal) Log::defaultLog.dumpOnSignal(signal)
+
+//! Collapse identical consecutive messages of a specific logger level
+#define LOGGER_SET_REPEAT_SUPPRESSION(level, enable) Log::defaultLog.setRepeatSuppression(level, enable)
+
+//! Enable call sites matching a pattern, see Log::setSitesEnabled
+#define LOGGER_ENABLE_SITES(match, pattern) Log::setSitesEnabled(match, pattern, true)
+
+//! Disable call sites matching a pattern, see Log::setSitesEnabled
+#define LOGGER_DISABLE_SITES(match, pattern) Log::setSitesEnabled(match, pattern, false)
+
+//! Write counters of the default logger into a file in Prometheus text format
+#define LOGGER_DUMP_METRICS(path) Log::defaultLog.dumpMetrics(path)
+
 namespace Log
 {
 
@@ -135,13 +259,59 @@ namespace Log
     };
 
 
+    /*!
+     * Counters of a logger at some point in time
+     */
+    struct MetricsSnapshot
+    {
+        StreamCounters levels[Debug + 1];   //!< Counters of every log level
+        uint64_t dropped = 0;               //!< Messages discarded by the asynchronous queue overflow policy
+        size_t queueHighWater = 0;          //!< Largest amount of messages waiting in an asynchronous queue
+        size_t queueCapacity = 0;           //!< Capacity of an asynchronous queue, 0 in synchronous mode
+    };
+
+
     /*!
      * Logger class
+     * Configuration is an immutable snapshot replaced atomically by setters,
+     * printing threads never take a lock to read it.
+     * @note Setters must not be called from a custom printer, they wait for all running print calls
+     *
+     * Logger is safe to use in a child forked while other threads are logging: before fork queued messages
+     * are printed, output streams are flushed and their locks are taken; in the child the pid is updated
+     * and the background thread is restarted.
+     * @note fork() must not be called from a custom printer
      */
-    class Logger
+    class Logger : private ForkListener
     {
     private:
-        std::vector<LogStream> _streams;
+        /*!
+         * Logger configuration snapshot
+         */
+        struct Config
+        {
+            std::vector<LogStream> streams;
+            std::shared_ptr<AsyncWriter> async;
+            std::shared_ptr<FlightRecorder> recorder;
+        };
+
+        Rcu<Config> _config;
+        std::atomic<uint32_t> _enabled;
+        std::atomic<uint32_t> _printed;
+        std::atomic<uint64_t> _rateLimits[Debug + 1];
+        mutable StreamMetrics _metrics[Debug + 1];
+        std::vector<std::mutex *> _forkLocks;
+        std::unique_ptr<SignalWatcher> _signalWatcher;
+        std::unique_ptr<FlushTimer> _flushTimer;
+
+        template <typename Modify>
+        void update(Modify &&modify);
+        void setAsync(std::shared_ptr<AsyncWriter> async);
+        void updateFlushTimer();
+        bool allowLimited(LogLevel level, std::string_view tag, CallSite &site, uint64_t limit) const;
+        void beforeFork() override;
+        void afterForkParent() override;
+        void afterForkChild() override;
     public:
 
 
@@ -153,8 +323,9 @@ namespace Log
 
         /*!
          * Destructor
+         * Prints all queued messages before returning
          */
-        ~Logger() = default;
+        ~Logger();
 
 
         /*!
@@ -165,6 +336,24 @@ namespace Log
         void setStream(LogLevel level, std::ostream &outStream);
 
 
+        /*!
+         * Set memory-mapped output file for a log level
+         * Records are written by a MappedFileSink without locking, the file must outlive its use by the logger
+         * @param level Log level
+         * @param file Output file
+         */
+        void setStream(LogLevel level, MappedFile &file);
+
+
+        /*!
+         * Set output sink for a log level
+         * Levels sharing a sink share its lock, thread safe sinks are written without locking
+         * @param level Log level
+         * @param sink Output sink
+         */
+        void setStream(LogLevel level, std::shared_ptr<Sink> sink);
+
+
         /*!
          * Disable a log level
          * @param level Log level to disable
@@ -172,6 +361,75 @@ namespace Log
         void disableLevel(LogLevel level);
 
 
+        /*!
+         * Check if a log level is enabled
+         * A level disabled while a flight recorder captures it is not enabled, see isAccepted()
+         * @param level Log level
+         * @return true if messages of the level are printed, false otherwise
+         */
+        inline bool isEnabled(LogLevel level) const
+        { return (_printed.load(std::memory_order_relaxed) >> level) & 1u; }
+
+
+        /*!
+         * Check if messages of a log level are evaluated
+         * @param level Log level
+         * @return true if messages of the level are printed or captured by a flight recorder, false otherwise
+         */
+        inline bool isAccepted(LogLevel level) const
+        { return (_enabled.load(std::memory_order_relaxed) >> level) & 1u; }
+
+
+        /*!
+         * Check if a message of a log level is evaluated
+         * Counts the message as suppressed if the level is neither printed nor captured
+         * @param level Log level
+         * @return true if messages of the level are printed or captured by a flight recorder, false otherwise
+         */
+        inline bool admit(LogLevel level) const
+        {
+            if (isAccepted(level))
+                return true;
+            _metrics[level].add(Counter::Suppressed);
+            return false;
+        }
+
+
+        /*!
+         * Check if a message printed by a call site is printed
+         * Counts the message as suppressed if the level is disabled, as filtered if the site is
+         * @param level Log level
+         * @param tag Message tag
+         * @param site Call site
+         * @param function Name of the function the site is in
+         * @return true if the message is printed or captured by a flight recorder, false otherwise
+         */
+        inline bool admit(LogLevel level, std::string_view tag, CallSite &site, const char *function) const
+        {
+            if (!admit(level))
+                return false;
+            if (site.enabled(level, tag, function))
+                return allow(level, tag, site);
+            _metrics[level].add(Counter::Filtered);
+            return false;
+        }
+
+
+        /*!
+         * Check the rate limit of a log level for a call site
+         * Prints how many messages of the site were suppressed before the first allowed one
+         * @param level Log level
+         * @param tag Message tag
+         * @param site Call site
+         * @return true if the message should be printed, false otherwise
+         */
+        inline bool allow(LogLevel level, std::string_view tag, CallSite &site) const
+        {
+            uint64_t limit = _rateLimits[level].load(std::memory_order_relaxed);
+            return limit == 0 || allowLimited(level, tag, site, limit);
+        }
+
+
         /*!
          * Output messages to log
          * @param level Log level
@@ -180,7 +438,44 @@ namespace Log
          * @param args Other messages
          */
         template <typename MsgT, typename ... Args>
-        void print(LogLevel level, size_t indent, const std::string &tag, const MsgT& msg, const Args& ... args)const;
+        void print(LogLevel level, size_t indent, std::string_view tag, const MsgT& msg, const Args& ... args)const;
+
+
+        /*!
+         * Output a message with key-value fields to log
+         * @param level Log level
+         * @param tag Message tag
+         * @param msg Message
+         * @param fields Keys, each followed by its value
+         */
+        template <typename MsgT, typename ... Fields>
+        void printKV(LogLevel level, size_t indent, std::string_view tag, const MsgT &msg,
+                     const Fields & ... fields) const;
+
+
+        /*!
+         * Output a message with key-value fields to log with a given time stamp
+         * @param level Log level
+         * @param time Time stamp of the record
+         * @param tag Message tag
+         * @param msg Message
+         * @param fields Keys, each followed by its value
+         */
+        template <typename MsgT, typename ... Fields>
+        void printKVAt(LogLevel level, std::chrono::system_clock::time_point time, size_t indent,
+                       std::string_view tag, const MsgT &msg, const Fields & ... fields) const;
+
+
+        /*!
+         * Format arguments into a single line and output it to log
+         * @param level Log level
+         * @param tag Message tag
+         * @param fmt Compile-time format string created by LOGGER_FORMAT_STRING
+         * @param args Arguments
+         */
+        template <typename Fmt, typename ... Args>
+        void printFormat(LogLevel level, size_t indent, std::string_view tag, Fmt fmt, std::string_view,
+                         const Args& ... args) const;
 
 
         /*!
@@ -189,26 +484,236 @@ namespace Log
          * @param level Log level
          * @param tag Message tag
          */
-        void print(LogLevel level, size_t indent, const std::string &tag) const;
+        void print(LogLevel level, size_t indent, std::string_view tag) const;
 
 
         /*!
          * Updates logger's buffered PID value
+         * Called automatically in a forked child
          */
         void updatePID();
+
+
+        /*!
+         * Switch to asynchronous mode
+         * Messages are copied into a bounded lock-free queue and printed by a background thread
+         * @param capacity Maximum amount of queued messages
+         * @param policy Behaviour when the queue is full
+         */
+        void enableAsync(size_t capacity = 8192, OverflowPolicy policy = OverflowPolicy::Block);
+
+
+        /*!
+         * Switch to sharded asynchronous mode
+         * Every thread queues messages into one of several queues, so threads on different cores
+         * do not contend on a shared lock. Background thread merges queued messages in timestamp order,
+         * messages of a single thread are printed in the order they were logged.
+         * Order across threads is exact for messages queued within the reorder window after their timestamp
+         * was taken, the oldest message is delayed by up to the window while some queue is empty.
+         * @param shards Amount of queues, 0 to use one per hardware thread
+         * @param capacity Maximum amount of queued messages per queue
+         * @param policy Behaviour when a queue is full
+         * @param window Reorder window, 0 to print every message as soon as possible in best-effort order
+         */
+        void enableSharded(size_t shards = 0, size_t capacity = 1024, OverflowPolicy policy = OverflowPolicy::Block,
+                           std::chrono::microseconds window = std::chrono::microseconds(1000));
+
+
+        /*!
+         * Print all queued messages, stop the background thread and print on the caller's thread again
+         */
+        void disableAsync();
+
+
+        /*!
+         * Wait until all queued messages are printed and flush output streams
+         */
+        void flush();
+
+
+        /*!
+         * Set output flush policy for a log level
+         * Assert level is always flushed after every message regardless of its policy
+         * @param level Log level
+         * @param policy Flush policy
+         */
+        void setFlushPolicy(LogLevel level, FlushPolicy policy);
+
+
+        /*!
+         * Set output flush policy for all log levels
+         * @param policy Flush policy
+         */
+        void setFlushPolicy(FlushPolicy policy);
+
+
+        /*!
+         * Get amount of messages discarded by the asynchronous queue overflow policy
+         * @return Amount of discarded messages
+         */
+        size_t dropped() const;
+
+
+        /*!
+         * Get the largest amount of messages ever waiting in an asynchronous queue
+         * @return Queue high-water mark, 0 in synchronous mode
+         */
+        size_t queueHighWater() const;
+
+
+        /*!
+         * Set output format for a log level
+         * @param level Log level
+         * @param format Output format
+         */
+        void setFormat(LogLevel level, OutputFormat format);
+
+
+        /*!
+         * Set handling of control characters in messages of a log level
+         * @param level Log level
+         * @param policy Control character policy
+         */
+        void setControlChars(LogLevel level, ControlChars policy);
+
+
+        /*!
+         * Select clock used to timestamp messages of all levels
+         * @param source Clock source
+         */
+        void setClockSource(ClockSource source);
+
+
+        /*!
+         * Limit messages printed by every call site of a log level
+         * Applies to messages printed with the LOG_* macros and allow()
+         * @param level Log level
+         * @param limit Rate limit, perSecond 0 to disable
+         */
+        void setRateLimit(LogLevel level, RateLimit limit);
+
+
+        /*!
+         * Collapse identical consecutive messages of a log level
+         * Repeats are counted instead of being printed, the count is printed as
+         * "last message repeated N times" before the next different message or on flush().
+         * Streams written without a lock, like MappedFile, print every message.
+         * @param level Log level
+         * @param enable true to suppress repeats, false to print every message
+         */
+        void setRepeatSuppression(LogLevel level, bool enable);
+
+
+        /*!
+         * Switch to flight recorder mode
+         * Messages of disabled levels are captured into a fixed-size ring of the calling thread without
+         * being formatted. Before every Error or Assert message, messages captured by the same thread
+         * are printed into its stream, so the error comes with its context.
+         * @note Messages of disabled levels are evaluated in this mode
+         * @param capacity Size of the ring of every thread in bytes
+         */
+        void enableFlightRecorder(size_t capacity = 64 * 1024);
+
+
+        /*!
+         * Discard captured messages and stop capturing messages of disabled levels
+         */
+        void disableFlightRecorder();
+
+
+        /*!
+         * Print messages captured by all threads into the Error stream, or the Assert stream if Error is disabled
+         */
+        void dumpFlightRecorder();
+
+
+        /*!
+         * Call dumpFlightRecorder() when a signal is delivered
+         * The dump runs on a dedicated thread, not in the signal handler
+         * @note Not thread safe, meant to be called once at startup
+         * @param signal Signal number, e.g. SIGUSR1
+         */
+        void dumpOnSignal(int signal);
+
+
+        /*!
+         * Read counters of every log level and the asynchronous queue
+         * Counters are updated without locking, so the snapshot is taken while they keep changing
+         * @return Counters
+         */
+        MetricsSnapshot metrics() const;
+
+
+        /*!
+         * Write counters in Prometheus text exposition format
+         * @param out Output stream
+         */
+        void writeMetrics(std::ostream &out) const;
+
+
+        /*!
+         * Write counters into a file in Prometheus text exposition format
+         * The file is replaced atomically, so it can be read by the node exporter textfile collector at any time
+         * @param path File path
+         * @return true on success, false otherwise
+         */
+        bool dumpMetrics(const std::string &path) const;
     };
 
     extern Logger defaultLog;
 }
 
 template<typename MsgT, typename... Args>
-void Log::Logger::print(Log::LogLevel level, size_t indent, const std::string &tag, const MsgT &msg, const Args &... args) const
+void Log::Logger::print(Log::LogLevel level, size_t indent, std::string_view tag, const MsgT &msg, const Args &... args) const
 {
-    if (level < _streams.size() && _streams[level].enabled())
+    auto config = _config.read();
+    if (level < config->streams.size() && config->streams[level].enabled())
     {
-        LogStream::printer<MsgT>()(_streams[level], indent, tag, msg);
-        print(level, indent, tag, args...);
+        const LogStream &stream = config->streams[level];
+        LogStream::Batch batch(stream, tag);
+        LogStream::printer<MsgT>()(stream, indent, tag, msg);
+        (LogStream::printer<Args>()(stream, indent, tag, args), ...);
     }
+    else if (level < config->streams.size())
+        config->streams[level].count(Counter::Suppressed);
+}
+
+template<typename MsgT, typename... Fields>
+void Log::Logger::printKV(Log::LogLevel level, size_t indent, std::string_view tag, const MsgT &msg,
+                          const Fields &... fields) const
+{
+    auto config = _config.read();
+    if (level < config->streams.size() && config->streams[level].enabled())
+        config->streams[level].printKV(indent, tag, msg, fields...);
+    else if (level < config->streams.size())
+        config->streams[level].count(Counter::Suppressed);
+}
+
+template<typename MsgT, typename... Fields>
+void Log::Logger::printKVAt(Log::LogLevel level, std::chrono::system_clock::time_point time, size_t indent,
+                            std::string_view tag, const MsgT &msg, const Fields &... fields) const
+{
+    auto config = _config.read();
+    if (level < config->streams.size() && config->streams[level].enabled())
+    {
+        const LogStream &stream = config->streams[level];
+        LogStream::Batch batch(stream, tag, time);
+        stream.printKV(indent, tag, msg, fields...);
+    }
+    else if (level < config->streams.size())
+        config->streams[level].count(Counter::Suppressed);
+}
+
+template<typename Fmt, typename... Args>
+void Log::Logger::printFormat(Log::LogLevel level, size_t indent, std::string_view tag, Fmt, std::string_view,
+                              const Args &... args) const
+{
+    constexpr std::string_view fmt = checkedFormat<Fmt, Args...>();
+    auto config = _config.read();
+    if (level < config->streams.size() && config->streams[level].enabled())
+        config->streams[level].printFormat(indent, tag, fmt, args...);
+    else if (level < config->streams.size())
+        config->streams[level].count(Counter::Suppressed);
 }
 
 #endif //LOGGER_LOGGER_H
@@ -0,0 +1,302 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Log::MappedFileBuf::MappedFileBuf(const std::string &path, size_t segmentSize):
+        _fd(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)), _segmentSize(0), _start(0), _tail(0),
+        _current(nullptr), _currentIndex(0), _lost(false)
+{
+    auto page = size_t(sysconf(_SC_PAGESIZE));
+    _segmentSize = std::max((segmentSize + page - 1) / page * page, page);
+    if (_fd < 0)
+        return;
+    _start = recover();
+    _tail.store(_start);
+    std::lock_guard<std::mutex> lock(_mutex);
+    Segment *segment = map(_start / _segmentSize);
+    _current.store(segment);
+    _currentIndex.store(segment->index);
+}
+
+Log::MappedFileBuf::~MappedFileBuf()
+{
+    if (_fd < 0)
+        return;
+    for (auto &segment : _segments)
+    {
+        if (segment.data != nullptr)
+            munmap(segment.data, _segmentSize);
+    }
+    // Failure is harmless, preallocated zeros are also removed when the file is opened again.
+    // A trailing zero is kept after a range that was not written, so that it is removed as well
+    int result = ftruncate(_fd, off_t(_tail.load() + (_lost.load() ? 1 : 0)));
+    (void)result;
+    close(_fd);
+}
+
+bool Log::MappedFileBuf::is_open() const
+{
+    return _fd >= 0;
+}
+
+uint64_t Log::MappedFileBuf::size() const
+{
+    return _tail.load(std::memory_order_relaxed);
+}
+
+std::streamsize Log::MappedFileBuf::xsputn(const char *s, std::streamsize count)
+{
+    if (_fd < 0 || count <= 0)
+        return 0;
+    auto size = size_t(count);
+    return std::streamsize(store(_tail.fetch_add(size, std::memory_order_relaxed), s, size));
+}
+
+bool Log::MappedFileBuf::append(const std::string_view *parts, size_t count)
+{
+    if (_fd < 0)
+        return false;
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+        total += parts[i].size();
+    // One reservation keeps the record contiguous among records of other threads
+    uint64_t pos = _tail.fetch_add(total, std::memory_order_relaxed);
+    bool stored = true;
+    for (size_t i = 0; i < count; ++i)
+    {
+        stored &= store(pos, parts[i].data(), parts[i].size()) == parts[i].size();
+        pos += parts[i].size();
+    }
+    return stored;
+}
+
+size_t Log::MappedFileBuf::store(uint64_t pos, const char *s, size_t size)
+{
+    size_t stored = 0;
+    for (size_t done = 0; done < size;)
+    {
+        uint64_t index = (pos + done) / _segmentSize;
+        size_t offset = size_t((pos + done) % _segmentSize);
+        size_t length = std::min(size - done, _segmentSize - offset);
+        Segment *segment = this->segment(index);
+        if (segment == nullptr)
+        {
+            _lost.store(true, std::memory_order_relaxed);
+            return stored;
+        }
+        // The whole reserved range is accounted even if it cannot be stored, so the segment is still released
+        if (segment->data != nullptr)
+        {
+            std::memcpy(segment->data + offset, s + done, length);
+            stored += length;
+        }
+        else if (pwrite(_fd, s + done, length, off_t(pos + done)) == ssize_t(length))
+            stored += length;
+        else
+            _lost.store(true, std::memory_order_relaxed);
+        if (segment->written.fetch_add(length, std::memory_order_acq_rel) + length == _segmentSize)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            release(*segment);
+        }
+        done += length;
+    }
+    return stored;
+}
+
+Log::MappedFileBuf::int_type Log::MappedFileBuf::overflow(int_type ch)
+{
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+        return traits_type::not_eof(ch);
+    char c = traits_type::to_char_type(ch);
+    return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+}
+
+uint64_t Log::MappedFileBuf::recover()
+{
+    struct stat st{};
+    if (fstat(_fd, &st) != 0)
+        return 0;
+    // Preallocated space left by a crashed process is zero filled, drop it
+    auto size = uint64_t(st.st_size);
+    auto end = size;
+    char buf[4096];
+    char last = '\n';
+    while (end > 0)
+    {
+        auto length = size_t(std::min<uint64_t>(end, sizeof(buf)));
+        if (pread(_fd, buf, length, off_t(end - length)) != ssize_t(length))
+            break;
+        auto data = std::find_if(std::make_reverse_iterator(buf + length), std::make_reverse_iterator(buf),
+                                 [](char c) { return c != 0; });
+        if (data != std::make_reverse_iterator(buf))
+        {
+            end -= size_t(data - std::make_reverse_iterator(buf + length));
+            last = *data;
+            break;
+        }
+        end -= length;
+    }
+    // Writers of that process may have left zero filled ranges before the end as well
+    if (end < size)
+        end = compact(end);
+    // Terminate a partially written last record
+    if (last != '\n' && pwrite(_fd, "\n", 1, off_t(end)) == 1)
+        ++end;
+    if (ftruncate(_fd, off_t(end)) != 0)
+        return size;
+    return end;
+}
+
+uint64_t Log::MappedFileBuf::compact(uint64_t end)
+{
+    // Data is moved over the zero filled ranges, a record cut short by one gets a line break
+    char buf[4096];
+    char out[sizeof(buf) + 1];
+    uint64_t read = 0;
+    uint64_t write = 0;
+    char last = '\n';
+    bool gap = false;
+    while (read < end)
+    {
+        auto length = size_t(std::min<uint64_t>(end - read, sizeof(buf)));
+        if (pread(_fd, buf, length, off_t(read)) != ssize_t(length))
+            break;
+        size_t kept = 0;
+        for (size_t i = 0; i < length; ++i)
+        {
+            if (buf[i] == 0)
+            {
+                gap = true;
+                continue;
+            }
+            // At least one zero is dropped for every line break added, so data never moves forward
+            if (gap && last != '\n')
+                out[kept++] = '\n';
+            gap = false;
+            last = buf[i];
+            out[kept++] = last;
+        }
+        if ((write != read || kept != length) && pwrite(_fd, out, kept, off_t(write)) != ssize_t(kept))
+            break;
+        read += length;
+        write += kept;
+    }
+    if (read == end)
+        return write;
+    // Keep the rest in place, data already moved is blanked out instead of being repeated
+    std::string blank(size_t(read - write), '\n');
+    ssize_t result = pwrite(_fd, blank.data(), blank.size(), off_t(write));
+    (void)result;
+    return end;
+}
+
+Log::MappedFileBuf::Segment *Log::MappedFileBuf::segment(uint64_t index)
+{
+    // The current segment is published before its index, so it is the segment of the index or a newer one
+    if (_currentIndex.load(std::memory_order_acquire) == index)
+    {
+        Segment *current = _current.load(std::memory_order_acquire);
+        if (current->index == index)
+            return current;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_segments.empty())
+        return nullptr;
+    // Map the next segment ahead, so writers crossing the boundary rarely wait for it
+    while (_segments.back().index <= index)
+        map(_segments.back().index + 1);
+    Segment *segment = &_segments[index - _segments.front().index];
+    if (_currentIndex.load(std::memory_order_relaxed) < index)
+    {
+        _current.store(segment, std::memory_order_release);
+        _currentIndex.store(index, std::memory_order_release);
+    }
+    // Released segments before the current one are not used anymore. They are dropped from the front only,
+    // so a segment still being written keeps the later ones a writer may have read as current
+    while (_segments.front().released && _segments.front().index < _currentIndex.load(std::memory_order_relaxed))
+        _segments.pop_front();
+    return segment;
+}
+
+Log::MappedFileBuf::Segment *Log::MappedFileBuf::map(uint64_t index)
+{
+    auto offset = off_t(index * _segmentSize);
+    auto end = offset + off_t(_segmentSize);
+    bool allocated = fallocate(_fd, 0, offset, off_t(_segmentSize)) == 0;
+    if (!allocated)
+    {
+        // Filesystem without fallocate support, extend the file instead
+        struct stat st{};
+        allocated = fstat(_fd, &st) == 0 && (st.st_size >= end || ftruncate(_fd, end) == 0);
+    }
+    // Writing into a mapping past the end of file raises SIGBUS, so map only allocated space
+    void *data = MAP_FAILED;
+    if (allocated)
+        data = mmap(nullptr, _segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, offset);
+    _segments.emplace_back();
+    Segment &segment = _segments.back();
+    segment.index = index;
+    segment.data = data == MAP_FAILED ? nullptr : static_cast<char *>(data);
+    // Part of the first segment is occupied by data written before the file was opened
+    uint64_t used = _start > uint64_t(offset) ? std::min<uint64_t>(_start - uint64_t(offset), _segmentSize) : 0;
+    segment.written.store(size_t(used), std::memory_order_relaxed);
+    segment.released = false;
+    if (used == _segmentSize)
+        release(segment);
+    return &segment;
+}
+
+void Log::MappedFileBuf::release(Segment &segment)
+{
+    // Called with the lock held by the writer that completed the segment, nobody else touches its data anymore
+    if (segment.data != nullptr)
+        munmap(segment.data, _segmentSize);
+    segment.data = nullptr;
+    segment.released = true;
+}
+
+Log::MappedFile::MappedFile(const std::string &path, size_t segmentSize): std::ostream(nullptr),
+        _buf(path, segmentSize)
+{
+    std::ostream::rdbuf(&_buf);
+    if (!_buf.is_open())
+        setstate(std::ios::badbit);
+}
+
+bool Log::MappedFile::is_open() const
+{
+    return _buf.is_open();
+}
+
+uint64_t Log::MappedFile::size() const
+{
+    return _buf.size();
+}
+
+Log::MappedFileBuf *Log::MappedFile::rdbuf() const
+{
+    return const_cast<MappedFileBuf *>(&_buf);
+}
+
+Log::MappedFileSink::MappedFileSink(MappedFile &file): _buf(*file.rdbuf())
+{
+}
+
+void Log::MappedFileSink::write(const std::string_view *parts, size_t count)
+{
+    _buf.append(parts, count);
+}
+
+bool Log::MappedFileSink::threadSafe() const
+{
+    return true;
+}
@@ -0,0 +1,179 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_MAPPEDFILE_H
+#define LOGGER_MAPPEDFILE_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include "Sink.h"
+
+namespace Log
+{
+    /*!
+     * Stream buffer writing into a memory-mapped file
+     * File grows by preallocated segments that are mapped on first use and unmapped once filled.
+     * Every write reserves its range with an atomic fetch-add and copies in parallel with other writers,
+     * so the buffer can be used by several threads without a lock.
+     * A range in a segment that cannot be mapped is written with pwrite(), a range that cannot be written
+     * at all stays zero filled and is removed when the file is opened again.
+     */
+    class MappedFileBuf : public std::streambuf
+    {
+    private:
+        /*!
+         * Mapped file segment
+         */
+        struct Segment
+        {
+            uint64_t index;
+            char *data;
+            std::atomic<size_t> written;
+            bool released;
+        };
+
+        int _fd;
+        size_t _segmentSize;
+        uint64_t _start;
+        std::atomic<uint64_t> _tail;
+        std::atomic<Segment *> _current;
+        std::atomic<uint64_t> _currentIndex;
+        std::atomic<bool> _lost;
+        std::mutex _mutex;
+        std::deque<Segment> _segments;
+
+        uint64_t recover();
+        uint64_t compact(uint64_t end);
+        size_t store(uint64_t pos, const char *data, size_t size);
+        Segment *segment(uint64_t index);
+        Segment *map(uint64_t index);
+        void release(Segment &segment);
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize count) override;
+        int_type overflow(int_type ch) override;
+    public:
+
+
+        /*!
+         * Constructor
+         * Opens the file for appending, recovering it after a crash if needed
+         * @param path File path
+         * @param segmentSize Size of a preallocated segment, rounded up to the page size
+         */
+        MappedFileBuf(const std::string &path, size_t segmentSize);
+
+
+        /*!
+         * Destructor
+         * Truncates preallocated space after the last record
+         * @note Must not be called while other threads are writing
+         */
+        ~MappedFileBuf() override;
+
+
+        /*!
+         * Check if file is open
+         * @return true if open, false otherwise
+         */
+        bool is_open() const;
+
+
+        /*!
+         * Get amount of bytes written into the file, including data it had before opening
+         * @return File size
+         */
+        uint64_t size() const;
+
+
+        /*!
+         * Write parts as one contiguous range reserved with a single atomic operation
+         * Safe to call from several threads at once, no stream state is touched
+         * @param parts Parts to write in order
+         * @param count Amount of parts
+         * @return true if all bytes were stored, false otherwise
+         */
+        bool append(const std::string_view *parts, size_t count);
+
+        MappedFileBuf(const MappedFileBuf &) = delete;
+        MappedFileBuf &operator=(const MappedFileBuf &) = delete;
+    };
+
+    /*!
+     * Output stream writing into a memory-mapped file
+     * Logger prints into it without locking through MappedFileSink, see Logger::setStream(LogLevel, MappedFile&)
+     *
+     * Mapped pages belong to the kernel page cache, so printed records survive a crash of the process.
+     * Preallocated space is zero filled: if the process dies, the file is truncated after the last
+     * written byte and an unterminated last record gets a line break when the file is opened again.
+     * Ranges reserved by records that were not copied completely are removed from the middle of the file
+     * as well, which reads the file once.
+     */
+    class MappedFile : public std::ostream
+    {
+    private:
+        MappedFileBuf _buf;
+    public:
+
+
+        /*!
+         * Constructor
+         * Sets badbit if the file cannot be opened
+         * @param path File path
+         * @param segmentSize Size of a preallocated segment
+         */
+        explicit MappedFile(const std::string &path, size_t segmentSize = 64 * 1024 * 1024);
+
+
+        /*!
+         * Check if file is open
+         * @return true if open, false otherwise
+         */
+        bool is_open() const;
+
+
+        /*!
+         * Get amount of bytes written into the file, including data it had before opening
+         * @return File size
+         */
+        uint64_t size() const;
+
+
+        /*!
+         * Get stream buffer
+         * @return Buffer writing into the file
+         */
+        MappedFileBuf *rdbuf() const;
+    };
+
+    /*!
+     * Thread safe sink writing records into a memory-mapped file
+     * Every record is appended by MappedFileBuf::append() directly, the stream and its state are not used,
+     * so threads write without a lock. Records that could not be stored are dropped.
+     */
+    class MappedFileSink : public Sink
+    {
+    private:
+        MappedFileBuf &_buf;
+    public:
+
+
+        /*!
+         * Constructor
+         * @param file Output file, must outlive the sink
+         */
+        explicit MappedFileSink(MappedFile &file);
+
+        void write(const std::string_view *parts, size_t count) override;
+
+        bool threadSafe() const override;
+    };
+}
+
+#endif //LOGGER_MAPPEDFILE_H
@@ -0,0 +1,64 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "Metrics.h"
+
+namespace
+{
+    std::atomic<uint32_t> ownedShards(0);
+}
+
+size_t Log::StreamMetrics::claim()
+{
+    /*!
+     * Releases the shard owned by a thread when it exits
+     */
+    struct Owner
+    {
+        size_t index = shards;
+
+        ~Owner()
+        {
+            if (index != shards)
+                ownedShards.fetch_and(~(1u << index), std::memory_order_release);
+            // Messages printed by destructors of other thread-local objects use the shared shard
+            _owned = shards + 1;
+        }
+    };
+    static_assert(shards <= 32, "Owned shards are tracked by a 32-bit mask");
+    thread_local Owner owner;
+    uint32_t owned = ownedShards.load(std::memory_order_relaxed);
+    while (owned != UINT32_MAX)
+    {
+        auto free = size_t(__builtin_ctz(~owned));
+        // Acquire stores of the previous owner, the shard keeps its values
+        if (ownedShards.compare_exchange_weak(owned, owned | 1u << free, std::memory_order_acquire))
+        {
+            owner.index = free;
+            break;
+        }
+    }
+    _owned = owner.index + 1;
+    return owner.index;
+}
+
+Log::StreamMetrics::StreamMetrics() noexcept
+{
+    for (auto &shard : _shards)
+    {
+        for (auto &value : shard.values)
+            value.store(0, std::memory_order_relaxed);
+    }
+}
+
+Log::StreamCounters Log::StreamMetrics::read() const
+{
+    StreamCounters result;
+    for (const auto &shard : _shards)
+    {
+        for (size_t i = 0; i < counters; ++i)
+            result.values[i] += shard.values[i].load(std::memory_order_relaxed);
+    }
+    return result;
+}
@@ -0,0 +1,102 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_METRICS_H
+#define LOGGER_METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Log
+{
+    /*!
+     * Counter of a log stream
+     */
+    enum class Counter : size_t
+    {
+        Messages,   //!< Messages printed
+        Suppressed, //!< Messages of a disabled level discarded
+        Filtered,   //!< Messages of a call site disabled by a rule
+        Captured,   //!< Messages of a disabled level captured by a flight recorder
+        Lines,      //!< Lines printed, a message has several if it contains line breaks
+        Bytes,      //!< Bytes written into the output
+        Flushes,    //!< Output flushes
+        LockWait,   //!< Nanoseconds spent waiting for the output lock
+    };
+
+    /*!
+     * Amount of stream counters
+     */
+    constexpr size_t counters = size_t(Counter::LockWait) + 1;
+
+    /*!
+     * Values of stream counters at some point in time
+     */
+    struct StreamCounters
+    {
+        uint64_t values[counters] = {};
+
+        inline uint64_t operator[](Counter counter) const
+        { return values[size_t(counter)]; }
+    };
+
+    /*!
+     * Lock-free counters of a log stream
+     * Every thread owns a cache line sized shard while it runs, so counting is a plain store that threads printing
+     * into the same stream do not contend on; reading sums the shards.
+     * Threads started when all shards are owned share an additional shard updated with atomic increments.
+     */
+    class StreamMetrics
+    {
+    private:
+        static constexpr size_t shards = 32;
+
+        struct alignas(64) Shard
+        {
+            std::atomic<uint64_t> values[counters];
+        };
+
+        static inline thread_local size_t _owned = 0; //!< Index of the shard owned by a thread plus one, 0 if none
+        static size_t claim();
+        Shard _shards[shards + 1];
+    public:
+
+
+        /*!
+         * Constructor
+         * Initializes all counters with zero
+         */
+        StreamMetrics() noexcept;
+
+
+        /*!
+         * Increase a counter
+         * @param counter Counter
+         * @param value Amount to add
+         */
+        inline void add(Counter counter, uint64_t value = 1)
+        {
+            size_t shard = _owned != 0 ? _owned - 1 : claim();
+            std::atomic<uint64_t> &target = _shards[shard].values[size_t(counter)];
+            if (shard == shards)
+                target.fetch_add(value, std::memory_order_relaxed);
+            else
+                target.store(target.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+
+        /*!
+         * Read all counters
+         * Counters are read one by one while they may be increased, values are not a consistent snapshot
+         * @return Counter values
+         */
+        StreamCounters read() const;
+
+        StreamMetrics(const StreamMetrics &) = delete;
+        StreamMetrics &operator=(const StreamMetrics &) = delete;
+    };
+}
+
+#endif //LOGGER_METRICS_H
@@ -0,0 +1,22 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_RATELIMIT_H
+#define LOGGER_RATELIMIT_H
+
+#include <cstdint>
+
+namespace Log
+{
+    /*!
+     * Token bucket limiting messages printed by a single call site
+     */
+    struct RateLimit
+    {
+        uint32_t perSecond = 0; //!< Sustained rate, 0 to disable the limit
+        uint32_t burst = 1;     //!< Amount of messages printed at once after a quiet period
+    };
+}
+
+#endif //LOGGER_RATELIMIT_H
@@ -0,0 +1,56 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "Rcu.h"
+#include <thread>
+
+namespace
+{
+    std::atomic<size_t> nextSlot(0);
+
+    size_t threadSlot()
+    {
+        thread_local size_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+}
+
+Log::RcuDomain::Guard::Guard(const RcuDomain &domain):
+        _counter(&domain._readers[domain._epoch.load(std::memory_order_relaxed) & 1][threadSlot() % slots])
+{
+    // Sequentially consistent, so the protected value is loaded after the writer can see this reader
+    _counter->value.fetch_add(1);
+}
+
+Log::RcuDomain::Guard::~Guard()
+{
+    _counter->value.fetch_sub(1, std::memory_order_release);
+}
+
+Log::RcuDomain::RcuDomain() noexcept: _epoch(0)
+{
+}
+
+void Log::RcuDomain::synchronize()
+{
+    // New readers use the other epoch after a flip, so waiting for both epochs never starves
+    for (size_t phase = 0; phase < 2; ++phase)
+    {
+        size_t epoch = _epoch.fetch_add(1) & 1;
+        for (auto &counter : _readers[epoch])
+        {
+            while (counter.value.load() != 0)
+                std::this_thread::yield();
+        }
+    }
+}
+
+void Log::RcuDomain::reset()
+{
+    for (auto &epoch : _readers)
+    {
+        for (auto &counter : epoch)
+            counter.value.store(0, std::memory_order_relaxed);
+    }
+}
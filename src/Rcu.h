@@ -0,0 +1,232 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_RCU_H
+#define LOGGER_RCU_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace Log
+{
+    /*!
+     * Tracks readers of an Rcu object
+     * Readers increment a counter picked by their thread, so they never share a lock
+     * and rarely share a cache line. Writers flip the reader epoch and wait until
+     * counters of both epochs drain.
+     */
+    class RcuDomain
+    {
+    private:
+        static constexpr size_t slots = 64;
+
+        struct alignas(64) Counter
+        {
+            std::atomic<size_t> value{0};
+        };
+
+        mutable Counter _readers[2][slots];
+        std::atomic<size_t> _epoch;
+    public:
+
+
+        /*!
+         * Read-side critical section
+         */
+        class Guard
+        {
+        private:
+            Counter *_counter;
+        public:
+
+
+            /*!
+             * Constructor
+             * Enters read-side critical section
+             * @param domain Domain to register the reader in
+             */
+            explicit Guard(const RcuDomain &domain);
+
+
+            /*!
+             * Destructor
+             * Leaves read-side critical section
+             */
+            ~Guard();
+
+            Guard(const Guard &) = delete;
+            Guard &operator=(const Guard &) = delete;
+        };
+
+
+        /*!
+         * Constructor
+         */
+        RcuDomain() noexcept;
+
+
+        /*!
+         * Wait until every read-side critical section entered before this call is left
+         * @note Deadlocks if called from a read-side critical section of the same domain
+         */
+        void synchronize();
+
+
+        /*!
+         * Forget readers of threads that do not exist in a forked child
+         * @note Must only be called in the child after fork, outside of a read-side critical section
+         */
+        void reset();
+    };
+
+    /*!
+     * Read-copy-update cell
+     * Readers get a snapshot of the value with a couple of atomic operations,
+     * writers publish a modified copy and retire the previous value once no reader uses it
+     * @tparam T Value type
+     */
+    template <typename T>
+    class Rcu
+    {
+    private:
+        RcuDomain _domain;
+        std::atomic<const T *> _current;
+        std::mutex _writer;
+    public:
+
+
+        /*!
+         * Snapshot of the value, valid until the guard is destroyed
+         */
+        class ReadGuard
+        {
+        private:
+            RcuDomain::Guard _guard;
+            const T *_value;
+        public:
+
+
+            /*!
+             * Constructor
+             * @param rcu Cell to read
+             */
+            explicit ReadGuard(const Rcu &rcu);
+
+            inline const T &operator*() const
+            { return *_value; }
+
+            inline const T *operator->() const
+            { return _value; }
+        };
+
+
+        /*!
+         * Constructor
+         * @param value Initial value
+         */
+        explicit Rcu(std::unique_ptr<T> value);
+
+
+        /*!
+         * Destructor
+         * @note No reader may exist
+         */
+        ~Rcu();
+
+        Rcu(const Rcu &) = delete;
+        Rcu &operator=(const Rcu &) = delete;
+
+
+        /*!
+         * Get a snapshot of the current value
+         * @return Read guard
+         */
+        ReadGuard read() const;
+
+
+        /*!
+         * Publish a modified copy of the current value
+         * Writers are serialized, readers are never blocked
+         * @param modify Functor called with the copy to modify
+         * @return Previous value, no reader uses it anymore
+         */
+        template <typename Modify>
+        std::unique_ptr<const T> update(Modify &&modify);
+
+
+        /*!
+         * Wait for a running update and block further updates until fork completes
+         */
+        void beforeFork();
+
+
+        /*!
+         * Allow updates again in the parent after fork
+         */
+        void afterForkParent();
+
+
+        /*!
+         * Allow updates again in the child after fork
+         * Readers of other threads were interrupted by fork and are forgotten
+         */
+        void afterForkChild();
+    };
+}
+
+template<typename T>
+Log::Rcu<T>::ReadGuard::ReadGuard(const Rcu &rcu): _guard(rcu._domain), _value(rcu._current.load())
+{
+}
+
+template<typename T>
+Log::Rcu<T>::Rcu(std::unique_ptr<T> value): _current(value.release())
+{
+}
+
+template<typename T>
+Log::Rcu<T>::~Rcu()
+{
+    delete _current.load();
+}
+
+template<typename T>
+typename Log::Rcu<T>::ReadGuard Log::Rcu<T>::read() const
+{
+    return ReadGuard(*this);
+}
+
+template<typename T>
+template<typename Modify>
+std::unique_ptr<const T> Log::Rcu<T>::update(Modify &&modify)
+{
+    std::lock_guard<std::mutex> lock(_writer);
+    std::unique_ptr<T> next(new T(*_current.load()));
+    modify(*next);
+    std::unique_ptr<const T> previous(_current.exchange(next.release()));
+    _domain.synchronize();
+    return previous;
+}
+
+template<typename T>
+void Log::Rcu<T>::beforeFork()
+{
+    _writer.lock();
+}
+
+template<typename T>
+void Log::Rcu<T>::afterForkParent()
+{
+    _writer.unlock();
+}
+
+template<typename T>
+void Log::Rcu<T>::afterForkChild()
+{
+    _domain.reset();
+    _writer.unlock();
+}
+
+#endif //LOGGER_RCU_H
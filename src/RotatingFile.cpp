@@ -0,0 +1,410 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "RotatingFile.h"
+#include "Timestamp.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef LOGGER_HAVE_ZLIB
+#define LOGGER_HAVE_ZLIB 0
+#endif
+
+#ifndef LOGGER_HAVE_ZSTD
+#define LOGGER_HAVE_ZSTD 0
+#endif
+
+#if LOGGER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if LOGGER_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+    constexpr size_t bufferSize = 64 * 1024;
+
+    bool writeFully(int fd, const char *data, size_t size)
+    {
+        while (size != 0)
+        {
+            ssize_t written = write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += written;
+            size -= size_t(written);
+        }
+        return true;
+    }
+
+    const char *extension(Log::Compression compression)
+    {
+        switch (compression)
+        {
+            case Log::Compression::Gzip:
+                return ".gz";
+            case Log::Compression::Zstd:
+                return ".zst";
+            case Log::Compression::None:
+                break;
+        }
+        return "";
+    }
+
+#if LOGGER_HAVE_ZLIB
+    bool compressGzip(int in, const std::string &path)
+    {
+        gzFile file = gzopen(path.c_str(), "wb");
+        if (file == nullptr)
+            return false;
+        char buf[bufferSize];
+        bool result = true;
+        ssize_t length;
+        while ((length = read(in, buf, sizeof(buf))) > 0)
+        {
+            if (gzwrite(file, buf, unsigned(length)) != int(length))
+            {
+                result = false;
+                break;
+            }
+        }
+        if (length < 0)
+            result = false;
+        if (gzclose(file) != Z_OK)
+            result = false;
+        return result;
+    }
+#endif
+
+#if LOGGER_HAVE_ZSTD
+    bool compressZstd(int in, const std::string &path)
+    {
+        int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0)
+            return false;
+        ZSTD_CCtx *context = ZSTD_createCCtx();
+        std::vector<char> input(ZSTD_CStreamInSize());
+        std::vector<char> output(ZSTD_CStreamOutSize());
+        bool result = context != nullptr;
+        while (result)
+        {
+            ssize_t length = read(in, input.data(), input.size());
+            if (length < 0)
+            {
+                result = false;
+                break;
+            }
+            bool last = length == 0;
+            ZSTD_inBuffer inBuffer = {input.data(), size_t(length), 0};
+            bool finished = false;
+            while (result && !finished)
+            {
+                ZSTD_outBuffer outBuffer = {output.data(), output.size(), 0};
+                size_t remaining = ZSTD_compressStream2(context, &outBuffer, &inBuffer,
+                                                        last ? ZSTD_e_end : ZSTD_e_continue);
+                result = !ZSTD_isError(remaining) && writeFully(out, output.data(), outBuffer.pos);
+                finished = last ? remaining == 0 : inBuffer.pos == inBuffer.size;
+            }
+            if (last)
+                break;
+        }
+        ZSTD_freeCCtx(context);
+        if (close(out) != 0)
+            result = false;
+        return result;
+    }
+#endif
+
+    bool compress(Log::Compression compression, int in, const std::string &path)
+    {
+        switch (compression)
+        {
+#if LOGGER_HAVE_ZLIB
+            case Log::Compression::Gzip:
+                return compressGzip(in, path);
+#endif
+#if LOGGER_HAVE_ZSTD
+            case Log::Compression::Zstd:
+                return compressZstd(in, path);
+#endif
+            default:
+                return false;
+        }
+    }
+}
+
+bool Log::compressionAvailable(Compression compression)
+{
+    switch (compression)
+    {
+        case Compression::None:
+            return true;
+        case Compression::Gzip:
+            return LOGGER_HAVE_ZLIB;
+        case Compression::Zstd:
+            return LOGGER_HAVE_ZSTD;
+    }
+    return false;
+}
+
+Log::RotatingFileBuf::RotatingFileBuf(const std::string &path, const RotationPolicy &policy):
+        _path(path), _policy(policy), _compression(policy.compression),
+        _fd(open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)), _size(0), _rotations(0),
+        _reserved(false), _buffer(bufferSize), _pending(0), _stop(false)
+{
+    if (!compressionAvailable(_compression))
+    {
+        if (compressionAvailable(Compression::Zstd))
+            _compression = Compression::Zstd;
+        else if (compressionAvailable(Compression::Gzip))
+            _compression = Compression::Gzip;
+        else
+            _compression = Compression::None;
+    }
+    struct stat st{};
+    if (_fd >= 0 && fstat(_fd, &st) == 0)
+        _size = uint64_t(st.st_size);
+    setp(_buffer.data(), _buffer.data() + _buffer.size());
+    scheduleRoll(now(ClockSource::CoarseRealtime));
+    _thread = std::thread(&RotatingFileBuf::run, this);
+    addForkListener(this, ForkStage::Output);
+}
+
+Log::RotatingFileBuf::~RotatingFileBuf()
+{
+    removeForkListener(this);
+    drain();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+    if (_fd >= 0)
+        close(_fd);
+}
+
+bool Log::RotatingFileBuf::is_open() const
+{
+    return _fd >= 0;
+}
+
+Log::Compression Log::RotatingFileBuf::compression() const
+{
+    return _compression;
+}
+
+void Log::RotatingFileBuf::waitRotated()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _pending == 0; });
+}
+
+std::streamsize Log::RotatingFileBuf::xsputn(const char *s, std::streamsize count)
+{
+    if (_fd < 0 || count <= 0)
+        return 0;
+    auto size = size_t(count);
+    // Records are written with a single call, so a record never spans two files
+    if (!_reserved)
+        rotateIfNeeded(size);
+    _reserved = false;
+    _size += size;
+    if (size > size_t(epptr() - pptr()))
+    {
+        if (!drain())
+            return 0;
+        if (size >= _buffer.size())
+            return writeFully(_fd, s, size) ? count : 0;
+    }
+    std::memcpy(pptr(), s, size);
+    pbump(int(size));
+    return count;
+}
+
+Log::RotatingFileBuf::int_type Log::RotatingFileBuf::overflow(int_type ch)
+{
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+        return traits_type::not_eof(ch);
+    char c = traits_type::to_char_type(ch);
+    return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+}
+
+int Log::RotatingFileBuf::sync()
+{
+    return drain() ? 0 : -1;
+}
+
+bool Log::RotatingFileBuf::drain()
+{
+    bool result = _fd >= 0 && writeFully(_fd, pbase(), size_t(pptr() - pbase()));
+    setp(_buffer.data(), _buffer.data() + _buffer.size());
+    return result;
+}
+
+bool Log::RotatingFileBuf::reserve(size_t size)
+{
+    _reserved = _fd >= 0;
+    return _reserved && rotateIfNeeded(size);
+}
+
+bool Log::RotatingFileBuf::rotateIfNeeded(size_t incoming)
+{
+    bool rotate = _policy.maxSize != 0 && _size != 0 && _size + incoming > _policy.maxSize;
+    if (_policy.interval.count() != 0)
+    {
+        auto time = now(ClockSource::CoarseRealtime);
+        if (time >= _nextRoll)
+        {
+            rotate = rotate || _size != 0;
+            scheduleRoll(time);
+        }
+    }
+    return rotate && this->rotate();
+}
+
+bool Log::RotatingFileBuf::rotate()
+{
+    drain();
+    // Only rename here, closing and compressing may take a while
+    std::string pending = _path + ".rotating." + std::to_string(getpid()) + '.' + std::to_string(_rotations++);
+    if (std::rename(_path.c_str(), pending.c_str()) != 0)
+        return false;
+    int fd = open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        std::rename(pending.c_str(), _path.c_str());
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back({_fd, pending});
+        ++_pending;
+    }
+    _wake.notify_one();
+    _fd = fd;
+    _size = 0;
+    return true;
+}
+
+void Log::RotatingFileBuf::scheduleRoll(std::chrono::system_clock::time_point time)
+{
+    if (_policy.interval.count() == 0)
+        return;
+    auto since = time.time_since_epoch();
+    _nextRoll = std::chrono::system_clock::time_point((since / _policy.interval + 1) * _policy.interval);
+}
+
+std::string Log::RotatingFileBuf::generation(size_t index, bool compressed) const
+{
+    return _path + '.' + std::to_string(index) + (compressed ? extension(_compression) : "");
+}
+
+void Log::RotatingFileBuf::process(Job &job)
+{
+    close(job.fd);
+    if (_policy.generations == 0)
+    {
+        std::remove(job.path.c_str());
+        return;
+    }
+    // A generation is stored uncompressed if its compression failed
+    for (bool compressed : {false, true})
+    {
+        if (compressed && _compression == Compression::None)
+            break;
+        std::remove(generation(_policy.generations, compressed).c_str());
+        for (size_t i = _policy.generations - 1; i > 0; --i)
+            std::rename(generation(i, compressed).c_str(), generation(i + 1, compressed).c_str());
+    }
+    if (_compression != Compression::None)
+    {
+        int in = open(job.path.c_str(), O_RDONLY | O_CLOEXEC);
+        bool compressed = in >= 0 && compress(_compression, in, generation(1, true));
+        if (in >= 0)
+            close(in);
+        if (compressed)
+        {
+            std::remove(job.path.c_str());
+            return;
+        }
+        std::remove(generation(1, true).c_str());
+    }
+    std::rename(job.path.c_str(), generation(1, false).c_str());
+}
+
+void Log::RotatingFileBuf::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _wake.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+        if (_jobs.empty())
+            break;
+        Job job = std::move(_jobs.front());
+        _jobs.pop_front();
+        lock.unlock();
+        process(job);
+        lock.lock();
+        --_pending;
+        _done.notify_all();
+    }
+}
+
+void Log::RotatingFileBuf::beforeFork()
+{
+    _mutex.lock();
+}
+
+void Log::RotatingFileBuf::afterForkParent()
+{
+    _mutex.unlock();
+}
+
+void Log::RotatingFileBuf::afterForkChild()
+{
+    for (auto &job : _jobs)
+        close(job.fd);
+    _jobs.clear();
+    _pending = 0;
+    // The background thread does not exist in the child, its handle is abandoned instead of being joined
+    new (&_wake) std::condition_variable;
+    new (&_done) std::condition_variable;
+    new (&_thread) std::thread;
+    _mutex.unlock();
+    _thread = std::thread(&RotatingFileBuf::run, this);
+}
+
+Log::RotatingFile::RotatingFile(const std::string &path, const RotationPolicy &policy): std::ostream(nullptr),
+        _buf(path, policy)
+{
+    rdbuf(&_buf);
+    if (!_buf.is_open())
+        setstate(std::ios::badbit);
+}
+
+bool Log::RotatingFile::is_open() const
+{
+    return _buf.is_open();
+}
+
+Log::Compression Log::RotatingFile::compression() const
+{
+    return _buf.compression();
+}
+
+void Log::RotatingFile::waitRotated()
+{
+    _buf.waitRotated();
+}
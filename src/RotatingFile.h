@@ -0,0 +1,195 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_ROTATINGFILE_H
+#define LOGGER_ROTATINGFILE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AtFork.h"
+
+namespace Log
+{
+    /*!
+     * Compression of rotated log files
+     */
+    enum class Compression
+    {
+        None, //!< Keep rotated files as is
+        Gzip, //!< Compress with zlib into .gz files
+        Zstd, //!< Compress with zstd into .zst files
+    };
+
+    /*!
+     * Check if a compression method is supported by this build
+     * @param compression Compression method
+     * @return true if supported, false otherwise
+     */
+    bool compressionAvailable(Compression compression);
+
+    /*!
+     * Log file rotation policy
+     */
+    struct RotationPolicy
+    {
+        uint64_t maxSize = 0;                                   //!< Rotate when file exceeds this size, 0 to disable
+        std::chrono::system_clock::duration interval{0};        //!< Rotate at multiples of this interval since
+                                                                //!< the epoch (UTC), 0 to disable
+        size_t generations = 5;                                 //!< Amount of rotated files to keep
+        Compression compression = Compression::Gzip;            //!< Falls back to another method if not available
+    };
+
+    /*!
+     * Stream buffer writing into a file that is rotated by size or time
+     * Rotation only renames the file and opens a new one, rotated files are closed, renamed
+     * and compressed by a background thread.
+     * Rotated files are named <path>.1 (the newest) to <path>.<generations>, plus the compression extension.
+     * A forked child restarts the background thread, files rotated before fork are processed by the parent.
+     */
+    class RotatingFileBuf : public std::streambuf, private ForkListener
+    {
+    private:
+        /*!
+         * Rotated file waiting for the background thread
+         */
+        struct Job
+        {
+            int fd;
+            std::string path;
+        };
+
+        std::string _path;
+        RotationPolicy _policy;
+        Compression _compression;
+        int _fd;
+        uint64_t _size;
+        std::chrono::system_clock::time_point _nextRoll;
+        uint64_t _rotations;
+        bool _reserved;
+        std::vector<char> _buffer;
+
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        std::deque<Job> _jobs;
+        size_t _pending;
+        bool _stop;
+        std::thread _thread;
+
+        bool drain();
+        bool rotateIfNeeded(size_t incoming);
+        bool rotate();
+        void scheduleRoll(std::chrono::system_clock::time_point time);
+        std::string generation(size_t index, bool compressed) const;
+        void process(Job &job);
+        void run();
+        void beforeFork() override;
+        void afterForkParent() override;
+        void afterForkChild() override;
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize count) override;
+        int_type overflow(int_type ch) override;
+        int sync() override;
+    public:
+
+
+        /*!
+         * Constructor
+         * Opens the file for appending
+         * @param path File path
+         * @param policy Rotation policy
+         */
+        RotatingFileBuf(const std::string &path, const RotationPolicy &policy);
+
+
+        /*!
+         * Destructor
+         * Writes buffered data and waits until rotated files are processed
+         */
+        ~RotatingFileBuf() override;
+
+
+        /*!
+         * Check if file is open
+         * @return true if open, false otherwise
+         */
+        bool is_open() const;
+
+
+        /*!
+         * Get compression method used for rotated files
+         * @return Compression method
+         */
+        Compression compression() const;
+
+
+        /*!
+         * Rotate the file if a record does not fit in it
+         * The next write is the record and is not checked again, so it is not moved into another file
+         * after the caller has formatted it for this one
+         * @param size Size of the record
+         * @return true if a new file was started, false otherwise
+         */
+        bool reserve(size_t size);
+
+
+        /*!
+         * Wait until all rotated files are closed, renamed and compressed
+         */
+        void waitRotated();
+
+        RotatingFileBuf(const RotatingFileBuf &) = delete;
+        RotatingFileBuf &operator=(const RotatingFileBuf &) = delete;
+    };
+
+    /*!
+     * Output stream writing into a file that is rotated by size or time
+     * Like any other output stream it is not thread safe, Logger serializes writes into it
+     */
+    class RotatingFile : public std::ostream
+    {
+    private:
+        RotatingFileBuf _buf;
+    public:
+
+
+        /*!
+         * Constructor
+         * Sets badbit if the file cannot be opened
+         * @param path File path
+         * @param policy Rotation policy
+         */
+        RotatingFile(const std::string &path, const RotationPolicy &policy);
+
+
+        /*!
+         * Check if file is open
+         * @return true if open, false otherwise
+         */
+        bool is_open() const;
+
+
+        /*!
+         * Get compression method used for rotated files
+         * @return Compression method
+         */
+        Compression compression() const;
+
+
+        /*!
+         * Wait until all rotated files are closed, renamed and compressed
+         */
+        void waitRotated();
+    };
+}
+
+#endif //LOGGER_ROTATINGFILE_H
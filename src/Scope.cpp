@@ -0,0 +1,70 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "Scope.h"
+#include "Logger.h"
+#include <atomic>
+
+namespace
+{
+    std::atomic<int64_t> scopeThreshold(0);
+
+    int64_t monotonic()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+bool Log::Scope::enabled(const Logger &logger, size_t level, std::string_view tag, CallSite &site,
+                         const char *function)
+{
+    return logger.isAccepted(LogLevel(level)) && site.enabled(level, tag, function);
+}
+
+void Log::Scope::begin()
+{
+    _parent = _innermost;
+    _innermost = this;
+    _indent = _depth++;
+    _start = monotonic();
+    if (scopeThreshold.load(std::memory_order_relaxed) == 0)
+        enter(false);
+}
+
+void Log::Scope::enter(bool deferred)
+{
+    // Deferred enter records are printed outermost first
+    if (_parent != nullptr && !_parent->_entered)
+        _parent->enter(true);
+    _entered = true;
+    if (!deferred)
+    {
+        _logger->printKV(LogLevel(_level), _indent, _tag, _name, "scope", "enter");
+        return;
+    }
+    // Time the scope was entered, the wall clock is only read when the record is printed
+    auto time = std::chrono::system_clock::now() - std::chrono::nanoseconds(monotonic() - _start);
+    _logger->printKVAt(LogLevel(_level), std::chrono::time_point_cast<std::chrono::system_clock::duration>(time),
+                       _indent, _tag, _name, "scope", "enter");
+}
+
+void Log::Scope::end()
+{
+    int64_t duration = monotonic() - _start;
+    _innermost = _parent;
+    --_depth;
+    if (!_entered)
+    {
+        if (duration < scopeThreshold.load(std::memory_order_relaxed))
+            return;
+        enter(true);
+    }
+    _logger->printKV(LogLevel(_level), _indent, _tag, _name, "scope", "exit", "duration_us", double(duration) / 1000);
+}
+
+void Log::setScopeThreshold(std::chrono::nanoseconds threshold)
+{
+    scopeThreshold.store(threshold.count(), std::memory_order_relaxed);
+}
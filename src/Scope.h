@@ -0,0 +1,120 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_SCOPE_H
+#define LOGGER_SCOPE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace Log
+{
+    class Logger;
+    class CallSite;
+
+    /*!
+     * Traced scope
+     * Prints a record when the scope is entered and another one with its duration, measured with a monotonic clock,
+     * when it is left. Messages printed by logging macros inside the scope are indented one level deeper.
+     * Scopes shorter than the threshold set by setScopeThreshold() are not printed at all, their enter record
+     * is deferred until the scope turns out to be slow or prints a message, and is stamped with the time
+     * the scope was entered.
+     * A scope that was not enabled when it was created does nothing.
+     * @note Scopes must be destroyed in reverse order of creation on the thread that created them
+     */
+    class Scope
+    {
+    private:
+        static inline thread_local Scope *_innermost = nullptr;
+        static inline thread_local size_t _depth = 0;
+
+        const Logger *_logger;
+        size_t _level;
+        std::string_view _tag;
+        std::string_view _name;
+        Scope *_parent;
+        size_t _indent;
+        int64_t _start;
+        bool _entered;
+
+        static bool enabled(const Logger &logger, size_t level, std::string_view tag, CallSite &site,
+                            const char *function);
+
+        void begin();
+        void enter(bool deferred);
+        void end();
+    public:
+
+
+        /*!
+         * Constructor
+         * @param logger Logger to print into
+         * @param level Log level
+         * @param tag Tag of records, must outlive the scope
+         * @param name Scope name, must outlive the scope
+         * @param enabled false to skip tracing the scope
+         */
+        inline Scope(const Logger &logger, size_t level, std::string_view tag, std::string_view name, bool enabled):
+                _logger(enabled ? &logger : nullptr), _level(level), _tag(tag), _name(name), _parent(nullptr),
+                _indent(0), _start(0), _entered(false)
+        {
+            if (enabled)
+                begin();
+        }
+
+
+        /*!
+         * Constructor
+         * Traces the scope if the level and the call site are enabled
+         * @param logger Logger to print into
+         * @param level Log level
+         * @param tag Tag of records, must outlive the scope
+         * @param name Scope name, must outlive the scope
+         * @param site Call site the scope is created at
+         * @param function Name of the function the site is in
+         */
+        inline Scope(const Logger &logger, size_t level, std::string_view tag, std::string_view name, CallSite &site,
+                     const char *function):
+                Scope(logger, level, tag, name, enabled(logger, level, tag, site, function))
+        {
+        }
+
+
+        /*!
+         * Destructor
+         * Prints the exit record unless the scope is shorter than the threshold
+         */
+        inline ~Scope()
+        {
+            if (_logger != nullptr)
+                end();
+        }
+
+
+        /*!
+         * Get indentation of messages printed by the current thread
+         * Prints deferred enter records of the scopes the thread is in, so the message follows them
+         * @return Amount of traced scopes the thread is in
+         */
+        static inline size_t indent()
+        {
+            if (_innermost != nullptr && !_innermost->_entered)
+                _innermost->enter(true);
+            return _depth;
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+
+    /*!
+     * Set duration below which traced scopes are not printed
+     * @param threshold Duration threshold, 0 to print every scope
+     */
+    void setScopeThreshold(std::chrono::nanoseconds threshold);
+}
+
+#endif //LOGGER_SCOPE_H
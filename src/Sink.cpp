@@ -0,0 +1,176 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "Sink.h"
+#include "RotatingFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
+
+void Log::Sink::writeRecord(const LogRecord &, const std::string_view *parts, size_t count)
+{
+    write(parts, count);
+}
+
+void Log::Sink::flush()
+{
+}
+
+bool Log::Sink::reserve(size_t)
+{
+    return false;
+}
+
+bool Log::Sink::threadSafe() const
+{
+    return false;
+}
+
+Log::OStreamSink::OStreamSink(std::ostream &stream):
+        _stream(stream), _rotating(dynamic_cast<RotatingFileBuf *>(stream.rdbuf()))
+{
+}
+
+void Log::OStreamSink::write(const std::string_view *parts, size_t count)
+{
+    if (count == 1)
+    {
+        _stream.write(parts[0].data(), std::streamsize(parts[0].size()));
+        return;
+    }
+    _joined.clear();
+    for (size_t i = 0; i < count; ++i)
+        _joined.append(parts[i]);
+    _stream.write(_joined.data(), std::streamsize(_joined.size()));
+}
+
+bool Log::OStreamSink::reserve(size_t size)
+{
+    return _rotating != nullptr && _rotating->reserve(size);
+}
+
+void Log::OStreamSink::flush()
+{
+    _stream.flush();
+}
+
+std::ostream &Log::OStreamSink::stream() const
+{
+    return _stream;
+}
+
+Log::FdSink::FdSink(int fd, bool owned): _fd(fd), _owned(owned)
+{
+}
+
+Log::FdSink::~FdSink()
+{
+    if (_owned && _fd >= 0)
+        close(_fd);
+}
+
+void Log::FdSink::write(const std::string_view *parts, size_t count)
+{
+    constexpr size_t maxParts = 8;
+    iovec iov[maxParts];
+    while (count != 0)
+    {
+        size_t batch = std::min(count, maxParts);
+        size_t remaining = 0;
+        for (size_t i = 0; i < batch; ++i)
+        {
+            iov[i].iov_base = const_cast<char *>(parts[i].data());
+            iov[i].iov_len = parts[i].size();
+            remaining += parts[i].size();
+        }
+        iovec *pos = iov;
+        while (remaining != 0)
+        {
+            ssize_t written = writev(_fd, pos, int(batch - size_t(pos - iov)));
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            remaining -= size_t(written);
+            // Skip fully written parts and advance into a partially written one
+            auto left = size_t(written);
+            while (left != 0 && left >= pos->iov_len)
+                left -= (pos++)->iov_len;
+            if (left != 0)
+            {
+                pos->iov_base = static_cast<char *>(pos->iov_base) + left;
+                pos->iov_len -= left;
+            }
+        }
+        parts += batch;
+        count -= batch;
+    }
+}
+
+int Log::FdSink::fd() const
+{
+    return _fd;
+}
+
+Log::RingSink::RingSink(size_t capacity): _data(std::max<size_t>(capacity, 1)), _written(0)
+{
+}
+
+void Log::RingSink::write(const std::string_view *parts, size_t count)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::string_view part = parts[i];
+        // Only the tail of a part larger than the ring is kept
+        if (part.size() > _data.size())
+        {
+            _written += part.size() - _data.size();
+            part.remove_prefix(part.size() - _data.size());
+        }
+        size_t offset = _written % _data.size();
+        size_t first = std::min(part.size(), _data.size() - offset);
+        std::memcpy(_data.data() + offset, part.data(), first);
+        std::memcpy(_data.data(), part.data() + first, part.size() - first);
+        _written += part.size();
+    }
+}
+
+bool Log::RingSink::threadSafe() const
+{
+    return true;
+}
+
+std::string Log::RingSink::contents() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_written <= _data.size())
+        return std::string(_data.data(), _written);
+    size_t offset = _written % _data.size();
+    std::string result(_data.data() + offset, _data.size() - offset);
+    result.append(_data.data(), offset);
+    // The oldest line was partially overwritten
+    size_t start = result.find('\n');
+    result.erase(0, start == std::string::npos ? result.size() : start + 1);
+    return result;
+}
+
+void Log::RingSink::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _written = 0;
+}
+
+void Log::NullSink::write(const std::string_view *, size_t)
+{
+}
+
+bool Log::NullSink::threadSafe() const
+{
+    return true;
+}
@@ -0,0 +1,194 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_SINK_H
+#define LOGGER_SINK_H
+
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "LogRecord.h"
+
+namespace Log
+{
+    /*!
+     * Destination of formatted records
+     * Every record is written with a single call, split into a few contiguous parts
+     * (e.g. binary tag definitions followed by the record itself).
+     * Calls are serialized by the logger unless the sink is thread safe.
+     */
+    class Sink
+    {
+    public:
+        virtual ~Sink() = default;
+
+
+        /*!
+         * Write formatted bytes
+         * @param parts Parts to write in order
+         * @param count Amount of parts
+         */
+        virtual void write(const std::string_view *parts, size_t count) = 0;
+
+
+        /*!
+         * Write a record
+         * Receives the unformatted record along with its formatted bytes, writes the bytes by default
+         * @param record Record
+         * @param parts Formatted record, parts to write in order
+         * @param count Amount of parts
+         */
+        virtual void writeRecord(const LogRecord &record, const std::string_view *parts, size_t count);
+
+
+        /*!
+         * Prepare for a record before it is formatted for good, e.g. rotate a file it does not fit in
+         * Called by formats that depend on earlier output of the file, right before the record is written
+         * @param size Size of the record
+         * @return true if the record starts a new file, false by default
+         */
+        virtual bool reserve(size_t size);
+
+
+        /*!
+         * Flush buffered data
+         */
+        virtual void flush();
+
+
+        /*!
+         * Check if the sink can be written by several threads at once
+         * @return true if writes need no lock, false otherwise
+         */
+        virtual bool threadSafe() const;
+    };
+
+    class RotatingFileBuf;
+
+    /*!
+     * Sink writing into a standard output stream
+     * Parts of a record are joined and written with a single call, so a RotatingFile never splits them
+     */
+    class OStreamSink : public Sink
+    {
+    private:
+        std::ostream &_stream;
+        RotatingFileBuf *_rotating;
+        std::string _joined;
+    public:
+
+
+        /*!
+         * Constructor
+         * @param stream Output stream, must outlive the sink
+         */
+        explicit OStreamSink(std::ostream &stream);
+
+        void write(const std::string_view *parts, size_t count) override;
+
+        bool reserve(size_t size) override;
+
+        void flush() override;
+
+
+        /*!
+         * Get output stream
+         * @return Output stream
+         */
+        std::ostream &stream() const;
+    };
+
+    /*!
+     * Sink writing into a file descriptor with a single writev() per record
+     * Nothing is buffered, so flush is not needed
+     */
+    class FdSink : public Sink
+    {
+    private:
+        int _fd;
+        bool _owned;
+    public:
+
+
+        /*!
+         * Constructor
+         * @param fd File descriptor
+         * @param owned true to close the descriptor when the sink is destroyed
+         */
+        explicit FdSink(int fd, bool owned = false);
+
+
+        /*!
+         * Destructor
+         * Closes the descriptor if owned
+         */
+        ~FdSink() override;
+
+        FdSink(const FdSink &) = delete;
+        FdSink &operator=(const FdSink &) = delete;
+
+        void write(const std::string_view *parts, size_t count) override;
+
+
+        /*!
+         * Get file descriptor
+         * @return File descriptor
+         */
+        int fd() const;
+    };
+
+    /*!
+     * Sink keeping the most recent output in memory
+     * Older bytes are overwritten once the ring is full
+     */
+    class RingSink : public Sink
+    {
+    private:
+        mutable std::mutex _mutex;
+        std::vector<char> _data;
+        size_t _written;
+    public:
+
+
+        /*!
+         * Constructor
+         * @param capacity Amount of bytes kept
+         */
+        explicit RingSink(size_t capacity);
+
+        void write(const std::string_view *parts, size_t count) override;
+
+        bool threadSafe() const override;
+
+
+        /*!
+         * Get kept output, oldest first
+         * If older output was overwritten, starts at the first complete line
+         * @return Kept output
+         */
+        std::string contents() const;
+
+
+        /*!
+         * Discard kept output
+         */
+        void clear();
+    };
+
+    /*!
+     * Sink discarding everything
+     */
+    class NullSink : public Sink
+    {
+    public:
+        void write(const std::string_view *parts, size_t count) override;
+
+        bool threadSafe() const override;
+    };
+}
+
+#endif //LOGGER_SINK_H
@@ -0,0 +1,22 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "StringBuf.h"
+
+Log::StringBuf::StringBuf(std::string &str): _str(str)
+{
+}
+
+Log::StringBuf::int_type Log::StringBuf::overflow(int_type ch)
+{
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        _str.push_back(traits_type::to_char_type(ch));
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize Log::StringBuf::xsputn(const char *s, std::streamsize count)
+{
+    _str.append(s, size_t(count));
+    return count;
+}
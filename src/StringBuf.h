@@ -0,0 +1,35 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_STRINGBUF_H
+#define LOGGER_STRINGBUF_H
+
+#include <streambuf>
+#include <string>
+
+namespace Log
+{
+    /*!
+     * Stream buffer that appends everything written into it to an external string
+     * Unlike std::stringbuf it never copies the string, so its memory can be reused between records
+     */
+    class StringBuf : public std::streambuf
+    {
+    private:
+        std::string &_str;
+    protected:
+        int_type overflow(int_type ch) override;
+        std::streamsize xsputn(const char *s, std::streamsize count) override;
+    public:
+
+
+        /*!
+         * Constructor
+         * @param str String to append data to
+         */
+        explicit StringBuf(std::string &str);
+    };
+}
+
+#endif //LOGGER_STRINGBUF_H
@@ -6,6 +6,44 @@
 #include <catch.hpp>
 
 #include "Logger.h"
+#include "TextFormat.h"
+#include "Json.h"
+#include "LineScan.h"
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+#include <set>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+static thread_local size_t allocations = 0;
+static std::atomic<size_t> totalAllocations(0);
+
+void *operator new(size_t size)
+{
+    ++allocations;
+    totalAllocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if(ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+// Not inlined: GCC would see free() applied to a pointer returned by operator new and warn about
+// a mismatched deallocation, although the replaced operator new allocates with malloc()
+__attribute__((noinline)) void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
 
 std::string get(size_t pos, std::stringstream& sstream)
 {
@@ -31,6 +69,32 @@ std::string get(size_t pos, std::stringstream& sstream)
     }
 }
 
+class NullBuf : public std::streambuf
+{
+protected:
+    int_type overflow(int_type ch) override
+    {
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char *, std::streamsize count) override
+    {
+        return count;
+    }
+};
+
+class CountingBuf : public std::stringbuf
+{
+public:
+    size_t syncs = 0;
+protected:
+    int sync() override
+    {
+        ++syncs;
+        return std::stringbuf::sync();
+    }
+};
+
 std::string strThID()
 {
     std::stringstream idconv;
@@ -38,6 +102,24 @@ std::string strThID()
     return idconv.str();
 }
 
+void siteLogger(const std::string &msg)
+{
+    LOG_WARNING(msg);
+    LOG_WARNING_TAG(msg, "site-tag");
+}
+
+void scopedRequest(std::chrono::milliseconds slow)
+{
+    LOG_SCOPE("request");
+    {
+        LOG_SCOPE("fast");
+    }
+    {
+        LOG_SCOPE("slow");
+        std::this_thread::sleep_for(slow);
+    }
+}
+
 TEST_CASE("LoggerTest")
 {
 
@@ -123,6 +205,24 @@ TEST_CASE("LoggerTest")
         REQUIRE(get(0, out) == "");
     }
 
+    SECTION("HeaderCache", "[log-stream]")
+    {
+        auto time = std::chrono::system_clock::time_point(std::chrono::seconds(1546300800));
+        auto header = [time](uint64_t pid, uint64_t tid, char sign)
+        {
+            std::string result;
+            Log::appendHeader(result, time, pid, tid, sign, "tag");
+            return result.substr(Log::timestampLength);
+        };
+        REQUIRE(header(100, 7, sign) == "  100  7 " + std::string(1, sign) + " tag: ");
+        // Same slot of the cache, pid changed by fork
+        REQUIRE(header(4294967295u, 7, sign) == "  4294967295  7 " + std::string(1, sign) + " tag: ");
+        REQUIRE(header(100, 7, sign) == "  100  7 " + std::string(1, sign) + " tag: ");
+        // Colliding thread and sign
+        REQUIRE(header(100, 7 ^ 16, sign) == "  100  23 " + std::string(1, sign) + " tag: ");
+        REQUIRE(header(100, 18446744073709551615u, 'I') == "  100  18446744073709551615 I tag: ");
+    }
+
     SECTION("ConstructDestructLogger", "[logger]")
     {
         Log::Logger *logger;
@@ -271,4 +371,1801 @@ TEST_CASE("LoggerTest")
         REQUIRE(get(5, out) == std::string(__func__) + ':');
         REQUIRE(get(6, out) == msg);
     }
+
+    SECTION("AsyncLogger", "[logger]")
+    {
+        Log::Logger logger;
+        for(unsigned int i = 0; i < Log::levels; ++i)
+        {
+            logger.setStream(static_cast<Log::LogLevel >(i), out);
+        }
+        REQUIRE_NOTHROW(logger.enableAsync(16, Log::OverflowPolicy::Block));
+        for(size_t i = 0; i < 100; ++i)
+        {
+            REQUIRE_NOTHROW(logger.print(level, 0, __func__, msg));
+        }
+        REQUIRE_NOTHROW(logger.flush());
+        REQUIRE(logger.dropped() == 0);
+        REQUIRE(get(2, out) == std::to_string(getpid()));
+        REQUIRE(get(3, out) == strThID());
+        REQUIRE(get(5, out) == std::string(__func__) + ':');
+        REQUIRE(get(6, out) == msg);
+        auto str = out.str();
+        REQUIRE(std::count(str.begin(), str.end(), '\n') == 100);
+    }
+
+    SECTION("ShardedLogger", "[logger]")
+    {
+        constexpr size_t threads = 4;
+        constexpr size_t records = 500;
+        Log::Logger logger;
+        logger.setStream(level, out);
+        REQUIRE_NOTHROW(logger.enableSharded(threads, 64));
+        std::vector<std::thread> workers;
+        for(size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([&logger, level, i]()
+            {
+                for(size_t j = 0; j < records; ++j)
+                {
+                    logger.print(level, 0, "sharded", std::to_string(i) + ' ' + std::to_string(j));
+                }
+            });
+        }
+        for(auto & i : workers)
+        {
+            i.join();
+        }
+        logger.flush();
+        std::vector<size_t> next(threads, 0);
+        size_t lines = 0;
+        size_t unordered = 0;
+        std::string line;
+        while(std::getline(out, line))
+        {
+            std::istringstream fields(line.substr(line.find("sharded: ") + 9));
+            size_t thread;
+            size_t seq;
+            fields >> thread >> seq;
+            unordered += thread >= threads || seq != next[thread];
+            if(thread < threads)
+                next[thread] = seq + 1;
+            ++lines;
+        }
+        REQUIRE(lines == threads * records);
+        REQUIRE(unordered == 0);
+        REQUIRE(logger.dropped() == 0);
+    }
+
+    SECTION("ShardedReorderWindow", "[logger]")
+    {
+        // A record queued late into an empty queue is still printed before newer records of other queues
+        auto window = GENERATE(std::chrono::microseconds(0), std::chrono::microseconds(200000));
+        Log::LogStream lstr(sign, out, std::make_shared<std::mutex>());
+        auto record = [&lstr](const std::string &text, std::chrono::system_clock::time_point time)
+        {
+            Log::LogRecord result;
+            result.stream = &lstr;
+            result.tag = "reorder";
+            result.text = text;
+            result.lines.push_back({0, text.size()});
+            result.time = time;
+            result.tid = std::this_thread::get_id();
+            return result;
+        };
+        auto start = std::chrono::system_clock::now();
+        {
+            Log::AsyncWriter writer(64, Log::OverflowPolicy::Block, 2, window);
+            // Separate threads queue into separate shards
+            std::thread([&writer, &record, start]()
+            {
+                writer.push(record("newer", start));
+            }).join();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            std::thread([&writer, &record, start]()
+            {
+                writer.push(record("older", start - std::chrono::milliseconds(1)));
+            }).join();
+            writer.flush();
+        }
+        std::vector<std::string> texts;
+        std::string line;
+        while(std::getline(out, line))
+        {
+            texts.push_back(line.substr(line.find("reorder: ") + 9));
+        }
+        if(window.count() == 0)
+            REQUIRE(texts == std::vector<std::string>{"newer", "older"});
+        else
+            REQUIRE(texts == std::vector<std::string>{"older", "newer"});
+    }
+
+    SECTION("AsyncLoggerOverflow", "[logger]")
+    {
+        auto policy = GENERATE(Log::OverflowPolicy::DropNewest, Log::OverflowPolicy::DropOldest);
+        constexpr size_t threads = 4;
+        constexpr size_t count = 1000;
+        std::string str;
+        {
+            Log::Logger logger;
+            for(unsigned int i = 0; i < Log::levels; ++i)
+            {
+                logger.setStream(static_cast<Log::LogLevel >(i), out);
+            }
+            logger.enableAsync(4, policy);
+            std::vector<std::thread> workers;
+            for(size_t i = 0; i < threads; ++i)
+            {
+                workers.emplace_back([&logger, &msg, level]()
+                {
+                    for(size_t j = 0; j < count; ++j)
+                    {
+                        logger.print(level, 0, "overflow", msg);
+                    }
+                });
+            }
+            for(auto & i : workers)
+            {
+                i.join();
+            }
+            logger.flush();
+            str = out.str();
+            REQUIRE(size_t(std::count(str.begin(), str.end(), '\n')) + logger.dropped() == threads * count);
+        }
+        REQUIRE(out.str() == str);
+    }
+
+    SECTION("MultilineSingleWrite", "[log-stream]")
+    {
+        CountingBuf buf;
+        std::ostream counted(&buf);
+        Log::LogStream lstr(sign, counted, std::make_shared<std::mutex>());
+        std::string multiline;
+        for(size_t i = 0; i < 40; ++i)
+        {
+            multiline += msg + '\n';
+        }
+        multiline += msg;
+        REQUIRE_NOTHROW(Log::LogStream::printer<std::string>()(lstr, 0, scope, multiline));
+        REQUIRE(buf.syncs == 1);
+        auto str = buf.str();
+        REQUIRE(std::count(str.begin(), str.end(), '\n') == 41);
+    }
+
+    SECTION("NoInterleaveLogger", "[logger]")
+    {
+        constexpr size_t threads = 4;
+        constexpr size_t count = 200;
+        constexpr size_t lines = 10;
+        Log::Logger logger;
+        for(unsigned int i = 0; i < Log::levels; ++i)
+        {
+            logger.setStream(static_cast<Log::LogLevel >(i), out);
+        }
+        std::vector<std::thread> workers;
+        for(size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([&logger, level, i]()
+            {
+                std::string line = "thread" + std::to_string(i);
+                std::string multiline = line;
+                for(size_t j = 1; j < lines / 2; ++j)
+                {
+                    multiline += '\n' + line;
+                }
+                for(size_t j = 0; j < count; ++j)
+                {
+                    logger.print(level, 0, "interleave", multiline, multiline);
+                }
+            });
+        }
+        for(auto & i : workers)
+        {
+            i.join();
+        }
+        std::string line;
+        std::vector<std::string> bodies;
+        while(std::getline(out, line))
+        {
+            bodies.push_back(line.substr(line.rfind(' ') + 1));
+        }
+        REQUIRE(bodies.size() == threads * count * lines);
+        size_t interleaved = 0;
+        for(size_t i = 0; i < bodies.size(); i += lines)
+        {
+            for(size_t j = 1; j < lines; ++j)
+            {
+                interleaved += bodies[i + j] != bodies[i];
+            }
+        }
+        REQUIRE(interleaved == 0);
+    }
+
+    SECTION("FormatTime", "[timestamp]")
+    {
+        auto seconds = GENERATE(take(4, random(int64_t(0), int64_t(4000000000))));
+        auto nanoseconds = GENERATE(take(4, random(int64_t(0), int64_t(999999999))));
+        for(int64_t offset : {int64_t(0), int64_t(1), int64_t(999999999 - nanoseconds)})
+        {
+            std::chrono::system_clock::time_point time(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                    std::chrono::seconds(seconds) + std::chrono::nanoseconds(nanoseconds + offset)));
+            time_t ttime = std::chrono::system_clock::to_time_t(time);
+            tm ltime{};
+            std::stringstream expected;
+            expected << std::put_time(localtime_r(&ttime, &ltime), "%m-%d %T") << "." << std::setfill('0')
+                     << std::setw(9) << (nanoseconds + offset);
+            char buf[Log::timestampLength];
+            REQUIRE(Log::formatTime(time, buf) == buf + Log::timestampLength);
+            REQUIRE(std::string(buf, Log::timestampLength) == expected.str());
+        }
+    }
+
+    SECTION("ClockSource", "[timestamp]")
+    {
+        auto source = GENERATE(Log::ClockSource::Realtime, Log::ClockSource::CoarseRealtime, Log::ClockSource::Tsc);
+        auto before = std::chrono::system_clock::now();
+        auto time = Log::now(source);
+        auto after = std::chrono::system_clock::now();
+        REQUIRE(time >= before - std::chrono::milliseconds(50));
+        REQUIRE(time <= after + std::chrono::milliseconds(50));
+        if(source == Log::ClockSource::Tsc)
+        {
+            // Readings follow the realtime clock across anchors replaced every second
+            auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(1200);
+            std::chrono::system_clock::duration worst{0};
+            while(std::chrono::steady_clock::now() < end)
+            {
+                before = std::chrono::system_clock::now();
+                time = Log::now(source);
+                after = std::chrono::system_clock::now();
+                worst = std::max({worst, before - time, time - after});
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            REQUIRE(worst < std::chrono::milliseconds(1));
+        }
+
+        Log::LogStream lstr(sign, out, nullptr);
+        REQUIRE_NOTHROW(lstr.setClock(source));
+        REQUIRE(lstr.getClock() == source);
+        REQUIRE_NOTHROW(lstr.printStr(0, scope, msg));
+        REQUIRE(get(5, out) == scope + ':');
+        REQUIRE(get(6, out) == msg);
+    }
+
+    SECTION("FlushPolicy", "[log-stream]")
+    {
+        CountingBuf buf;
+        std::ostream counted(&buf);
+        Log::LogStream lstr(sign, counted, std::make_shared<std::mutex>());
+
+        REQUIRE_NOTHROW(lstr.setFlushPolicy(Log::FlushPolicy::manual()));
+        REQUIRE(lstr.getFlushPolicy().mode == Log::FlushMode::Manual);
+        for(size_t i = 0; i < 10; ++i)
+        {
+            lstr.printStr(0, scope, msg);
+        }
+        REQUIRE(buf.syncs == 0);
+        REQUIRE_NOTHROW(lstr.flush());
+        REQUIRE(buf.syncs == 1);
+
+        buf.syncs = 0;
+        REQUIRE_NOTHROW(lstr.setFlushPolicy(Log::FlushPolicy::everyBytes(1024)));
+        for(size_t i = 0; i < 100; ++i)
+        {
+            lstr.printStr(0, scope, msg);
+        }
+        size_t recordSize = buf.str().size() / 110;
+        size_t recordsPerFlush = (1024 + recordSize - 1) / recordSize;
+        REQUIRE(buf.syncs == 100 / recordsPerFlush);
+
+        buf.syncs = 0;
+        REQUIRE_NOTHROW(lstr.setFlushPolicy(Log::FlushPolicy::every(std::chrono::hours(1))));
+        for(size_t i = 0; i < 10; ++i)
+        {
+            lstr.printStr(0, scope, msg);
+        }
+        REQUIRE(buf.syncs == 0);
+
+        REQUIRE_NOTHROW(lstr.setCritical(true));
+        REQUIRE(lstr.critical());
+        for(size_t i = 0; i < 10; ++i)
+        {
+            lstr.printStr(0, scope, msg);
+        }
+        REQUIRE(buf.syncs == 10);
+    }
+
+    SECTION("FlushPolicyLogger", "[logger]")
+    {
+        CountingBuf buf;
+        std::ostream counted(&buf);
+        Log::Logger logger;
+        for(unsigned int i = 0; i < Log::levels; ++i)
+        {
+            logger.setStream(static_cast<Log::LogLevel >(i), counted);
+        }
+        REQUIRE_NOTHROW(logger.setFlushPolicy(Log::FlushPolicy::manual()));
+        REQUIRE_NOTHROW(logger.setFlushPolicy(Log::Error, Log::FlushPolicy::everyRecord()));
+        logger.print(Log::Info, 0, __func__, msg);
+        logger.print(Log::Warning, 0, __func__, msg);
+        REQUIRE(buf.syncs == 0);
+        logger.print(Log::Error, 0, __func__, msg);
+        REQUIRE(buf.syncs == 1);
+        logger.enableAsync();
+        logger.print(Log::Assert, 0, __func__, msg);
+        REQUIRE(buf.syncs == 2);
+        auto str = buf.str();
+        REQUIRE(std::count(str.begin(), str.end(), '\n') == 4);
+        logger.print(Log::Info, 0, __func__, msg);
+        REQUIRE_NOTHROW(logger.flush());
+        REQUIRE(buf.syncs > 2);
+        str = buf.str();
+        REQUIRE(std::count(str.begin(), str.end(), '\n') == 5);
+        logger.disableAsync();
+
+        // Errors flush pending output of every level waiting for them
+        std::stringstream infoOut;
+        std::stringstream errorOut;
+        logger.setStream(Log::Info, infoOut);
+        logger.setStream(Log::Warning, infoOut);
+        logger.setStream(Log::Error, errorOut);
+        logger.setFlushPolicy(Log::FlushPolicy::onError());
+        auto flushes = [&logger](Log::LogLevel level)
+        {
+            return logger.metrics().levels[level][Log::Counter::Flushes];
+        };
+        auto info = flushes(Log::Info);
+        auto warning = flushes(Log::Warning);
+        auto error = flushes(Log::Error);
+        logger.print(Log::Info, 0, __func__, msg);
+        logger.print(Log::Warning, 0, __func__, msg);
+        REQUIRE(flushes(Log::Info) == info);
+        REQUIRE(flushes(Log::Warning) == warning);
+        logger.print(Log::Error, 0, __func__, msg);
+        REQUIRE(flushes(Log::Info) == info + 1);
+        REQUIRE(flushes(Log::Warning) == warning + 1);
+        REQUIRE(flushes(Log::Error) == error + 1);
+        // Nothing pending, nothing flushed
+        logger.print(Log::Error, 0, __func__, msg);
+        REQUIRE(flushes(Log::Info) == info + 1);
+
+        // Output left pending by the write path is flushed by the timer
+        logger.setFlushPolicy(Log::Info, Log::FlushPolicy::every(std::chrono::milliseconds(20)));
+        logger.print(Log::Info, 0, __func__, msg);
+        logger.print(Log::Info, 0, __func__, msg);
+        info = flushes(Log::Info);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        REQUIRE(flushes(Log::Info) == info + 1);
+        logger.setFlushPolicy(Log::FlushPolicy::manual());
+    }
+
+    SECTION("ZeroAllocation", "[logger]")
+    {
+        NullBuf buf;
+        std::ostream null(&buf);
+        Log::Logger logger;
+        for(unsigned int i = 0; i < Log::levels; ++i)
+        {
+            logger.setStream(static_cast<Log::LogLevel >(i), null);
+        }
+        std::string_view view(msg);
+        std::string multiline = msg + '\n' + msg;
+        auto print = [&]()
+        {
+            logger.print(level, 0, __func__, msg, "const char * is a string literal in c++", view, multiline);
+            logger.print(level, 1, __PRETTY_FUNCTION__, 42, 3.14, true);
+        };
+        print();
+        size_t before = allocations;
+        print();
+        size_t after = allocations;
+        REQUIRE(after == before);
+
+        auto format = [&]()
+        {
+            logger.printFormat(level, 0, __func__, LOGGER_FORMAT_STRING("{} took {} us\n{}"), "", 42, 3.14, msg);
+        };
+        format();
+        before = allocations;
+        format();
+        after = allocations;
+        REQUIRE(after == before);
+    }
+
+    SECTION("ZeroAllocationAsync", "[logger]")
+    {
+        NullBuf buf;
+        std::ostream null(&buf);
+        Log::Logger logger;
+        logger.setStream(Log::Info, null);
+        std::string multiline = msg + '\n' + msg;
+        for(size_t shards : {size_t(1), size_t(2)})
+        {
+            constexpr size_t capacity = 64;
+            if(shards == 1)
+                logger.enableAsync(capacity);
+            else
+                logger.enableSharded(shards, capacity);
+            // Every queue slot keeps the memory of the largest record it held
+            auto print = [&]()
+            {
+                for(size_t i = 0; i < capacity * 2; ++i)
+                {
+                    logger.print(Log::Info, 0, __func__, multiline);
+                    logger.printFormat(Log::Info, 0, __func__, LOGGER_FORMAT_STRING("{} {}"), "", i, msg);
+                }
+                logger.flush();
+            };
+            print();
+            size_t before = totalAllocations.load();
+            print();
+            size_t after = totalAllocations.load();
+            REQUIRE(after == before);
+            REQUIRE(logger.queueHighWater() > 0);
+            REQUIRE(logger.queueHighWater() <= capacity);
+        }
+        logger.disableAsync();
+        REQUIRE(logger.queueHighWater() == 0);
+    }
+
+    SECTION("BufferStats", "[log-stream]")
+    {
+        NullBuf buf;
+        std::ostream null(&buf);
+        Log::LogStream stream('I', null, nullptr);
+        stream.printStr(0, __func__, msg);
+        auto stats = Log::bufferStats();
+        REQUIRE(stats.threads >= 1);
+        REQUIRE(stats.reserved > 0);
+        REQUIRE(stats.highWater >= stats.reserved);
+        REQUIRE(stats.limit == 1024 * 1024);
+
+        std::string huge(stats.limit, 'x');
+        stream.printStr(0, __func__, huge);
+        auto trimmed = Log::bufferStats();
+        REQUIRE(trimmed.trimmed == stats.trimmed + 1);
+        REQUIRE(trimmed.highWater > stats.limit);
+        REQUIRE(trimmed.reserved < stats.limit);
+
+        Log::setBufferLimit(4 * stats.limit);
+        stream.printStr(0, __func__, huge);
+        auto kept = Log::bufferStats();
+        REQUIRE(kept.trimmed == trimmed.trimmed);
+        REQUIRE(kept.reserved > stats.limit);
+        size_t before = allocations;
+        stream.printStr(0, __func__, huge);
+        REQUIRE(allocations == before);
+        Log::setBufferLimit(stats.limit);
+        stream.printStr(0, __func__, msg);
+        REQUIRE(Log::bufferStats().trimmed == kept.trimmed + 1);
+
+        size_t threads = Log::bufferStats().threads;
+        size_t running = 0;
+        std::thread([&](){
+            stream.printStr(0, __func__, msg);
+            running = Log::bufferStats().threads;
+        }).join();
+        REQUIRE(running == threads + 1);
+        REQUIRE(Log::bufferStats().threads == threads);
+    }
+
+    SECTION("LazyEvaluation", "[logger]")
+    {
+        static NullBuf nullBuf;
+        static std::ostream nullStream(&nullBuf);
+        size_t evaluated = 0;
+        auto evaluate = [&evaluated, &msg]()
+        {
+            ++evaluated;
+            return msg;
+        };
+
+        Log::Logger logger;
+        REQUIRE(logger.isEnabled(level));
+        REQUIRE_NOTHROW(logger.disableLevel(level));
+        REQUIRE_FALSE(logger.isEnabled(level));
+        REQUIRE_NOTHROW(logger.setStream(level, out));
+        REQUIRE(logger.isEnabled(level));
+
+        REQUIRE_NOTHROW(LOGGER_DISABLE_LEVEL(level));
+        LOGGER_LOG(level, __func__, evaluate());
+        REQUIRE(evaluated == 0);
+        REQUIRE_NOTHROW(LOGGER_SET_STREAM(level, nullStream));
+        LOGGER_LOG(level, __func__, evaluate());
+        REQUIRE(evaluated == 1);
+    }
+
+    SECTION("ReconfigureLogger", "[logger]")
+    {
+        constexpr size_t threads = 4;
+        Log::Logger logger;
+        for(unsigned int i = 0; i < Log::levels; ++i)
+        {
+            logger.setStream(static_cast<Log::LogLevel >(i), out);
+        }
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> workers;
+        for(size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([&logger, &stop, &msg, level]()
+            {
+                while(!stop.load())
+                {
+                    logger.print(level, 0, "reconfigure", msg);
+                }
+            });
+        }
+        for(size_t i = 0; i < 100; ++i)
+        {
+            logger.setStream(level, i % 2 ? out : out1);
+            logger.disableLevel(level);
+            logger.setFlushPolicy(level, Log::FlushPolicy::manual());
+            if(i % 10 == 0)
+                logger.enableAsync(64);
+            if(i % 10 == 5)
+                logger.disableAsync();
+            logger.setStream(level, out);
+        }
+        stop.store(true);
+        for(auto & i : workers)
+        {
+            i.join();
+        }
+        logger.flush();
+        std::string line;
+        size_t lines = 0;
+        size_t corrupted = 0;
+        while(std::getline(out, line))
+        {
+            corrupted += line.substr(line.rfind(' ') + 1) != msg;
+            ++lines;
+        }
+        REQUIRE(lines > 0);
+        REQUIRE(corrupted == 0);
+    }
+    SECTION("BinaryFormat", "[log-stream]")
+    {
+        Log::LogStream text(sign, out, nullptr);
+        Log::LogStream binary(sign, out1, nullptr);
+        binary.setFormat(Log::OutputFormat::Binary);
+        Log::LogRecord record;
+        record.time = std::chrono::system_clock::time_point(std::chrono::milliseconds(1546300800123));
+        record.tid = std::this_thread::get_id();
+        for(size_t i = 0; i < 3; ++i)
+        {
+            record.clear();
+            record.tag = i % 2 ? "other" : scope;
+            record.text = msg + "first" + msg;
+            record.lines = {{0, msg.size()}, {i, msg.size() + 5}};
+            text.printRecord(record);
+            binary.printRecord(record);
+        }
+        std::stringstream decoded;
+        Log::BinaryReader reader;
+        REQUIRE(reader.decode(out1, decoded));
+        REQUIRE(decoded.str() == out.str());
+        std::stringstream truncated(out1.str().substr(0, out1.str().size() - 1));
+        REQUIRE_FALSE(reader.decode(truncated, decoded));
+        REQUIRE_FALSE(reader.error().empty());
+        // Corrupt length prefixes and indents are reported without allocating what they claim
+        std::string hugeVarint = "\xff\xff\xff\xff\xff\xff\xff\xff\x7f";
+        std::stringstream corruptTag(std::string("T\0", 2) + hugeVarint + "tag");
+        Log::BinaryReader tagReader;
+        REQUIRE_FALSE(tagReader.decode(corruptTag, decoded));
+        REQUIRE(tagReader.error() == "truncated tag entry");
+        std::string header = out1.str().substr(0, 6) + std::string("T\0\3tag", 6);
+        std::stringstream corruptIndent(header + 'R' + std::string(8, '\0') + std::string("\1\1I\0\1", 5) +
+                                        hugeVarint + std::string("\1x", 2));
+        Log::BinaryReader indentReader;
+        REQUIRE_FALSE(indentReader.decode(corruptIndent, decoded));
+        REQUIRE(indentReader.error() == "truncated record");
+    }
+    SECTION("JsonEscape", "[log-stream]")
+    {
+        auto reference = [](const std::string &value)
+        {
+            std::string result;
+            for(char c : value)
+            {
+                auto u = static_cast<unsigned char>(c);
+                if(c == '"' || c == '\\')
+                    result += std::string("\\") + c;
+                else if(c == '\n')
+                    result += "\\n";
+                else if(c == '\r')
+                    result += "\\r";
+                else if(c == '\t')
+                    result += "\\t";
+                else if(c == '\b')
+                    result += "\\b";
+                else if(c == '\f')
+                    result += "\\f";
+                else if(u < 0x20)
+                {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", u);
+                    result += buf;
+                }
+                else
+                    result += c;
+            }
+            return result;
+        };
+        std::mt19937 random(uint32_t(msg.size()));
+        size_t mismatches = 0;
+        for(size_t i = 0; i < 2000; ++i)
+        {
+            std::string value(random() % 70, ' ');
+            // Mostly plain text, so runs longer than a vector register are covered
+            for(auto &c : value)
+                c = random() % 8 == 0 ? char(random() % 256) : char('a' + random() % 26);
+            std::string escaped;
+            Log::appendJsonEscaped(escaped, value);
+            if(escaped != reference(value))
+                ++mismatches;
+            size_t expected = std::find_if(value.begin(), value.end(), [](char c)
+            {
+                return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+            }) - value.begin();
+            if(Log::jsonEscapePosition(value) != expected)
+                ++mismatches;
+        }
+        REQUIRE(mismatches == 0);
+        std::string quoted;
+        Log::appendJsonString(quoted, std::string(20, 'x') + "\"\x01\x7f\xc3\xa9");
+        REQUIRE(quoted == "\"" + std::string(20, 'x') + "\\\"\\u0001\x7f\xc3\xa9\"");
+    }
+
+    SECTION("LineScan", "[log-stream]")
+    {
+        auto isControl = [](char c)
+        {
+            auto u = static_cast<unsigned char>(c);
+            return (u < 0x20 && c != '\t' && c != '\n') || u == 0x7f;
+        };
+        auto in = [](const std::string &line, size_t i, int first, int last)
+        {
+            return i < line.size() && static_cast<unsigned char>(line[i]) >= first &&
+                   static_cast<unsigned char>(line[i]) <= last;
+        };
+        auto sanitize = [&isControl, &in](const std::string &line, Log::ControlChars policy)
+        {
+            std::string result;
+            for(size_t i = 0; i < line.size();)
+            {
+                char c = line[i++];
+                if(!isControl(c) || policy == Log::ControlChars::Keep)
+                {
+                    result += c;
+                    continue;
+                }
+                if(policy == Log::ControlChars::Escape)
+                {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\x%02x", static_cast<unsigned char>(c));
+                    result += buf;
+                    continue;
+                }
+                if(c != '\x1b' || i == line.size())
+                    continue;
+                char kind = line[i++];
+                if(kind == '[')
+                {
+                    while(in(line, i, 0x30, 0x3f))
+                        ++i;
+                    while(in(line, i, 0x20, 0x2f))
+                        ++i;
+                    if(in(line, i, 0x40, 0x7e))
+                        ++i;
+                }
+                else if(std::string("]PX^_").find(kind) != std::string::npos)
+                {
+                    while(i < line.size() && line[i] != '\a' && line.compare(i, 2, "\x1b\\") != 0)
+                        ++i;
+                    i = std::min(line.size(), i + (i < line.size() && line[i] == '\a' ? 1 : 2));
+                }
+                else
+                {
+                    --i;
+                    while(in(line, i, 0x20, 0x2f))
+                        ++i;
+                    if(in(line, i, 0x30, 0x7e))
+                        ++i;
+                }
+            }
+            return result;
+        };
+        auto reference = [&sanitize](const std::string &value, Log::ControlChars policy)
+        {
+            std::vector<std::string> lines;
+            size_t start = 0;
+            for(size_t pos = value.find('\n'); pos != std::string::npos; pos = value.find('\n', start))
+            {
+                lines.push_back(sanitize(value.substr(start, pos - start), policy));
+                start = pos + 1;
+            }
+            lines.push_back(sanitize(value.substr(start), policy));
+            return lines;
+        };
+        struct LineSink : Log::Sink
+        {
+            std::vector<std::string> lines;
+
+            void write(const std::string_view *, size_t) override
+            {}
+
+            void writeRecord(const Log::LogRecord &record, const std::string_view *, size_t) override
+            {
+                size_t pos = 0;
+                for(const auto &line : record.lines)
+                {
+                    lines.push_back(record.text.substr(pos, line.length));
+                    pos += line.length;
+                }
+            }
+        };
+        auto sink = std::make_shared<LineSink>();
+        Log::Logger logger;
+        logger.setStream(Log::Info, sink);
+
+        const char alphabet[] = "abc \t\n\n\x1b\x1b[]P;0m\\\a\r\x01\x7f\xc3\xa9";
+        std::mt19937 random(uint32_t(msg.size()));
+        size_t mismatches = 0;
+        for(size_t i = 0; i < 3000; ++i)
+        {
+            std::string value(random() % 100, ' ');
+            // Mostly plain text, so runs longer than a vector register are covered by every implementation
+            for(auto &c : value)
+                c = random() % 8 == 0 ? alphabet[random() % (sizeof(alphabet) - 1)] : char('a' + random() % 26);
+            std::string_view view(value);
+            view.remove_prefix(std::min<size_t>(view.size(), random() % 4));
+            for(bool controls : {false, true})
+            {
+                size_t expected = std::find_if(view.begin(), view.end(), [controls, &isControl](char c)
+                {
+                    return c == '\n' || (controls && isControl(c));
+                }) - view.begin();
+                if(Log::lineScanPosition(view, controls) != expected)
+                    ++mismatches;
+            }
+            auto policy = Log::ControlChars(i % 3);
+            logger.setControlChars(Log::Info, policy);
+            sink->lines.clear();
+            // Both the string path and the path splitting formatted text
+            logger.print(Log::Info, 0, scope, value);
+            logger.printFormat(Log::Info, 0, scope, LOGGER_FORMAT_STRING("{}"), "", value);
+            auto expected = reference(value, policy);
+            auto doubled = expected;
+            doubled.insert(doubled.end(), expected.begin(), expected.end());
+            if(sink->lines != doubled)
+                ++mismatches;
+        }
+        REQUIRE(mismatches == 0);
+
+        logger.setControlChars(Log::Info, Log::ControlChars::Keep);
+        sink->lines.clear();
+        logger.print(Log::Info, 0, scope, std::string("\nfirst\n\nlast\n"));
+        REQUIRE(sink->lines == std::vector<std::string>{"", "first", "", "last", ""});
+        const std::string colored = "\x1b[1;31mred\x1b[0m \x1b]0;title\a\rdone";
+        logger.setControlChars(Log::Info, Log::ControlChars::Escape);
+        sink->lines.clear();
+        logger.print(Log::Info, 0, scope, colored);
+        REQUIRE(sink->lines == std::vector<std::string>{"\\x1b[1;31mred\\x1b[0m \\x1b]0;title\\x07\\x0ddone"});
+        logger.setControlChars(Log::Info, Log::ControlChars::Strip);
+        sink->lines.clear();
+        logger.print(Log::Info, 0, scope, colored);
+        REQUIRE(sink->lines == std::vector<std::string>{"red done"});
+    }
+
+    SECTION("KeyValueLogger", "[logger]")
+    {
+        Log::Logger logger;
+        logger.setStream(level, out);
+        int id = 42;
+        double dt = 12.5;
+        std::string name = "a b";
+        logger.printKV(level, 0, "kv", "first\nsecond", "user", id, "latency_us", dt, "ok", true, "name", name,
+                       "plain", "x", "bad", std::numeric_limits<double>::infinity(), "id", std::this_thread::get_id());
+        std::string line;
+        std::getline(out, line);
+        REQUIRE(line.substr(line.size() - 5) == "first");
+        std::getline(out, line);
+        REQUIRE(line.substr(line.find("kv: ")) == "kv: second user=42 latency_us=12.5 ok=true name=\"a b\" plain=x "
+                                                    "bad=inf id=" + strThID());
+        REQUIRE_FALSE(std::getline(out, line));
+
+        logger.setFormat(level, Log::OutputFormat::Json);
+        out.str(std::string());
+        out.clear();
+        auto time = std::chrono::system_clock::now();
+        logger.printKV(level, 1, "k\"v", "first\nsecond\t", "user", id, "latency_us", dt, "ok", false,
+                       "name", name, "bad", std::numeric_limits<double>::quiet_NaN());
+        std::getline(out, line);
+        std::string rest;
+        REQUIRE_FALSE(std::getline(out, rest));
+        REQUIRE(line.front() == '{');
+        REQUIRE(line.back() == '}');
+        auto begin = line.find("\"time\":") + 7;
+        auto ns = std::stoll(line.substr(begin, line.find(',', begin) - begin));
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+        REQUIRE(std::abs(ns / 1000000 - ms) < 10000);
+        REQUIRE(line.find(",\"pid\":" + std::to_string(getpid()) + ",\"tid\":" +
+                          std::to_string(Log::threadNumber(std::this_thread::get_id())) + ",\"level\":\"") !=
+                std::string::npos);
+        REQUIRE(line.substr(line.find(",\"tag\":")) == ",\"tag\":\"k\\\"v\",\"msg\":\"first\\nsecond\\t\","
+                "\"user\":42,\"latency_us\":12.5,\"ok\":false,\"name\":\"a b\",\"bad\":\"nan\"}");
+
+        // Binary format keeps fields as text of the last line
+        logger.setFormat(level, Log::OutputFormat::Binary);
+        out.str(std::string());
+        out.clear();
+        logger.printKV(level, 0, "kv", msg, "user", id);
+        std::stringstream decoded;
+        Log::BinaryReader reader;
+        REQUIRE(reader.decode(out, decoded));
+        line = decoded.str();
+        REQUIRE(line.substr(line.find("kv: ")) == "kv: " + msg + " user=42\n");
+
+        NullBuf buf;
+        std::ostream null(&buf);
+        logger.setStream(level, null);
+        logger.setFormat(level, Log::OutputFormat::Json);
+        auto print = [&]()
+        {
+            logger.printKV(level, 0, __func__, msg, "user", id, "latency_us", dt, "name", name);
+        };
+        print();
+        size_t before = allocations;
+        print();
+        REQUIRE(allocations == before);
+    }
+
+    SECTION("FormatLogger", "[logger]")
+    {
+        Log::defaultLog.setStream(level, out);
+        std::string_view view = msg;
+        LOGGER_LOG_FMT(level, "fmt", "conn {} took {:.2} us, {:x} {:X} {} {} {}{} {{{}}}",
+                       -42, 1.5, 255u, 3054ull, true, view, 'c', msg.c_str(), msg);
+        LOGGER_LOG_FMT(level, "fmt", "plain }} text");
+        LOGGER_LOG_FMT(level, "fmt", "{}", "first\nsecond");
+        std::vector<std::string> lines;
+        std::string line;
+        while(std::getline(out, line))
+        {
+            lines.push_back(line.substr(line.find("fmt: ") + 5));
+        }
+        REQUIRE(lines.size() == 4);
+        REQUIRE(lines[0] == "conn -42 took 1.50 us, ff BEE true " + msg + " c" + msg + " {" + msg + "}");
+        REQUIRE(lines[1] == "plain } text");
+        REQUIRE(lines[2] == "first");
+        REQUIRE(lines[3] == "second");
+
+        constexpr Log::ArgKind kinds[] = {Log::ArgKind::Integer, Log::ArgKind::Floating};
+        static_assert(Log::checkFormat("{} {:.3}", kinds, 2) == Log::FormatError::None);
+        static_assert(Log::checkFormat("{:x} {}", kinds, 2) == Log::FormatError::None);
+        static_assert(Log::checkFormat("{} {:x}", kinds, 2) == Log::FormatError::InvalidSpec);
+        static_assert(Log::checkFormat("{:.3} {}", kinds, 2) == Log::FormatError::InvalidSpec);
+        static_assert(Log::checkFormat("{} {", kinds, 2) == Log::FormatError::UnmatchedBrace);
+        static_assert(Log::checkFormat("{} }", kinds, 1) == Log::FormatError::UnmatchedBrace);
+        static_assert(Log::checkFormat("{} {} {}", kinds, 2) == Log::FormatError::TooFewArguments);
+        static_assert(Log::checkFormat("{}", kinds, 2) == Log::FormatError::TooManyArguments);
+    }
+    SECTION("MappedFile", "[logger]")
+    {
+        constexpr size_t threads = 4;
+        constexpr size_t records = 1000;
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".log";
+        std::remove(path.c_str());
+        {
+            // Leftovers of a crashed process: ranges of records that were not copied, completely or
+            // partially, and a partial record followed by preallocated zeros
+            std::ofstream crashed(path, std::ios::binary);
+            crashed << "first\n" << std::string(100, '\0');
+            crashed << "cut" << std::string(50, '\0');
+            crashed << "partial";
+            crashed << std::string(10000, '\0');
+        }
+        {
+            Log::MappedFile file(path, 4096);
+            REQUIRE(file.is_open());
+            REQUIRE(file.size() == 18);
+            Log::Logger logger;
+            logger.setStream(level, file);
+            // Records of several parts written directly by the sink stay contiguous
+            Log::MappedFileSink sink(file);
+            std::vector<std::thread> workers;
+            for(size_t i = 0; i < threads; ++i)
+            {
+                workers.emplace_back([&logger, &sink, &msg, level]()
+                {
+                    std::string_view parts[] = {"direct ", msg, "\n"};
+                    for(size_t j = 0; j < records; ++j)
+                    {
+                        logger.print(level, 0, "mapped", msg);
+                        sink.write(parts, std::size(parts));
+                    }
+                });
+            }
+            for(auto & i : workers)
+            {
+                i.join();
+            }
+            REQUIRE(file.good());
+        }
+        std::ifstream in(path, std::ios::binary);
+        std::string line;
+        REQUIRE(std::getline(in, line));
+        REQUIRE(line == "first");
+        REQUIRE(std::getline(in, line));
+        REQUIRE(line == "cut");
+        REQUIRE(std::getline(in, line));
+        REQUIRE(line == "partial");
+        size_t lines = 0;
+        size_t corrupted = 0;
+        while(std::getline(in, line))
+        {
+            corrupted += line.substr(line.rfind(' ') + 1) != msg;
+            ++lines;
+        }
+        REQUIRE(lines == 2 * threads * records);
+        REQUIRE(corrupted == 0);
+        std::remove(path.c_str());
+    }
+    SECTION("RotatingFile", "[logger]")
+    {
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".rotating.log";
+        auto compression = GENERATE(Log::Compression::None, Log::Compression::Gzip);
+        Log::RotationPolicy policy;
+        policy.maxSize = 4096;
+        policy.generations = 3;
+        policy.compression = compression;
+        std::string extension;
+        {
+            Log::RotatingFile file(path, policy);
+            REQUIRE(file.is_open());
+            if(file.compression() == Log::Compression::Gzip)
+                extension = ".gz";
+            Log::Logger logger;
+            logger.setStream(level, file);
+            for(size_t i = 0; i < 500; ++i)
+            {
+                logger.print(level, 0, "rotating", msg);
+            }
+            file.waitRotated();
+        }
+        auto size = [](const std::string &name)
+        {
+            std::ifstream in(name, std::ios::binary | std::ios::ate);
+            return in ? int64_t(in.tellg()) : int64_t(-1);
+        };
+        REQUIRE(size(path) > 0);
+        REQUIRE(size(path) <= 4096);
+        for(size_t i = 1; i <= 3; ++i)
+        {
+            std::string name = path + '.' + std::to_string(i) + extension;
+            REQUIRE(size(name) > 0);
+            if(extension.empty())
+                REQUIRE(size(name) <= 4096);
+            else
+            {
+                std::ifstream in(name, std::ios::binary);
+                REQUIRE(in.get() == 0x1f);
+                REQUIRE(in.get() == 0x8b);
+            }
+            std::remove(name.c_str());
+        }
+        REQUIRE(size(path + ".4" + extension) == -1);
+        std::remove(path.c_str());
+    }
+    SECTION("RotatingBinaryFile", "[logger]")
+    {
+        // Every rotated file starts with its own header and tag entries
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".rotating.bin";
+        Log::RotationPolicy policy;
+        policy.maxSize = 1024;
+        policy.generations = 3;
+        policy.compression = Log::Compression::None;
+        {
+            Log::RotatingFile file(path, policy);
+            Log::Logger logger;
+            logger.setStream(level, file);
+            logger.setFormat(level, Log::OutputFormat::Binary);
+            for(size_t i = 0; i < 400; ++i)
+            {
+                logger.print(level, 0, i % 2 == 0 ? "even" : "odd", std::to_string(i));
+            }
+            file.waitRotated();
+        }
+        for(const auto &name : {path, path + ".1", path + ".2", path + ".3"})
+        {
+            std::ifstream in(name, std::ios::binary);
+            REQUIRE(in.get() == 'H');
+            in.seekg(0);
+            std::stringstream decoded;
+            Log::BinaryReader reader;
+            REQUIRE(reader.decode(in, decoded));
+            std::string line;
+            REQUIRE(std::getline(decoded, line));
+            REQUIRE(line.find(": ") != std::string::npos);
+            std::remove(name.c_str());
+        }
+    }
+    SECTION("RotatingFileInterval", "[logger]")
+    {
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".interval.log";
+        Log::RotationPolicy policy;
+        policy.interval = std::chrono::milliseconds(50);
+        policy.compression = Log::Compression::None;
+        {
+            Log::RotatingFile file(path, policy);
+            Log::Logger logger;
+            logger.setStream(level, file);
+            logger.print(level, 0, "interval", msg);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            logger.print(level, 0, "interval", msg);
+            file.waitRotated();
+        }
+        std::ifstream current(path);
+        std::ifstream rotated(path + ".1");
+        std::string line;
+        REQUIRE(std::getline(current, line));
+        REQUIRE(std::getline(rotated, line));
+        REQUIRE_FALSE(std::getline(rotated, line));
+        std::remove(path.c_str());
+        std::remove((path + ".1").c_str());
+    }
+
+    SECTION("RateLimitLogger", "[logger]")
+    {
+        Log::Logger logger;
+        logger.setStream(level, out);
+        logger.setRateLimit(level, {10, 3});
+        Log::CallSite site;
+        Log::CallSite other;
+        size_t allowed = 0;
+        for(size_t i = 0; i < 1000; ++i)
+        {
+            if(logger.allow(level, "limited", site))
+            {
+                logger.print(level, 0, "limited", msg);
+                ++allowed;
+            }
+        }
+        REQUIRE(allowed == 3);
+        REQUIRE(logger.allow(level, "limited", other));
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        REQUIRE(logger.allow(level, "limited", site));
+        std::vector<std::string> lines;
+        std::string line;
+        while(std::getline(out, line))
+        {
+            lines.push_back(line.substr(line.find("limited: ")));
+        }
+        REQUIRE(lines.size() == 4);
+        REQUIRE(lines[2] == "limited: " + msg);
+        REQUIRE(lines[3] == "limited: suppressed 997 messages");
+        logger.setRateLimit(level, {0, 0});
+        for(size_t i = 0; i < 100; ++i)
+        {
+            REQUIRE(logger.allow(level, "limited", site));
+        }
+
+        // Every expansion of a macro is a call site of its own
+        std::stringstream macroOut;
+        LOGGER_SET_STREAM(Log::Warning, macroOut);
+        LOGGER_SET_RATE_LIMIT(Log::Warning, 1, 2);
+        size_t evaluated = 0;
+        for(size_t i = 0; i < 10; ++i)
+        {
+            LOG_WARNING(std::to_string(++evaluated));
+            LOG_WARNING_FMT("{}", i);
+        }
+        LOGGER_SET_RATE_LIMIT(Log::Warning, 0, 0);
+        LOGGER_SET_STREAM(Log::Warning, std::cout);
+        REQUIRE(evaluated == 2);
+        size_t count = 0;
+        while(std::getline(macroOut, line))
+        {
+            ++count;
+        }
+        REQUIRE(count == 4);
+    }
+
+    SECTION("CallSites", "[logger]")
+    {
+        std::stringstream siteOut;
+        LOGGER_SET_STREAM(Log::Warning, siteOut);
+        auto printed = [&siteOut, &msg]()
+        {
+            siteOut.str(std::string());
+            siteOut.clear();
+            siteLogger(msg);
+            std::string line;
+            std::vector<std::string> tags;
+            while(std::getline(siteOut, line))
+            {
+                auto end = line.find(": ");
+                tags.push_back(line.substr(line.rfind(' ', end) + 1, end - line.rfind(' ', end) - 1));
+            }
+            return tags;
+        };
+        REQUIRE(printed() == std::vector<std::string>{"siteLogger", "site-tag"});
+
+        std::vector<Log::CallSiteInfo> sites;
+        for(const auto &site : Log::callSites())
+        {
+            if(std::string(site.function) == "siteLogger")
+                sites.push_back(site);
+        }
+        REQUIRE(sites.size() == 2);
+        REQUIRE(sites[0].tag == "siteLogger");
+        REQUIRE(sites[1].tag == "site-tag");
+        REQUIRE(sites[1].line == sites[0].line + 1);
+        REQUIRE(sites[0].level == Log::Warning);
+        REQUIRE(std::string(sites[0].file).find("Test.cpp") != std::string::npos);
+        REQUIRE(sites[0].id != 0);
+        REQUIRE(sites[1].id != sites[0].id);
+        REQUIRE(Log::callSite(sites[1].id).tag == "site-tag");
+        REQUIRE(Log::callSite(0).id == 0);
+
+        auto filtered = Log::defaultLog.metrics().levels[Log::Warning][Log::Counter::Filtered];
+        auto suppressed = Log::defaultLog.metrics().levels[Log::Warning][Log::Counter::Suppressed];
+        LOGGER_DISABLE_SITES(Log::SiteMatch::Tag, "site-*");
+        REQUIRE(printed() == std::vector<std::string>{"siteLogger"});
+        REQUIRE(Log::defaultLog.metrics().levels[Log::Warning][Log::Counter::Filtered] == filtered + 1);
+        REQUIRE(Log::defaultLog.metrics().levels[Log::Warning][Log::Counter::Suppressed] == suppressed);
+        REQUIRE_FALSE(Log::callSite(sites[1].id).enabled);
+        LOGGER_DISABLE_SITES(Log::SiteMatch::Function, "site*");
+        REQUIRE(printed().empty());
+        LOGGER_ENABLE_SITES(Log::SiteMatch::File, "*Test.cpp");
+        REQUIRE(printed().size() == 2);
+        LOGGER_DISABLE_SITES(Log::SiteMatch::Function, "site*");
+        REQUIRE(printed().empty());
+        Log::resetSites();
+        REQUIRE(printed().size() == 2);
+        REQUIRE(Log::callSites().size() >= 2);
+
+        // Tag expressions are evaluated once by every macro
+        siteOut.clear();
+        size_t tagCalls = 0;
+        auto nextTag = [&tagCalls]()
+        {
+            ++tagCalls;
+            return "counted";
+        };
+        LOGGER_LOG(Log::Warning, nextTag(), std::string("tagged"));
+        LOGGER_LOG_FMT(Log::Warning, nextTag(), "{}", 1);
+        LOGGER_LOG_KV(Log::Warning, nextTag(), msg, "key", 1);
+        {
+            LOGGER_SCOPE(Log::Warning, nextTag(), "scope");
+        }
+        REQUIRE(tagCalls == 4);
+        REQUIRE(siteOut.str().find("counted: tagged") != std::string::npos);
+        LOGGER_SET_STREAM(Log::Warning, std::cout);
+
+        // The registry is not left locked in a child forked while another thread holds it
+        std::atomic<bool> stop(false);
+        std::thread reader([&stop]()
+        {
+            while(!stop.load())
+            {
+                Log::resetSites();
+            }
+        });
+        size_t failed = 0;
+        for(size_t i = 0; i < 20; ++i)
+        {
+            pid_t pid = fork();
+            if(pid == 0)
+            {
+                Log::resetSites();
+                _exit(Log::callSites().empty() ? 1 : 0);
+            }
+            int status = 0;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while(waitpid(pid, &status, WNOHANG) == 0)
+            {
+                if(std::chrono::steady_clock::now() > deadline)
+                {
+                    kill(pid, SIGKILL);
+                    waitpid(pid, &status, 0);
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+        stop.store(true);
+        reader.join();
+        REQUIRE(failed == 0);
+    }
+
+    SECTION("ScopeLogger", "[logger]")
+    {
+        std::stringstream scopeOut;
+        LOGGER_SET_STREAM(Log::Info, scopeOut);
+        auto printed = [&scopeOut]()
+        {
+            std::string line;
+            std::vector<std::string> lines;
+            while(std::getline(scopeOut, line))
+            {
+                std::string text = line.substr(line.find(": ") + 2);
+                // Durations vary, only their presence is checked
+                auto duration = text.find(" duration_us=");
+                lines.push_back(duration == std::string::npos ? text : text.substr(0, duration + 13));
+            }
+            scopeOut.str(std::string());
+            scopeOut.clear();
+            return lines;
+        };
+
+        scopedRequest(std::chrono::milliseconds(0));
+        REQUIRE(printed() == std::vector<std::string>{
+                "request scope=enter",
+                "    fast scope=enter",
+                "    fast scope=exit duration_us=",
+                "    slow scope=enter",
+                "    slow scope=exit duration_us=",
+                "request scope=exit duration_us="});
+        REQUIRE(Log::Scope::indent() == 0);
+
+        // Only scopes slower than the threshold and the scopes they are in are printed
+        LOGGER_SET_SCOPE_THRESHOLD(std::chrono::milliseconds(20));
+        scopedRequest(std::chrono::milliseconds(0));
+        REQUIRE(printed().empty());
+        scopedRequest(std::chrono::milliseconds(30));
+        std::string slowExit = scopeOut.str();
+        // A deferred enter record keeps the time the scope was entered
+        auto secondsOf = [&slowExit](const std::string &text)
+        {
+            std::string line = slowExit.substr(slowExit.rfind('\n', slowExit.find(text)) + 1);
+            return std::stod(line.substr(6, 2)) * 3600 + std::stod(line.substr(9, 2)) * 60 +
+                   std::stod(line.substr(12, 12));
+        };
+        REQUIRE(std::fmod(secondsOf("slow scope=exit") - secondsOf("slow scope=enter") + 86400, 86400) >= 0.029);
+        slowExit = slowExit.substr(slowExit.find("slow scope=exit duration_us=") + 28);
+        REQUIRE(std::stod(slowExit) >= 30000);
+        REQUIRE(printed() == std::vector<std::string>{
+                "request scope=enter",
+                "    slow scope=enter",
+                "    slow scope=exit duration_us=",
+                "request scope=exit duration_us="});
+
+        // A message printed inside a fast scope prints the scope around it
+        {
+            LOG_SCOPE("quiet");
+            LOG_INFO(msg);
+        }
+        REQUIRE(printed() == std::vector<std::string>{"quiet scope=enter", "    " + msg,
+                                                      "quiet scope=exit duration_us="});
+
+        // Scopes are not messages, the rate limit of their call site does not apply to them
+        LOGGER_SET_SCOPE_THRESHOLD(std::chrono::nanoseconds(0));
+        LOGGER_SET_RATE_LIMIT(Log::Info, 1, 1);
+        for(size_t i = 0; i < 3; ++i)
+        {
+            LOG_SCOPE("limited");
+        }
+        LOGGER_SET_RATE_LIMIT(Log::Info, 0, 1);
+        REQUIRE(printed().size() == 6);
+
+        // Scopes of a disabled level do nothing
+        LOGGER_DISABLE_LEVEL(Log::Info);
+        {
+            LOG_SCOPE("disabled");
+            REQUIRE(Log::Scope::indent() == 0);
+        }
+        LOGGER_SET_SCOPE_THRESHOLD(std::chrono::nanoseconds(0));
+        REQUIRE(printed().empty());
+        // Setting a stream enables the level again
+        LOGGER_SET_STREAM(Log::Info, std::cout);
+    }
+
+    SECTION("RepeatSuppression", "[logger]")
+    {
+        Log::Logger logger;
+        logger.setStream(level, out);
+        logger.setRepeatSuppression(level, true);
+        for(size_t i = 0; i < 5; ++i)
+        {
+            logger.print(level, 0, scope, msg);
+        }
+        logger.print(level, 0, scope, msg + '1');
+        logger.print(level, 0, scope, msg + '1');
+        logger.print(level, 0, scope, msg);
+        logger.flush();
+        logger.print(level, 0, scope, msg);
+        logger.flush();
+        std::vector<std::string> lines;
+        std::string line;
+        while(std::getline(out, line))
+        {
+            lines.push_back(line.substr(line.find(scope + ": ") + scope.size() + 2));
+        }
+        REQUIRE(lines.size() == 6);
+        REQUIRE(lines[0] == msg);
+        REQUIRE(lines[1] == "last message repeated 4 times");
+        REQUIRE(lines[2] == msg + '1');
+        REQUIRE(lines[3] == "last message repeated 1 time");
+        REQUIRE(lines[4] == msg);
+        REQUIRE(lines[5] == "last message repeated 1 time");
+    }
+
+    SECTION("SinkLogger", "[logger]")
+    {
+        struct RecordSink : Log::Sink
+        {
+            std::vector<std::string> tags;
+            std::string bytes;
+
+            void write(const std::string_view *parts, size_t count) override
+            {
+                for(size_t i = 0; i < count; ++i)
+                {
+                    bytes.append(parts[i]);
+                }
+            }
+
+            void writeRecord(const Log::LogRecord &record, const std::string_view *parts, size_t count) override
+            {
+                tags.push_back(record.tag);
+                write(parts, count);
+            }
+        };
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".sink.log";
+        auto records = std::make_shared<RecordSink>();
+        auto ring = std::make_shared<Log::RingSink>(256);
+        auto fd = std::make_shared<Log::FdSink>(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644), true);
+        {
+            Log::Logger logger;
+            logger.setStream(Log::Info, records);
+            logger.setStream(Log::Warning, ring);
+            logger.setStream(Log::Error, fd);
+            logger.setStream(Log::Verbose, std::make_shared<Log::NullSink>());
+            logger.setStream(Log::Assert, fd);
+            logger.setFormat(Log::Assert, Log::OutputFormat::Binary);
+            logger.print(Log::Info, 0, scope, msg, msg);
+            logger.print(Log::Info, 0, "other", msg);
+            for(size_t i = 0; i < 100; ++i)
+            {
+                logger.print(Log::Warning, 0, "ring", i);
+            }
+            logger.print(Log::Error, 0, scope, msg + "\nsecond");
+            logger.print(Log::Verbose, 0, scope, msg);
+            logger.print(Log::Assert, 0, scope, msg);
+        }
+        REQUIRE(records->tags == std::vector<std::string>{scope, "other"});
+        REQUIRE(std::count(records->bytes.begin(), records->bytes.end(), '\n') == 3);
+        std::string kept = ring->contents();
+        REQUIRE(kept.size() <= 256);
+        REQUIRE(kept.size() > 100);
+        REQUIRE(kept.find("ring: 99\n") == kept.size() - 9);
+        REQUIRE(kept.find("ring: 98\n") != std::string::npos);
+        REQUIRE(kept.find("ring: 0\n") == std::string::npos);
+        std::ifstream file(path);
+        std::string line;
+        REQUIRE(std::getline(file, line));
+        REQUIRE(line.substr(line.find(": ") + 2) == msg);
+        REQUIRE(std::getline(file, line));
+        REQUIRE(line.substr(line.find(": ") + 2) == "second");
+        // Binary records follow text ones in the same file
+        REQUIRE(file.get() == 'H');
+        std::remove(path.c_str());
+    }
+
+    SECTION("BatchSinkLogger", "[logger]")
+    {
+        constexpr size_t threads = 4;
+        constexpr size_t count = 500;
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".batch.log";
+        // Records larger than the ring are written directly, in order with records of the ring
+        auto oversized = GENERATE(false, true);
+        auto paddingOf = [oversized](size_t j)
+        {
+            return std::string(oversized && j % 50 == 0 ? 1500 : j % 300, 'x');
+        };
+        for(bool uring : {false, true})
+        {
+            Log::BatchPolicy policy;
+            // Small chunks, so records span chunks and threads wait for free ones
+            policy.chunkSize = 256;
+            policy.chunks = 4;
+            policy.uring = uring;
+            auto sink = std::make_shared<Log::BatchSink>(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644),
+                                                         true, policy);
+            if(!uring)
+            {
+                REQUIRE_FALSE(sink->usesUring());
+            }
+            Log::Logger logger;
+            logger.setStream(Log::Info, sink);
+            logger.setFlushPolicy(Log::Info, Log::FlushPolicy::manual());
+            std::vector<std::thread> workers;
+            for(size_t i = 0; i < threads; ++i)
+            {
+                workers.emplace_back([&logger, &paddingOf, i]()
+                {
+                    for(size_t j = 0; j < count; ++j)
+                    {
+                        logger.print(Log::Info, 0, "batch",
+                                     std::to_string(i) + ' ' + std::to_string(j) + ' ' + paddingOf(j));
+                    }
+                });
+            }
+            for(auto &worker : workers)
+            {
+                worker.join();
+            }
+            logger.flush();
+            Log::BatchStats stats = sink->stats();
+            std::ifstream file(path);
+            std::string line;
+            std::vector<size_t> next(threads, 0);
+            size_t lines = 0;
+            size_t bytes = 0;
+            bool ordered = true;
+            while(std::getline(file, line))
+            {
+                bytes += line.size() + 1;
+                ++lines;
+                // Records of every thread are complete and in order
+                std::istringstream text(line.substr(line.find(": ") + 2));
+                size_t worker = threads;
+                size_t index = 0;
+                std::string padding;
+                text >> worker >> index >> padding;
+                ordered = ordered && worker < threads && index == next[worker]++ && padding == paddingOf(index);
+            }
+            REQUIRE(ordered);
+            REQUIRE(lines == threads * count);
+            REQUIRE(stats.bytes == bytes);
+            REQUIRE(stats.batches <= lines);
+            if(!oversized)
+            {
+                REQUIRE(stats.largestBatch <= policy.chunkSize * policy.chunks);
+            }
+        }
+        std::remove(path.c_str());
+    }
+
+    SECTION("FlightRecorder", "[logger]")
+    {
+        auto ring = std::make_shared<Log::RingSink>(64 * 1024);
+        Log::Logger logger;
+        for(unsigned int i = 0; i < Log::levels; ++i)
+        {
+            logger.disableLevel(static_cast<Log::LogLevel >(i));
+        }
+        logger.setStream(Log::Error, ring);
+        REQUIRE_FALSE(logger.isEnabled(Log::Verbose));
+        logger.enableFlightRecorder(1024);
+        // Captured levels are evaluated but not printed
+        REQUIRE(logger.isAccepted(Log::Verbose));
+        REQUIRE_FALSE(logger.isEnabled(Log::Verbose));
+        REQUIRE(logger.isEnabled(Log::Error));
+        for(size_t i = 0; i < 100; ++i)
+        {
+            logger.print(Log::Verbose, 0, "context", i);
+        }
+        logger.print(Log::Info, 0, "context", std::string("first\nsecond"));
+        REQUIRE(ring->contents().empty());
+        REQUIRE(logger.metrics().levels[Log::Verbose][Log::Counter::Captured] == 100);
+        REQUIRE(logger.metrics().levels[Log::Verbose][Log::Counter::Suppressed] == 0);
+        logger.print(Log::Error, 0, "failure", msg);
+        auto lines = [&ring]()
+        {
+            std::vector<std::string> result;
+            std::istringstream in(ring->contents());
+            std::string line;
+            while(std::getline(in, line))
+            {
+                result.push_back(line.substr(Log::timestampLength));
+            }
+            return result;
+        };
+        auto captured = lines();
+        REQUIRE(captured.size() > 3);
+        REQUIRE(captured.size() < 40);
+        REQUIRE(captured.back().find(" E failure: " + msg) != std::string::npos);
+        REQUIRE(captured[captured.size() - 2].find(" I context: second") != std::string::npos);
+        REQUIRE(captured[captured.size() - 3].find(" I context: first") != std::string::npos);
+        REQUIRE(captured[captured.size() - 4].find(" V context: 99") != std::string::npos);
+        // Captured messages are printed only once
+        ring->clear();
+        logger.print(Log::Error, 0, "failure", msg);
+        REQUIRE(lines().size() == 1);
+
+        // Messages of other threads are printed on request
+        ring->clear();
+        std::string otherThread;
+        std::thread([&logger, &otherThread]()
+        {
+            otherThread = strThID();
+            logger.print(Log::Verbose, 0, "worker", std::string("captured"));
+            logger.dumpFlightRecorder();
+        }).join();
+        captured = lines();
+        REQUIRE(captured.size() == 1);
+        REQUIRE(captured[0].find("  " + otherThread + " V worker: captured") != std::string::npos);
+
+        // Messages of exited threads are kept until they are printed
+        ring->clear();
+        std::thread([&logger]()
+        {
+            logger.print(Log::Verbose, 0, "exited", std::string("captured"));
+        }).join();
+        logger.dumpFlightRecorder();
+        captured = lines();
+        REQUIRE(captured.size() == 1);
+        REQUIRE(captured[0].find(" V exited: captured") != std::string::npos);
+        ring->clear();
+        logger.dumpFlightRecorder();
+        REQUIRE(ring->contents().empty());
+
+        ring->clear();
+        logger.dumpOnSignal(SIGUSR1);
+        logger.print(Log::Verbose, 0, "signal", std::string("captured"));
+        raise(SIGUSR1);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while(ring->contents().empty() && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        REQUIRE(ring->contents().find(" V signal: captured\n") != std::string::npos);
+
+        logger.disableFlightRecorder();
+        REQUIRE_FALSE(logger.isAccepted(Log::Verbose));
+    }
+
+    SECTION("MetricsLogger", "[logger]")
+    {
+        Log::Logger logger;
+        for(unsigned int i = 0; i < Log::levels; ++i)
+        {
+            logger.setStream(static_cast<Log::LogLevel >(i), out);
+        }
+        Log::LogLevel other = Log::LogLevel((level + 1) % Log::levels);
+        logger.disableLevel(other);
+        logger.print(level, 0, __func__, msg);
+        logger.print(level, 0, __func__, msg + '\n' + msg);
+        logger.print(other, 0, __func__, msg);
+        REQUIRE_FALSE(logger.admit(other));
+        REQUIRE(logger.admit(level));
+        logger.flush();
+        auto snapshot = logger.metrics();
+        auto counters = snapshot.levels[level];
+        REQUIRE(counters[Log::Counter::Messages] == 2);
+        REQUIRE(counters[Log::Counter::Lines] == 3);
+        REQUIRE(counters[Log::Counter::Bytes] == out.str().size());
+        REQUIRE(counters[Log::Counter::Flushes] >= 1);
+        REQUIRE(counters[Log::Counter::Suppressed] == 0);
+        REQUIRE(snapshot.levels[other][Log::Counter::Suppressed] == 2);
+        REQUIRE(snapshot.levels[other][Log::Counter::Messages] == 0);
+        REQUIRE(snapshot.queueCapacity == 0);
+
+        std::stringstream text;
+        logger.writeMetrics(text);
+        REQUIRE(text.str().find("# TYPE logger_messages_total counter\n") != std::string::npos);
+        std::string names[] = {"info", "verbose", "warning", "error", "assert", "debug"};
+        REQUIRE(text.str().find("logger_messages_total{level=\"" + names[level] + "\"} 2\n") != std::string::npos);
+        REQUIRE(text.str().find("logger_lines_total{level=\"" + names[level] + "\"} 3\n") != std::string::npos);
+        REQUIRE(text.str().find("logger_async") == std::string::npos);
+
+        logger.enableAsync(64, Log::OverflowPolicy::DropNewest);
+        logger.print(level, 0, __func__, msg);
+        logger.flush();
+        snapshot = logger.metrics();
+        REQUIRE(snapshot.levels[level][Log::Counter::Messages] == 3);
+        REQUIRE(snapshot.queueCapacity == 64);
+        REQUIRE(snapshot.queueHighWater >= 1);
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".prom";
+        REQUIRE(logger.dumpMetrics(path));
+        text.str(std::string());
+        logger.writeMetrics(text);
+        std::ifstream file(path);
+        std::string dumped((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        REQUIRE(dumped == text.str());
+        REQUIRE(dumped.find("logger_async_queue_capacity 64\n") != std::string::npos);
+        std::remove(path.c_str());
+        REQUIRE_FALSE(logger.dumpMetrics(std::string(P_tmpdir) + "/LoggerTest.missing/metrics.prom"));
+        logger.disableAsync();
+
+        auto mutex = std::make_shared<std::mutex>();
+        Log::StreamMetrics metrics;
+        Log::LogStream stream(sign, out, mutex);
+        stream.setMetrics(&metrics);
+        mutex->lock();
+        std::thread writer([&]()
+        {
+            stream.printStr(0, __func__, msg);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        mutex->unlock();
+        writer.join();
+        REQUIRE(metrics.read()[Log::Counter::LockWait] >= 10000000);
+        REQUIRE(metrics.read()[Log::Counter::Messages] == 1);
+    }
+
+    SECTION("ForkLogger", "[logger]")
+    {
+        // Children fork while other threads log, buffered output must not be duplicated and
+        // locks, pid and the background thread must work in the child
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".fork.log";
+        // A sink with its own lock and thread is quiesced after the logger writing into it
+#ifdef __SANITIZE_THREAD__
+        // ThreadSanitizer cannot track threads started in a child of a multi-threaded process
+        auto shards = GENERATE(size_t(0));
+        auto batched = GENERATE(false);
+#else
+        auto shards = GENERATE(size_t(0), size_t(2));
+        auto batched = GENERATE(false, true);
+#endif
+        constexpr size_t threads = 4;
+        constexpr size_t forks = 20;
+        std::vector<pid_t> children;
+        std::vector<size_t> produced(threads, 0);
+        size_t failed = 0;
+        {
+            std::ofstream file;
+            Log::Logger logger;
+            if(batched)
+                logger.setStream(level, std::make_shared<Log::BatchSink>(
+                        open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644), true));
+            else
+            {
+                file.open(path);
+                logger.setStream(level, file);
+            }
+            logger.setFlushPolicy(level, Log::FlushPolicy::manual());
+            if(shards != 0)
+                logger.enableSharded(shards, 64);
+            std::atomic<bool> stop(false);
+            std::vector<std::thread> workers;
+            for(size_t i = 0; i < threads; ++i)
+            {
+                workers.emplace_back([&logger, &stop, &produced, level, i]()
+                {
+                    size_t j = 0;
+                    for(; !stop.load(); ++j)
+                    {
+                        logger.print(level, 0, "worker", std::to_string(i) + ' ' + std::to_string(j));
+                    }
+                    produced[i] = j;
+                });
+            }
+            for(size_t i = 0; i < forks; ++i)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                pid_t pid = fork();
+                if(pid == 0)
+                {
+                    logger.print(level, 0, "child", std::to_string(i));
+                    logger.disableAsync();
+                    logger.flush();
+                    _exit(0);
+                }
+                children.push_back(pid);
+            }
+            for(pid_t pid : children)
+            {
+                int status = 0;
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                while(waitpid(pid, &status, WNOHANG) == 0)
+                {
+                    if(std::chrono::steady_clock::now() > deadline)
+                    {
+                        kill(pid, SIGKILL);
+                        waitpid(pid, &status, 0);
+                        break;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            }
+            stop.store(true);
+            for(auto & i : workers)
+            {
+                i.join();
+            }
+        }
+        REQUIRE(failed == 0);
+        std::ifstream in(path);
+        std::set<std::pair<size_t, size_t>> records;
+        std::vector<size_t> childLines(forks, 0);
+        size_t duplicates = 0;
+        size_t foreignPid = 0;
+        std::string line;
+        while(std::getline(in, line))
+        {
+            auto pos = line.find("child: ");
+            if(pos != std::string::npos)
+            {
+                size_t i = std::min<size_t>(std::stoul(line.substr(pos + 7)), forks - 1);
+                ++childLines[i];
+                foreignPid += line.find("  " + std::to_string(children[i]) + "  ") == std::string::npos;
+                continue;
+            }
+            pos = line.find("worker: ");
+            std::istringstream fields(line.substr(pos == std::string::npos ? 0 : pos + 8));
+            size_t thread = threads;
+            size_t seq = 0;
+            fields >> thread >> seq;
+            duplicates += !records.insert({thread, seq}).second;
+        }
+        REQUIRE(duplicates == 0);
+        REQUIRE(foreignPid == 0);
+        REQUIRE(std::count(childLines.begin(), childLines.end(), 1) == forks);
+        size_t total = 0;
+        for(size_t i : produced)
+        {
+            total += i;
+        }
+        REQUIRE(records.size() == total);
+        std::remove(path.c_str());
+    }
+    SECTION("ForkRotatingLogger", "[logger]")
+    {
+        // Fork while other threads rotate the file, the logger must not wait for an output locked before it
+        // ThreadSanitizer cannot track the rotation thread restarted in a child of a multi-threaded process
+#ifndef __SANITIZE_THREAD__
+        std::string path = std::string(P_tmpdir) + "/LoggerTest." + std::to_string(getpid()) + ".forkrotating.log";
+        auto shards = GENERATE(size_t(0), size_t(2));
+        constexpr size_t forks = 10;
+        Log::RotationPolicy policy;
+        policy.maxSize = 1024;
+        policy.generations = 2;
+        policy.compression = Log::Compression::None;
+        size_t failed = 0;
+        {
+            Log::RotatingFile file(path, policy);
+            Log::Logger logger;
+            logger.setStream(level, file);
+            if(shards != 0)
+                logger.enableSharded(shards, 64);
+            std::atomic<bool> stop(false);
+            std::vector<std::thread> workers;
+            for(size_t i = 0; i < 2; ++i)
+            {
+                workers.emplace_back([&logger, &stop, &msg, level]()
+                {
+                    while(!stop.load())
+                    {
+                        logger.print(level, 0, "rotating", msg);
+                    }
+                });
+            }
+            std::vector<pid_t> children;
+            for(size_t i = 0; i < forks; ++i)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                pid_t pid = fork();
+                if(pid == 0)
+                {
+                    logger.print(level, 0, "child", msg);
+                    logger.disableAsync();
+                    logger.flush();
+                    _exit(0);
+                }
+                children.push_back(pid);
+            }
+            stop.store(true);
+            for(auto & i : workers)
+            {
+                i.join();
+            }
+            for(pid_t pid : children)
+            {
+                int status = 0;
+                waitpid(pid, &status, 0);
+                failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            }
+            file.waitRotated();
+        }
+        REQUIRE(failed == 0);
+        std::remove(path.c_str());
+        std::remove((path + ".1").c_str());
+        std::remove((path + ".2").c_str());
+#endif
+    }
 }
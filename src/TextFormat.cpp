@@ -0,0 +1,104 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "TextFormat.h"
+#include "Json.h"
+#include "StringBuf.h"
+#include "Timestamp.h"
+#include <charconv>
+#include <functional>
+#include <ostream>
+
+namespace
+{
+    /*!
+     * Rendered constant part of a line header
+     */
+    struct HeaderCache
+    {
+        bool valid = false;
+        uint64_t pid = 0;
+        uint64_t tid = 0;
+        char sign = 0;
+        size_t length = 0;
+        char text[48];
+    };
+
+    constexpr size_t headerCacheSize = 16;
+}
+
+uint64_t Log::threadNumber(std::thread::id tid)
+{
+    thread_local std::thread::id cachedId;
+    thread_local uint64_t cachedNumber = 0;
+    thread_local std::string text;
+    thread_local Log::StringBuf buf(text);
+    thread_local std::ostream str(&buf);
+    if (tid == cachedId)
+        return cachedNumber;
+    text.clear();
+    str << tid;
+    uint64_t number;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), number);
+    if (result.ec != std::errc() || result.ptr != text.data() + text.size())
+        number = std::hash<std::thread::id>()(tid);
+    cachedId = tid;
+    cachedNumber = number;
+    return number;
+}
+
+void Log::appendHeader(std::string &out, std::chrono::system_clock::time_point time, uint64_t pid, uint64_t tid,
+                       char sign, std::string_view tag)
+{
+    // "  <pid>  <tid> <sign> " only changes with the stream, thread or after fork, render it once
+    thread_local HeaderCache cache[headerCacheSize];
+    HeaderCache &entry = cache[(tid ^ uint64_t(uint8_t(sign))) % headerCacheSize];
+    if (!entry.valid || entry.pid != pid || entry.tid != tid || entry.sign != sign)
+    {
+        char *pos = entry.text;
+        *pos++ = ' ';
+        *pos++ = ' ';
+        pos = std::to_chars(pos, entry.text + sizeof(entry.text), pid).ptr;
+        *pos++ = ' ';
+        *pos++ = ' ';
+        pos = std::to_chars(pos, entry.text + sizeof(entry.text), tid).ptr;
+        *pos++ = ' ';
+        *pos++ = sign;
+        *pos++ = ' ';
+        entry.length = size_t(pos - entry.text);
+        entry.pid = pid;
+        entry.tid = tid;
+        entry.sign = sign;
+        entry.valid = true;
+    }
+    char buf[timestampLength];
+    out.append(buf, formatTime(time, buf));
+    out.append(entry.text, entry.length);
+    out.append(tag);
+    out.append(": ", 2);
+}
+
+void Log::appendIndent(std::string &out, size_t indent)
+{
+    out.append(indent * 4, ' ');
+}
+
+void Log::appendFields(std::string &out, const LogRecord &record)
+{
+    std::string_view text = record.fieldText;
+    for (const auto &field : record.fields)
+    {
+        std::string_view key = text.substr(0, field.keyLength);
+        std::string_view value = text.substr(field.keyLength, field.valueLength);
+        text.remove_prefix(field.keyLength + field.valueLength);
+        out.push_back(' ');
+        out.append(key);
+        out.push_back('=');
+        if (field.quoted && (value.empty() || value.find_first_of(" =") != std::string_view::npos ||
+                             jsonEscapePosition(value) != value.size()))
+            appendJsonString(out, value);
+        else
+            out.append(value);
+    }
+}
@@ -0,0 +1,54 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_TEXTFORMAT_H
+#define LOGGER_TEXTFORMAT_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "LogRecord.h"
+
+namespace Log
+{
+    /*!
+     * Convert thread id into the number printed for it in text logs
+     * @param tid Thread id
+     * @return Thread number
+     */
+    uint64_t threadNumber(std::thread::id tid);
+
+    /*!
+     * Append text log line header "<time>  <pid>  <tid> <sign> <tag>: "
+     * Part between time and tag is rendered once per thread for every pid, tid and sign combination,
+     * so a changed pid after fork is picked up without explicit invalidation
+     * @param out String to append to
+     * @param time Record time
+     * @param pid Process id
+     * @param tid Thread number
+     * @param sign Level sign
+     * @param tag Record tag
+     */
+    void appendHeader(std::string &out, std::chrono::system_clock::time_point time, uint64_t pid, uint64_t tid,
+                      char sign, std::string_view tag);
+
+    /*!
+     * Append line indentation
+     * @param out String to append to
+     * @param indent Indentation level
+     */
+    void appendIndent(std::string &out, size_t indent);
+
+    /*!
+     * Append key-value fields of a record as " key=value" pairs
+     * String values containing spaces, '=' or characters escaped in JSON are quoted and escaped like JSON strings
+     * @param out String to append to
+     * @param record Record
+     */
+    void appendFields(std::string &out, const LogRecord &record);
+}
+
+#endif //LOGGER_TEXTFORMAT_H
@@ -0,0 +1,218 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "Timestamp.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define LOGGER_HAS_TSC 1
+#else
+#define LOGGER_HAS_TSC 0
+#endif
+
+namespace
+{
+    constexpr int64_t nsPerSecond = 1000000000;
+
+    const char digitPairs[] =
+            "00010203040506070809"
+            "10111213141516171819"
+            "20212223242526272829"
+            "30313233343536373839"
+            "40414243444546474849"
+            "50515253545556575859"
+            "60616263646566676869"
+            "70717273747576777879"
+            "80818283848586878889"
+            "90919293949596979899";
+
+    inline void put2(char *out, unsigned value)
+    {
+        std::memcpy(out, digitPairs + 2 * value, 2);
+    }
+
+    /*!
+     * Writes exactly 9 digits
+     */
+    inline void put9(char *out, uint32_t value)
+    {
+        out[8] = char('0' + value % 10);
+        value /= 10;
+        for (int i = 6; i >= 0; i -= 2)
+        {
+            put2(out + i, value % 100);
+            value /= 100;
+        }
+    }
+
+    /*!
+     * "MM-DD HH:MM:SS" of the last formatted second
+     */
+    struct SecondCache
+    {
+        time_t second = -1;
+        char prefix[14];
+    };
+
+    thread_local SecondCache secondCache;
+
+    inline int64_t clockNs(clockid_t clock)
+    {
+        timespec ts{};
+        clock_gettime(clock, &ts);
+        return int64_t(ts.tv_sec) * nsPerSecond + ts.tv_nsec;
+    }
+
+    std::chrono::system_clock::time_point fromNs(int64_t ns)
+    {
+        return std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(ns)));
+    }
+
+#if LOGGER_HAS_TSC
+    /*!
+     * Time stamp counter value matching a CLOCK_REALTIME reading
+     * Every reanchor() takes a new pair and measures the tick rate since the previous one, so the counter
+     * follows adjustments of the realtime clock. Published with a sequence lock, readers never wait:
+     * while an anchor is being replaced they read the realtime clock instead.
+     */
+    class TscAnchor
+    {
+    private:
+        static constexpr int64_t minSpan = 1000000;     //!< Shortest span the first rate is measured over
+        static constexpr int64_t maxAge = nsPerSecond;  //!< Age of an anchor that is replaced
+
+        std::atomic<uint64_t> _sequence{0};
+        std::atomic<uint64_t> _tsc0{0};
+        std::atomic<int64_t> _ns0{0};
+        std::atomic<double> _nsPerTick{0};
+
+        int64_t reanchor(uint64_t sequence, uint64_t tsc0, int64_t ns0)
+        {
+            uint64_t tsc1 = __rdtsc();
+            int64_t ns1 = clockNs(CLOCK_REALTIME);
+            // Span too short to measure the rate, or another thread replaces the anchor already
+            if ((_nsPerTick.load(std::memory_order_relaxed) == 0 && ns1 - ns0 < minSpan) || tsc1 <= tsc0 ||
+                !_sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire))
+                return ns1;
+            std::atomic_thread_fence(std::memory_order_release);
+            _nsPerTick.store(double(ns1 - ns0) / double(tsc1 - tsc0), std::memory_order_relaxed);
+            _tsc0.store(tsc1, std::memory_order_relaxed);
+            _ns0.store(ns1, std::memory_order_relaxed);
+            _sequence.store(sequence + 2, std::memory_order_release);
+            return ns1;
+        }
+    public:
+        const bool valid;
+
+        TscAnchor(): valid(invariant())
+        {
+            _tsc0.store(__rdtsc(), std::memory_order_relaxed);
+            _ns0.store(clockNs(CLOCK_REALTIME), std::memory_order_relaxed);
+        }
+
+        static bool invariant()
+        {
+            unsigned eax, ebx, ecx, edx;
+            return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+        }
+
+        int64_t now()
+        {
+            uint64_t sequence = _sequence.load(std::memory_order_acquire);
+            if (sequence & 1)
+                return clockNs(CLOCK_REALTIME);
+            uint64_t tsc0 = _tsc0.load(std::memory_order_relaxed);
+            int64_t ns0 = _ns0.load(std::memory_order_relaxed);
+            double nsPerTick = _nsPerTick.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_sequence.load(std::memory_order_relaxed) != sequence)
+                return clockNs(CLOCK_REALTIME);
+            uint64_t tsc = __rdtsc();
+            auto ns = static_cast<int64_t>(double(static_cast<int64_t>(tsc - tsc0)) * nsPerTick);
+            if (nsPerTick == 0 || tsc < tsc0 || ns >= maxAge)
+                return reanchor(sequence, tsc0, ns0);
+            return ns0 + ns;
+        }
+    };
+
+    TscAnchor &tsc()
+    {
+        static TscAnchor anchor;
+        return anchor;
+    }
+#endif
+}
+
+std::chrono::system_clock::time_point Log::now(ClockSource source)
+{
+    switch (source)
+    {
+        case ClockSource::CoarseRealtime:
+#ifdef CLOCK_REALTIME_COARSE
+            return fromNs(clockNs(CLOCK_REALTIME_COARSE));
+#else
+            break;
+#endif
+        case ClockSource::Tsc:
+        {
+#if LOGGER_HAS_TSC
+            TscAnchor &anchor = tsc();
+            if (anchor.valid)
+                return fromNs(anchor.now());
+#endif
+            break;
+        }
+        case ClockSource::Realtime:
+            break;
+    }
+    return fromNs(clockNs(CLOCK_REALTIME));
+}
+
+char *Log::formatTime(std::chrono::system_clock::time_point time, char *out)
+{
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    int64_t sec = ns / nsPerSecond;
+    int64_t frac = ns % nsPerSecond;
+    if (frac < 0)
+    {
+        frac += nsPerSecond;
+        --sec;
+    }
+    SecondCache &cache = secondCache;
+    if (cache.second != time_t(sec))
+    {
+        time_t t = time_t(sec);
+        tm ltime{};
+        localtime_r(&t, &ltime);
+        put2(cache.prefix, unsigned(ltime.tm_mon + 1));
+        cache.prefix[2] = '-';
+        put2(cache.prefix + 3, unsigned(ltime.tm_mday));
+        cache.prefix[5] = ' ';
+        put2(cache.prefix + 6, unsigned(ltime.tm_hour));
+        cache.prefix[8] = ':';
+        put2(cache.prefix + 9, unsigned(ltime.tm_min));
+        cache.prefix[11] = ':';
+        put2(cache.prefix + 12, unsigned(ltime.tm_sec));
+        cache.second = t;
+    }
+    std::memcpy(out, cache.prefix, sizeof(cache.prefix));
+    out[14] = '.';
+    put9(out + 15, uint32_t(frac));
+    return out + timestampLength;
+}
+
+bool Log::tscAvailable()
+{
+#if LOGGER_HAS_TSC
+    return tsc().valid;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,52 @@
+// Copyright 2019 Sviatoslav Dmitriev
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef LOGGER_TIMESTAMP_H
+#define LOGGER_TIMESTAMP_H
+
+#include <chrono>
+#include <cstddef>
+
+namespace Log
+{
+    /*!
+     * Clock used to timestamp log records
+     */
+    enum class ClockSource
+    {
+        Realtime,       //!< CLOCK_REALTIME, nanosecond precision
+        CoarseRealtime, //!< CLOCK_REALTIME_COARSE, cheaper but only precise to a scheduler tick
+        Tsc,            //!< Time stamp counter anchored to CLOCK_REALTIME every second, requires an invariant TSC
+    };
+
+    /*!
+     * Length of a formatted timestamp "MM-DD HH:MM:SS.nnnnnnnnn"
+     */
+    constexpr size_t timestampLength = 24;
+
+    /*!
+     * Get current time
+     * Falls back to ClockSource::Realtime if the requested clock is not available
+     * @param source Clock to read
+     * @return Current time
+     */
+    std::chrono::system_clock::time_point now(ClockSource source);
+
+    /*!
+     * Format a timestamp in local time as "MM-DD HH:MM:SS.nnnnnnnnn"
+     * Date and time part is cached per thread and only recalculated when the second changes
+     * @param time Time to format
+     * @param out Buffer of at least timestampLength characters, not null terminated
+     * @return Pointer past the last written character
+     */
+    char *formatTime(std::chrono::system_clock::time_point time, char *out);
+
+    /*!
+     * Check if the time stamp counter can be used as a clock source
+     * @return true if ClockSource::Tsc is backed by an invariant time stamp counter
+     */
+    bool tscAvailable();
+}
+
+#endif //LOGGER_TIMESTAMP_H